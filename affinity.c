@@ -0,0 +1,185 @@
+/*****************************************************************************/
+/*                           CSC209-24s A3 CSCSHELL                          */
+/*       Copyright 2024 -- Demetres Kostas PhD (aka Darlene Heliokinde)      */
+/*****************************************************************************/
+
+#include "cscshell.h"
+
+
+static const char *pin_policy_names[] = {"off", "adjacent", "l3", "spread"};
+#define NUM_PIN_POLICIES (sizeof(pin_policy_names) / sizeof(pin_policy_names[0]))
+
+static int pin_policy = PIN_OFF;
+
+/*
+** The CPUs the shell may run on, in order, and for each one the lowest
+** numbered CPU sharing its L3 cache (which names the L3 domain), or -1 when
+** sysfs doesn't say. Read once, the first time a stage is pinned.
+*/
+static int *topology_cpus = NULL;
+static int *topology_l3 = NULL;
+static int topology_size = 0;
+
+// Where the current pipeline starts, picked when its first stage is pinned
+static int pipeline_base = 0;
+
+// The CPUs picked for the next child, which applies them itself
+static cpu_set_t stage_set;
+static uint8_t stage_pending = 0;
+
+
+/* HELPERS */
+
+/**
+ * @brief Reads the first integer out of a small sysfs file
+ *
+ * @return int: the integer, -1 if the file can't be read
+ */
+static int read_sysfs_int(int cpu, int index, const char *file){
+    char path[MAX_PATH_STR];
+    snprintf(path, MAX_PATH_STR, CPU_SYSFS_FMT, cpu, index, file);
+    FILE *stream = fopen(path, "r");
+    if (stream == NULL){
+        return -1;
+    }
+    int value;
+    if (fscanf(stream, "%d", &value) != 1){
+        value = -1;
+    }
+    fclose(stream);
+    return value;
+}
+
+/**
+ * @brief Finds the L3 domain of a CPU. shared_cpu_list starts with the
+ * lowest numbered CPU of the domain, which is all we need to tell them apart.
+ *
+ * @return int: the lowest CPU sharing the L3 cache, -1 if unknown
+ */
+static int l3_domain(int cpu){
+    for (int index = 0; ; index++){
+        int level = read_sysfs_int(cpu, index, "level");
+        if (level < 0){
+            return -1;
+        }
+        if (level == 3){
+            return read_sysfs_int(cpu, index, "shared_cpu_list");
+        }
+    }
+}
+
+/**
+ * @brief Loads the CPU topology, unless it is loaded
+ *
+ * @return int: 0 on success, -1 on error
+ */
+static int load_topology(void){
+    if (topology_size > 0){
+        return 0;
+    }
+
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0){
+        perror("pin");
+        return -1;
+    }
+    int count = CPU_COUNT(&allowed);
+    topology_cpus = malloc(sizeof(int) * count);
+    topology_l3 = malloc(sizeof(int) * count);
+    if (topology_cpus == NULL || topology_l3 == NULL){
+        perror("pin");
+        free(topology_cpus);
+        free(topology_l3);
+        topology_cpus = topology_l3 = NULL;
+        return -1;
+    }
+
+    for (int cpu = 0; cpu < CPU_SETSIZE && topology_size < count; cpu++){
+        if (!CPU_ISSET(cpu, &allowed)) continue;
+        topology_cpus[topology_size] = cpu;
+        topology_l3[topology_size] = l3_domain(cpu);
+        topology_size++;
+    }
+    return 0;
+}
+
+/**
+ * @brief Finds the position of the CPU the shell is running on, so each
+ * pipeline starts next to where its data was last touched.
+ *
+ * @return int: an index into topology_cpus
+ */
+static int current_position(void){
+    int cpu = sched_getcpu();
+    for (int i = 0; i < topology_size; i++){
+        if (topology_cpus[i] == cpu){
+            return i;
+        }
+    }
+    return 0;
+}
+
+
+/* SHELL EXTENSION FUNCTIONS */
+
+int set_pin_policy(const char *name){
+    for (int i = 0; i < NUM_PIN_POLICIES; i++){
+        if (strcmp(pin_policy_names[i], name) == 0){
+            pin_policy = i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+const char *pin_policy_name(void){
+    return pin_policy_names[pin_policy];
+}
+
+int pin_stage(int stage, int num_stages){
+    stage_pending = 0;
+    if (pin_policy == PIN_OFF){
+        return 0;
+    }
+    if (load_topology() < 0){
+        return -1;
+    }
+    if (stage == 0){
+        pipeline_base = current_position();
+    }
+
+    cpu_set_t *set = &stage_set;
+    CPU_ZERO(set);
+    int n = topology_size;
+    if (pin_policy == PIN_ADJACENT){
+        // one core each, side by side
+        CPU_SET(topology_cpus[(pipeline_base + stage) % n], set);
+    }
+    else if (pin_policy == PIN_L3){
+        // every stage may use any core that shares the first stage's L3,
+        // and the scheduler balances them within it
+        int domain = topology_l3[pipeline_base];
+        for (int i = 0; i < n; i++){
+            if (topology_l3[i] == domain){
+                CPU_SET(topology_cpus[i], set);
+            }
+        }
+    }
+    else {
+        // one core each, as far apart as the stages allow
+        CPU_SET(topology_cpus[(pipeline_base + (long) stage * n / num_stages) % n], set);
+    }
+    stage_pending = 1;
+    return 0;
+}
+
+void apply_stage_pin(void){
+    // placement failures are reported, but the stage still runs
+    if (stage_pending && sched_setaffinity(0, sizeof(stage_set), &stage_set) < 0){
+        perror("pin");
+    }
+}
+
+void clear_stage_pin(void){
+    stage_pending = 0;
+}
@@ -0,0 +1,252 @@
+/*****************************************************************************/
+/*                           CSC209-24s A3 CSCSHELL                          */
+/*       Copyright 2024 -- Demetres Kostas PhD (aka Darlene Heliokinde)      */
+/*****************************************************************************/
+
+#include "cscshell.h"
+#include <ctype.h>
+
+
+/*
+** A recursive descent evaluator, working straight off the text. Precedence,
+** lowest first: == !=, < <= > >=, + -, * / %, unary + - !, then numbers,
+** variables and parentheses. Any error sets failed; the rest of the
+** expression is still walked, but its value no longer matters.
+*/
+typedef struct ArithParser {
+    const char *pos;
+    const char *end;
+    Variable *variables;
+    uint8_t failed;
+} ArithParser;
+
+static int64_t parse_equality(ArithParser *parser);
+
+
+/* HELPERS */
+
+static void skip_space(ArithParser *parser){
+    while (parser->pos < parser->end && isspace(*parser->pos)){
+        parser->pos++;
+    }
+}
+
+/**
+ * @brief Consumes op if it is next (and isn't the start of a longer one)
+ *
+ * @return int: 1 if consumed, 0 if not
+ */
+static int accept_op(ArithParser *parser, const char *op){
+    skip_space(parser);
+    size_t len = strlen(op);
+    if (parser->end - parser->pos < len || strncmp(parser->pos, op, len) != 0){
+        return 0;
+    }
+    // "<" must not take the start of "<=", nor "=" half of "=="
+    if (len == 1 && parser->pos + 1 < parser->end && parser->pos[1] == '=' &&
+        strchr("<>!=", *op) != NULL){
+        return 0;
+    }
+    parser->pos += len;
+    return 1;
+}
+
+/**
+ * @brief Reads the value of a variable (or positional parameter) as a
+ * number. Unset variables are 0, as in other shells.
+ */
+static int64_t variable_value(ArithParser *parser, const char *name, size_t len){
+    char var_name[len + 1];
+    strncpy(var_name, name, len);
+    var_name[len] = '\0';
+
+    const char *value = NULL;
+    if (isdigit(var_name[0])){
+        parse_volatile = 1;
+        int index = atoi(var_name);
+        for (int i = 0; positional_params != NULL && i <= index; i++){
+            if (positional_params[i] == NULL) break;
+            if (i == index) value = positional_params[i];
+        }
+    }
+    else {
+        Variable *variable = search_for_var(&parser->variables, var_name);
+        value = variable == NULL ? NULL : variable->value;
+    }
+    if (value == NULL || *value == '\0'){
+        return 0;
+    }
+
+    char *end;
+    errno = 0;
+    long long number = strtoll(value, &end, 0);
+    if (errno != 0 || *end != '\0'){
+        parser->failed = 1;
+        return 0;
+    }
+    return number;
+}
+
+static int64_t parse_primary(ArithParser *parser){
+    skip_space(parser);
+    if (parser->pos >= parser->end){
+        parser->failed = 1;
+        return 0;
+    }
+
+    if (accept_op(parser, "(")){
+        int64_t value = parse_equality(parser);
+        if (!accept_op(parser, ")")){
+            parser->failed = 1;
+        }
+        return value;
+    }
+
+    if (isdigit(*parser->pos)){
+        char *end;
+        errno = 0;
+        long long number = strtoll(parser->pos, &end, 0);
+        if (errno != 0 || end > parser->end){
+            parser->failed = 1;
+        }
+        parser->pos = end;
+        return number;
+    }
+
+    // NAME, $NAME, ${NAME} or $N
+    uint8_t dollar = (*parser->pos == VARIABLE_PARSE_MARKER);
+    uint8_t bracketed = dollar && parser->pos + 1 < parser->end && parser->pos[1] == '{';
+    const char *name = parser->pos + dollar + bracketed;
+    const char *end = name;
+    if (dollar && end < parser->end && isdigit(*end)){
+        while (end < parser->end && isdigit(*end)) end++;
+    }
+    else {
+        while (end < parser->end && (isalnum(*end) || *end == '_')) end++;
+    }
+    if (end == name){
+        parser->failed = 1;
+        return 0;
+    }
+    if (bracketed){
+        if (end >= parser->end || *end != '}'){
+            parser->failed = 1;
+            return 0;
+        }
+        parser->pos = end + 1;
+    }
+    else {
+        parser->pos = end;
+    }
+    return variable_value(parser, name, end - name);
+}
+
+static int64_t parse_unary(ArithParser *parser){
+    if (accept_op(parser, "-")){
+        // unsigned, so negating INT64_MIN doesn't overflow
+        return (int64_t) (0 - (uint64_t) parse_unary(parser));
+    }
+    if (accept_op(parser, "+")){
+        return parse_unary(parser);
+    }
+    if (accept_op(parser, "!")){
+        return !parse_unary(parser);
+    }
+    return parse_primary(parser);
+}
+
+static int64_t parse_term(ArithParser *parser){
+    int64_t value = parse_unary(parser);
+    while (1){
+        char op;
+        if (accept_op(parser, "*")) op = '*';
+        else if (accept_op(parser, "/")) op = '/';
+        else if (accept_op(parser, "%")) op = '%';
+        else return value;
+
+        int64_t rhs = parse_unary(parser);
+        if (op == '*'){
+            value = (int64_t) ((uint64_t) value * (uint64_t) rhs);
+        }
+        else if (rhs == 0 || (value == INT64_MIN && rhs == -1)){
+            parser->failed = 1;
+            value = 0;
+        }
+        else {
+            value = op == '/' ? value / rhs : value % rhs;
+        }
+    }
+}
+
+static int64_t parse_additive(ArithParser *parser){
+    int64_t value = parse_term(parser);
+    while (1){
+        if (accept_op(parser, "+")){
+            value = (int64_t) ((uint64_t) value + (uint64_t) parse_term(parser));
+        }
+        else if (accept_op(parser, "-")){
+            value = (int64_t) ((uint64_t) value - (uint64_t) parse_term(parser));
+        }
+        else {
+            return value;
+        }
+    }
+}
+
+static int64_t parse_relational(ArithParser *parser){
+    int64_t value = parse_additive(parser);
+    while (1){
+        if (accept_op(parser, "<=")) value = value <= parse_additive(parser);
+        else if (accept_op(parser, ">=")) value = value >= parse_additive(parser);
+        else if (accept_op(parser, "<")) value = value < parse_additive(parser);
+        else if (accept_op(parser, ">")) value = value > parse_additive(parser);
+        else return value;
+    }
+}
+
+static int64_t parse_equality(ArithParser *parser){
+    int64_t value = parse_relational(parser);
+    while (1){
+        if (accept_op(parser, "==")) value = value == parse_relational(parser);
+        else if (accept_op(parser, "!=")) value = value != parse_relational(parser);
+        else return value;
+    }
+}
+
+
+/* SHELL EXTENSION FUNCTIONS */
+
+int eval_arith(const char *expr, size_t len, Variable *variables, int64_t *result){
+    ArithParser parser = {expr, expr + len, variables, 0};
+    *result = parse_equality(&parser);
+    skip_space(&parser);
+    if (parser.failed || parser.pos != parser.end){
+        ERR_PRINT(ERR_ARITH, (int) len, expr);
+        return -1;
+    }
+    return 0;
+}
+
+const char *find_arith_close(const char *open){
+    // "$((" ... "))", where the inner parenthesis closes right before the
+    // outer one; anything else is a command substitution of a subshell
+    if (open[0] != SUBST_OPEN || open[1] != SUBST_OPEN){
+        return NULL;
+    }
+    const char *outer = find_subst_close(open);
+    const char *inner = find_subst_close(open + 1);
+    if (outer == NULL || inner == NULL || inner + 1 != outer){
+        return NULL;
+    }
+    return outer;
+}
+
+uint8_t has_substitution(const char *text, size_t length){
+    for (const char *c = text; c + 1 < text + length; c++){
+        if (c[0] == VARIABLE_PARSE_MARKER && c[1] == SUBST_OPEN &&
+            find_arith_close(c + 1) == NULL){
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,30 @@
+#!/bin/bash
+# Times pipelines of many stages, to check setup stays linear in their length.
+# Usage: bench/long_pipeline.sh [STAGES] [RUNS]   (from the repo root, after make)
+
+STAGES=${1:-1000}
+RUNS=${2:-5}
+SCRIPT=$(mktemp)
+trap 'rm -f "$SCRIPT"' EXIT
+
+for stages in $((STAGES / 4)) $((STAGES / 2)) "$STAGES"; do
+    {
+        echo "PATH=/usr/bin:/bin"
+        for _ in $(seq 1 "$RUNS"); do
+            printf 'seq 1 100'
+            for _ in $(seq 1 "$stages"); do
+                printf ' | cat'
+            done
+            echo ' | wc -l'
+        done
+    } > "$SCRIPT"
+    start=$(date +%s.%N)
+    out=$(./cscshell -i /dev/null "$SCRIPT" < /dev/null | sort -u)
+    end=$(date +%s.%N)
+    if [ "$out" != "100" ]; then
+        echo "$stages stages: wrong output: $out" >&2
+        exit 1
+    fi
+    awk -v n="$stages" -v s="$start" -v e="$end" -v r="$RUNS" \
+        'BEGIN { printf "%5d stages %.3fs per run, %.3fms per stage\n", n, (e - s) / r, (e - s) / r / n * 1000 }'
+done
@@ -0,0 +1,27 @@
+#!/bin/bash
+# Times a multi-stage pipeline under each pin policy.
+# Usage: bench/pin_pipeline.sh [LINES] [RUNS]   (from the repo root, after make)
+
+LINES=${1:-2000000}
+RUNS=${2:-5}
+DATA=$(mktemp)
+SCRIPT=$(mktemp)
+trap 'rm -f "$DATA" "$DATA.gz" "$SCRIPT"' EXIT
+
+seq 1 "$LINES" | awk '{print $1 % 50000, "key" $1 % 977}' > "$DATA"
+gzip -kf "$DATA"
+
+for policy in off adjacent l3 spread; do
+    {
+        echo "PATH=/usr/bin:/bin"
+        echo "pin $policy"
+        for _ in $(seq 1 "$RUNS"); do
+            echo "zcat $DATA.gz | cut -c1-4 | sort | uniq -c | wc -l"
+        done
+    } > "$SCRIPT"
+    start=$(date +%s.%N)
+    ./cscshell -i /dev/null "$SCRIPT" > /dev/null
+    end=$(date +%s.%N)
+    awk -v p="$policy" -v s="$start" -v e="$end" -v r="$RUNS" \
+        'BEGIN { printf "%-9s %.3fs per run\n", p, (e - s) / r }'
+done
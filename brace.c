@@ -0,0 +1,545 @@
+/*****************************************************************************/
+/*                           CSC209-24s A3 CSCSHELL                          */
+/*       Copyright 2024 -- Demetres Kostas PhD (aka Darlene Heliokinde)      */
+/*****************************************************************************/
+
+#include "cscshell.h"
+#include <ctype.h>
+
+
+/*
+** A word with braces is parsed into parts: literal text (pointing into the
+** word), lists {a,b,c} whose alternatives are words themselves, and
+** sequences {1..10..2}. Each part knows how many words it expands to, so
+** the whole expansion is counted before any of it is made, and then every
+** word is written straight from its index: the first part changes slowest,
+** like nested loops.
+*/
+
+#define BRACE_LITERAL 0
+#define BRACE_LIST 1
+#define BRACE_SEQUENCE 2
+
+typedef struct BraceWord BraceWord;
+
+typedef struct BracePart {
+    uint8_t kind;
+    const char *text;          // a literal
+    size_t length;
+    BraceWord **alternatives;  // a list
+    size_t *starts;            // the index of the first word of each one
+    size_t num_alternatives;
+    long long first;           // a sequence
+    long long step;
+    int width;                 // zero padded to this many characters
+    uint8_t is_char;
+    size_t count;              // the words this part expands to
+    size_t rest;               // the words every part after it expands to
+    struct BracePart *next;
+} BracePart;
+
+struct BraceWord {
+    BracePart *parts;
+    size_t count;
+};
+
+
+/* HELPERS */
+
+/**
+ * @brief Multiplies word counts, stopping just past BRACE_MAX_WORDS so a
+ * huge product can't overflow
+ */
+static size_t count_product(size_t a, size_t b){
+    if (a != 0 && b > (BRACE_MAX_WORDS + 1) / a){
+        return BRACE_MAX_WORDS + 1;
+    }
+    return a * b;
+}
+
+static void free_brace_word(BraceWord *word){
+    if (word == NULL){
+        return;
+    }
+    BracePart *part = word->parts;
+    while (part != NULL){
+        BracePart *next = part->next;
+        for (size_t i = 0; i < part->num_alternatives; i++){
+            free_brace_word(part->alternatives[i]);
+        }
+        mem_free(part->alternatives);
+        mem_free(part->starts);
+        mem_free(part);
+        part = next;
+    }
+    mem_free(word);
+}
+
+/**
+ * @brief Finds the '}' closing the '{' at text[open], skipping nested pairs
+ *
+ * @return size_t: its index, or length if it isn't closed
+ */
+static size_t find_brace_close(const char *text, size_t length, size_t open){
+    int depth = 0;
+    for (size_t i = open; i < length; i++){
+        if (text[i] == '{'){
+            depth++;
+        }
+        else if (text[i] == '}' && --depth == 0){
+            return i;
+        }
+    }
+    return length;
+}
+
+/**
+ * @brief Parses an integer taking up all of text[0, length)
+ *
+ * @return int: 1 if it is one, 0 if not
+ */
+static int parse_brace_number(const char *text, size_t length, long long *value){
+    char number[MAX_USER_BUF];
+    if (length == 0 || length >= MAX_USER_BUF){
+        return 0;
+    }
+    memcpy(number, text, length);
+    number[length] = '\0';
+    char *end;
+    errno = 0;
+    *value = strtoll(number, &end, 10);
+    return errno == 0 && *end == '\0' && !isspace((unsigned char) number[0]);
+}
+
+/**
+ * @brief The width a sequence end asks to be padded to: its length if it
+ * has a leading zero (after any sign), else none
+ */
+static int padded_width(const char *text, size_t length){
+    size_t sign = text[0] == '-';
+    return length - sign > 1 && text[sign] == '0' ? (int) length : 0;
+}
+
+/**
+ * @brief Fills in part as the sequence in the braces, X..Y or X..Y..STEP,
+ * where X and Y are both integers or both single characters
+ *
+ * @return int: 1 if content is a sequence, 0 if not
+ */
+static int parse_sequence(const char *content, size_t length, BracePart *part){
+    const char *dots = memmem(content, length, "..", 2);
+    if (dots == NULL){
+        return 0;
+    }
+    const char *second = dots + 2;
+    size_t first_len = dots - content;
+    size_t second_len = content + length - second;
+    long long step = 1;
+    const char *more = memmem(second, second_len, "..", 2);
+    if (more != NULL){
+        if (!parse_brace_number(more + 2, content + length - more - 2, &step) ||
+            step == 0){
+            return 0;
+        }
+        second_len = more - second;
+        step = step < 0 ? -step : step;
+    }
+
+    long long first;
+    long long last;
+    if (parse_brace_number(content, first_len, &first) &&
+        parse_brace_number(second, second_len, &last)){
+        part->is_char = 0;
+        int width = padded_width(content, first_len);
+        int last_width = padded_width(second, second_len);
+        part->width = width > last_width ? width : last_width;
+    }
+    else if (first_len == 1 && second_len == 1 &&
+             !isdigit((unsigned char) content[0]) &&
+             !isdigit((unsigned char) second[0])){
+        part->is_char = 1;
+        part->width = 0;
+        first = (unsigned char) content[0];
+        last = (unsigned char) second[0];
+    }
+    else {
+        return 0;
+    }
+
+    unsigned long long span = first <= last ? (unsigned long long) last - first :
+                                              (unsigned long long) first - last;
+    // compared before adding 1: the full range of a long long would wrap
+    unsigned long long steps = span / step;
+    part->kind = BRACE_SEQUENCE;
+    part->first = first;
+    part->step = first <= last ? step : -step;
+    part->count = steps >= BRACE_MAX_WORDS ? BRACE_MAX_WORDS + 1 : steps + 1;
+    return 1;
+}
+
+static BraceWord *parse_brace_word(const char *text, size_t length);
+
+/**
+ * @brief Fills in part as the list in the braces, if they have a comma
+ * outside any nested braces
+ *
+ * @return int: 1 if content is a list, 0 if not, -1 on error
+ */
+static int parse_list(const char *content, size_t length, BracePart *part){
+    size_t num_alternatives = 1;
+    int depth = 0;
+    for (size_t i = 0; i < length; i++){
+        if (content[i] == '{') depth++;
+        else if (content[i] == '}' && depth > 0) depth--;
+        else if (content[i] == ',' && depth == 0) num_alternatives++;
+    }
+    if (num_alternatives == 1){
+        return 0;
+    }
+
+    part->kind = BRACE_LIST;
+    part->alternatives = mem_calloc(num_alternatives, sizeof(BraceWord *),
+                                    MEM_EXPANSION);
+    part->starts = mem_alloc(sizeof(size_t) * num_alternatives, MEM_EXPANSION);
+    if (part->alternatives == NULL || part->starts == NULL){
+        perror("expand_braces");
+        return -1;
+    }
+
+    size_t start = 0;
+    depth = 0;
+    part->count = 0;
+    for (size_t i = 0; i <= length; i++){
+        if (i < length && content[i] == '{') depth++;
+        else if (i < length && content[i] == '}' && depth > 0) depth--;
+        else if (i == length || (content[i] == ',' && depth == 0)){
+            BraceWord *alternative = parse_brace_word(content + start, i - start);
+            if (alternative == NULL){
+                return -1;
+            }
+            part->starts[part->num_alternatives] = part->count;
+            part->alternatives[part->num_alternatives++] = alternative;
+            part->count += alternative->count;
+            if (part->count > BRACE_MAX_WORDS){
+                part->count = BRACE_MAX_WORDS + 1;
+            }
+            start = i + 1;
+        }
+    }
+    return 1;
+}
+
+/**
+ * @brief Parses text into literal, list and sequence parts. A '{' that
+ * doesn't start a list or a sequence is just a character.
+ *
+ * @return BraceWord*: the word, NULL on error
+ */
+static BraceWord *parse_brace_word(const char *text, size_t length){
+    BraceWord *word = mem_calloc(1, sizeof(BraceWord), MEM_EXPANSION);
+    if (word == NULL){
+        perror("expand_braces");
+        return NULL;
+    }
+    BracePart **tail = &word->parts;
+    BracePart *literal = NULL;
+
+    size_t i = 0;
+    while (i < length){
+        BracePart *part = mem_calloc(1, sizeof(BracePart), MEM_EXPANSION);
+        if (part == NULL){
+            perror("expand_braces");
+            free_brace_word(word);
+            return NULL;
+        }
+
+        size_t close = text[i] == '{' ? find_brace_close(text, length, i) : length;
+        int found = 0;
+        if (close < length){
+            const char *content = text + i + 1;
+            size_t content_len = close - i - 1;
+            found = parse_list(content, content_len, part);
+            if (found == 0){
+                found = parse_sequence(content, content_len, part);
+            }
+        }
+        if (found < 0){
+            // along with the alternatives parsed so far
+            part->next = word->parts;
+            word->parts = part;
+            free_brace_word(word);
+            return NULL;
+        }
+
+        if (found){
+            *tail = part;
+            tail = &part->next;
+            literal = NULL;
+            i = close + 1;
+            continue;
+        }
+        mem_free(part);
+        // runs of plain text (and unused braces) make up one literal
+        if (literal == NULL){
+            literal = mem_calloc(1, sizeof(BracePart), MEM_EXPANSION);
+            if (literal == NULL){
+                perror("expand_braces");
+                free_brace_word(word);
+                return NULL;
+            }
+            literal->kind = BRACE_LITERAL;
+            literal->text = text + i;
+            literal->count = 1;
+            *tail = literal;
+            tail = &literal->next;
+        }
+        size_t run = 1 + strcspn(text + i + 1, "{");
+        run = i + run > length ? length - i : run;
+        literal->length += run;
+        i += run;
+    }
+
+    // from the last part back, so each knows the words after it
+    size_t count = 1;
+    size_t num_parts = 0;
+    for (BracePart *part = word->parts; part != NULL; part = part->next){
+        num_parts++;
+    }
+    BracePart *parts[num_parts > 0 ? num_parts : 1];
+    num_parts = 0;
+    for (BracePart *part = word->parts; part != NULL; part = part->next){
+        parts[num_parts++] = part;
+    }
+    for (size_t j = num_parts; j > 0; j--){
+        parts[j - 1]->rest = count;
+        count = count_product(count, parts[j - 1]->count);
+    }
+    word->count = count;
+    return word;
+}
+
+static size_t emit_word(const BraceWord *word, size_t index, char *buf);
+
+/**
+ * @brief Writes the index-th word of one part into buf, or only measures
+ * it if buf is NULL
+ *
+ * @return size_t: its length
+ */
+static size_t emit_part(const BracePart *part, size_t index, char *buf){
+    if (part->kind == BRACE_LITERAL){
+        if (buf != NULL) memcpy(buf, part->text, part->length);
+        return part->length;
+    }
+
+    if (part->kind == BRACE_SEQUENCE){
+        long long value = part->first + (long long) index * part->step;
+        char number[MAX_USER_BUF];
+        int length;
+        if (part->is_char){
+            number[0] = (char) value;
+            length = 1;
+        }
+        else if (part->width > 0 && value < 0){
+            // the sign takes one of the padded places
+            length = snprintf(number, MAX_USER_BUF, "-%0*lld",
+                              part->width - 1, -value);
+        }
+        else {
+            length = snprintf(number, MAX_USER_BUF, "%0*lld", part->width, value);
+        }
+        if (buf != NULL) memcpy(buf, number, length);
+        return length;
+    }
+
+    // the alternative holding this index: the last one starting at or before it
+    size_t low = 0;
+    size_t high = part->num_alternatives - 1;
+    while (low < high){
+        size_t mid = (low + high + 1) / 2;
+        if (part->starts[mid] <= index) low = mid;
+        else high = mid - 1;
+    }
+    return emit_word(part->alternatives[low], index - part->starts[low], buf);
+}
+
+/**
+ * @brief Writes the index-th word of the expansion into buf (without a
+ * terminator), or only measures it if buf is NULL
+ *
+ * @return size_t: its length
+ */
+static size_t emit_word(const BraceWord *word, size_t index, char *buf){
+    size_t length = 0;
+    for (BracePart *part = word->parts; part != NULL; part = part->next){
+        length += emit_part(part, index / part->rest,
+                            buf == NULL ? NULL : buf + length);
+        index %= part->rest;
+    }
+    return length;
+}
+
+/**
+ * @brief Whether arg has a '{' with a '}' somewhere after it, the least a
+ * brace expansion needs
+ */
+static uint8_t may_have_braces(const char *arg){
+    const char *open = strchr(arg, '{');
+    return open != NULL && strchr(open, '}') != NULL;
+}
+
+
+/* SHELL EXTENSION FUNCTIONS */
+
+int expand_braces(Command *command){
+    int i = 1;
+    while (command->args[i] != NULL && !may_have_braces(command->args[i])){
+        i++;
+    }
+    if (command->args[i] == NULL){
+        return 0; // nothing to expand, leave the args alone
+    }
+
+    int num_original = i;
+    while (command->args[num_original] != NULL){
+        num_original++;
+    }
+    BraceWord **words = mem_calloc(num_original, sizeof(BraceWord *), MEM_EXPANSION);
+    if (words == NULL){
+        perror("expand_braces");
+        return -1;
+    }
+
+    // count first, so the args are allocated once at their final size
+    size_t total = 0;
+    int error = 0;
+    for (int j = 0; j < num_original; j++){
+        if (j >= i && may_have_braces(command->args[j])){
+            words[j] = parse_brace_word(command->args[j], strlen(command->args[j]));
+            if (words[j] == NULL){
+                error = 1;
+                break;
+            }
+            // a word with no lists or sequences stays as it is
+            if (words[j]->count == 1 && words[j]->parts->kind == BRACE_LITERAL &&
+                words[j]->parts->next == NULL){
+                free_brace_word(words[j]);
+                words[j] = NULL;
+            }
+        }
+        total += words[j] != NULL ? words[j]->count : 1;
+        if (total > BRACE_MAX_WORDS){
+            ERR_PRINT(ERR_BRACE_TOO_LARGE, command->args[j], BRACE_MAX_WORDS);
+            error = 1;
+            break;
+        }
+    }
+
+    char **args = error ? NULL : mem_alloc(sizeof(char *) * (total + 1), MEM_EXPANSION);
+    if (!error && args == NULL){
+        perror("expand_braces");
+        error = 1;
+    }
+
+    size_t num_args = 0;
+    for (int j = 0; j < num_original && !error; j++){
+        if (words[j] == NULL){
+            args[num_args++] = command->args[j];
+            continue;
+        }
+        for (size_t k = 0; k < words[j]->count; k++){
+            size_t length = emit_word(words[j], k, NULL);
+            char *arg = mem_alloc(length + 1, MEM_EXPANSION);
+            if (arg == NULL){
+                perror("expand_braces");
+                error = 1;
+                break;
+            }
+            emit_word(words[j], k, arg);
+            arg[length] = '\0';
+            args[num_args++] = arg;
+        }
+    }
+
+    if (error){
+        // the original args are untouched, only drop what we built
+        for (size_t k = 0, j = 0; args != NULL && k < num_args; j++){
+            if (words[j] == NULL){
+                k++;
+                continue;
+            }
+            for (size_t n = 0; n < words[j]->count && k < num_args; n++){
+                mem_free(args[k++]);
+            }
+        }
+        mem_free(args);
+    }
+    else {
+        args[num_args] = NULL;
+        for (int j = 0; j < num_original; j++){
+            if (words[j] != NULL) mem_free(command->args[j]);
+        }
+        mem_free(command->args);
+        command->args = args;
+    }
+    for (int j = 0; j < num_original; j++){
+        free_brace_word(words[j]);
+    }
+    mem_free(words);
+    return error ? -1 : 0;
+}
+
+int brace_iter_init(BraceIter *iter, const char *word){
+    iter->text = word;
+    iter->word = NULL;
+    iter->next = 0;
+    iter->count = 1;
+    iter->buf = NULL;
+    iter->cap = 0;
+    if (!may_have_braces(word)){
+        return 0;
+    }
+
+    iter->word = parse_brace_word(word, strlen(word));
+    if (iter->word == NULL){
+        return -1;
+    }
+    if (iter->word->count > BRACE_MAX_WORDS){
+        ERR_PRINT(ERR_BRACE_TOO_LARGE, word, BRACE_MAX_WORDS);
+        free_brace_iter(iter);
+        return -1;
+    }
+    iter->count = iter->word->count;
+    return 0;
+}
+
+const char *brace_iter_next(BraceIter *iter){
+    if (iter->next == iter->count){
+        return NULL;
+    }
+    if (iter->word == NULL){
+        iter->next++;
+        return iter->text;
+    }
+
+    size_t length = emit_word(iter->word, iter->next, NULL);
+    if (length + 1 > iter->cap){
+        char *grown = mem_realloc(iter->buf, length + 1, MEM_EXPANSION);
+        if (grown == NULL){
+            perror("expand_braces");
+            return NULL;
+        }
+        iter->buf = grown;
+        iter->cap = length + 1;
+    }
+    emit_word(iter->word, iter->next++, iter->buf);
+    iter->buf[length] = '\0';
+    return iter->buf;
+}
+
+void free_brace_iter(BraceIter *iter){
+    free_brace_word(iter->word);
+    mem_free(iter->buf);
+    iter->word = NULL;
+    iter->buf = NULL;
+}
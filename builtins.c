@@ -0,0 +1,532 @@
+/*****************************************************************************/
+/*                           CSC209-24s A3 CSCSHELL                          */
+/*       Copyright 2024 -- Demetres Kostas PhD (aka Darlene Heliokinde)      */
+/*****************************************************************************/
+
+#include "cscshell.h"
+#include <limits.h>
+
+
+/* BUILTIN COMMANDS */
+
+static int builtin_cd(Command *command, BuiltinOutput *out){
+    return cd_cscshell(command->args[1]);
+}
+
+static int builtin_echo(Command *command, BuiltinOutput *out){
+    char **args = command->args;
+    int i = 1;
+    uint8_t newline = 1;
+    if (args[i] != NULL && strcmp(args[i], "-n") == 0){
+        newline = 0;
+        i++;
+    }
+
+    for (int first = i; args[i] != NULL; i++){
+        if (i > first && builtin_write(out, " ", 1) < 0){
+            return 1;
+        }
+        if (builtin_write(out, args[i], strlen(args[i])) < 0){
+            return 1;
+        }
+    }
+    if (newline && builtin_write(out, "\n", 1) < 0){
+        return 1;
+    }
+    return 0;
+}
+
+static int builtin_pwd(Command *command, BuiltinOutput *out){
+    char cwd_buff[MAX_PATH_STR];
+    if (getcwd(cwd_buff, MAX_PATH_STR) == NULL){
+        perror("pwd");
+        return 1;
+    }
+    size_t len = strlen(cwd_buff);
+    cwd_buff[len] = '\n';
+    return builtin_write(out, cwd_buff, len + 1) < 0;
+}
+
+/*
+** The limits ulimit knows about. Values are given to ulimit in units of
+** `unit` bytes (or counts / seconds when unit is 1), like bash.
+*/
+typedef struct LimitOption {
+    char flag;
+    int resource;
+    rlim_t unit;
+    const char *description;
+} LimitOption;
+
+static const LimitOption limit_options[] = {
+    {'c', RLIMIT_CORE, 512, "core file size (blocks)"},
+    {'d', RLIMIT_DATA, 1024, "data seg size (kbytes)"},
+    {'f', RLIMIT_FSIZE, 512, "file size (blocks)"},
+    {'n', RLIMIT_NOFILE, 1, "open files"},
+    {'s', RLIMIT_STACK, 1024, "stack size (kbytes)"},
+    {'t', RLIMIT_CPU, 1, "cpu time (seconds)"},
+    {'u', RLIMIT_NPROC, 1, "max user processes"},
+    {'v', RLIMIT_AS, 1024, "virtual memory (kbytes)"},
+};
+#define NUM_LIMIT_OPTIONS (sizeof(limit_options) / sizeof(limit_options[0]))
+
+// Soft limits for children, set by ulimit; the shell itself is unaffected
+static rlim_t child_limits[NUM_LIMIT_OPTIONS];
+static uint8_t child_limit_set[NUM_LIMIT_OPTIONS];
+
+/**
+ * @brief Writes one limit, as ulimit reports it
+ */
+static int write_limit(BuiltinOutput *out, int i, uint8_t verbose){
+    rlim_t value = child_limits[i];
+    if (!child_limit_set[i]){
+        struct rlimit current;
+        if (getrlimit(limit_options[i].resource, &current) < 0){
+            perror("ulimit");
+            return -1;
+        }
+        value = current.rlim_cur;
+    }
+
+    char line[MAX_USER_BUF];
+    int length = 0;
+    if (verbose){
+        length = snprintf(line, MAX_USER_BUF, "%-26s(-%c) ",
+                          limit_options[i].description, limit_options[i].flag);
+    }
+    if (value == RLIM_INFINITY){
+        length += snprintf(line + length, MAX_USER_BUF - length, "%s\n",
+                           ULIMIT_UNLIMITED);
+    }
+    else {
+        length += snprintf(line + length, MAX_USER_BUF - length, "%llu\n",
+                           (unsigned long long) (value / limit_options[i].unit));
+    }
+    return builtin_write(out, line, length);
+}
+
+static int builtin_ulimit(Command *command, BuiltinOutput *out){
+    char **args = command->args;
+    int option = 2; // -f, like bash
+    int i = 1;
+    for (; args[i] != NULL && args[i][0] == '-'; i++){
+        if (strcmp(args[i], "-a") == 0){
+            for (int j = 0; j < NUM_LIMIT_OPTIONS; j++){
+                if (write_limit(out, j, 1) < 0) return 1;
+            }
+            return 0;
+        }
+        option = -1;
+        for (int j = 0; j < NUM_LIMIT_OPTIONS; j++){
+            if (args[i][1] == limit_options[j].flag && args[i][2] == '\0'){
+                option = j;
+            }
+        }
+        if (option < 0){
+            ERR_PRINT(ERR_ULIMIT_USAGE);
+            return 2;
+        }
+    }
+
+    if (args[i] == NULL){
+        return write_limit(out, option, 0) < 0;
+    }
+
+    rlim_t value;
+    if (strcmp(args[i], ULIMIT_UNLIMITED) == 0){
+        value = RLIM_INFINITY;
+    }
+    else {
+        char *end;
+        errno = 0;
+        unsigned long long parsed = strtoull(args[i], &end, 10);
+        if (errno != 0 || *end != '\0' || end == args[i]){
+            ERR_PRINT(ERR_ULIMIT_VALUE, args[i]);
+            return 1;
+        }
+        value = parsed * limit_options[option].unit;
+    }
+
+    // Soft limits can't go over the hard limit, so refuse here rather than
+    // failing in every child later
+    struct rlimit current;
+    if (getrlimit(limit_options[option].resource, &current) < 0){
+        perror("ulimit");
+        return 1;
+    }
+    if (current.rlim_max != RLIM_INFINITY &&
+        (value == RLIM_INFINITY || value > current.rlim_max)){
+        ERR_PRINT(ERR_ULIMIT_VALUE, args[i]);
+        return 1;
+    }
+    child_limits[option] = value;
+    child_limit_set[option] = 1;
+    return 0;
+}
+
+static int builtin_pin(Command *command, BuiltinOutput *out){
+    char **args = command->args;
+    if (args[1] == NULL){
+        const char *name = pin_policy_name();
+        if (builtin_write(out, name, strlen(name)) < 0 ||
+            builtin_write(out, "\n", 1) < 0){
+            return 1;
+        }
+        return 0;
+    }
+    if (args[2] != NULL || set_pin_policy(args[1]) < 0){
+        ERR_PRINT(ERR_PIN_USAGE);
+        return 2;
+    }
+    return 0;
+}
+
+static int builtin_parsecache(Command *command, BuiltinOutput *out){
+    char **args = command->args;
+    if (args[1] != NULL && strcmp(args[1], "-c") == 0 && args[2] == NULL){
+        parse_cache_clear();
+        return 0;
+    }
+    if (args[1] != NULL){
+        ERR_PRINT(ERR_PARSECACHE_USAGE);
+        return 2;
+    }
+
+    char report[MAX_USER_BUF];
+    int length = snprintf(report, MAX_USER_BUF,
+                          "hits %llu\nmisses %llu\nentries %d/%d\n",
+                          (unsigned long long) parse_cache_stats.hits,
+                          (unsigned long long) parse_cache_stats.misses,
+                          parse_cache_stats.entries, PARSE_CACHE_SIZE);
+    return builtin_write(out, report, length) < 0;
+}
+
+/**
+ * @brief Sets the variable name to the n bytes at value
+ */
+static int set_field(Command *command, const char *name, const char *value,
+                     size_t n){
+    char field[n + 1];
+    memcpy(field, value, n);
+    field[n] = '\0';
+    return set_variable(command->variables, name, field);
+}
+
+static int builtin_read(Command *command, BuiltinOutput *out){
+    char **args = command->args;
+    char delim = '\n';
+    int i = 1;
+    if (args[i] != NULL && strcmp(args[i], "-d") == 0){
+        if (args[i + 1] == NULL){
+            ERR_PRINT(ERR_READ_USAGE);
+            return 2;
+        }
+        delim = args[i + 1][0];
+        i += 2;
+    }
+    if (args[i] != NULL && args[i][0] == '-'){
+        ERR_PRINT(ERR_READ_USAGE);
+        return 2;
+    }
+
+    ExpandBuffer record;
+    if (expand_buffer_init(&record, MAX_SINGLE_LINE) < 0){
+        return 1;
+    }
+    int found = read_record(command->stdin_fd, delim, &record);
+    if (found < 0 || (found == 0 && record.len == 0)){
+        mem_free(record.data);
+        return 1;
+    }
+
+    Variable *ifs_var = search_for_var(command->variables, "IFS");
+    const char *ifs = ifs_var != NULL ? ifs_var->value : DEFAULT_IFS;
+    const char *curr = record.data;
+    const char *end = record.data + record.len;
+    int status = 0;
+
+    if (args[i] == NULL){
+        status = set_field(command, READ_DEFAULT_VAR, curr, end - curr) < 0;
+    }
+    for (; args[i] != NULL && status == 0; i++){
+        while (curr < end && strchr(ifs, *curr) != NULL) curr++;
+
+        // the last name gets the rest of the line, minus trailing separators
+        const char *stop = curr;
+        if (args[i + 1] != NULL){
+            while (stop < end && strchr(ifs, *stop) == NULL) stop++;
+        }
+        else {
+            stop = end;
+            while (stop > curr && strchr(ifs, stop[-1]) != NULL) stop--;
+        }
+        status = set_field(command, args[i], curr, stop - curr) < 0;
+        curr = stop;
+    }
+    mem_free(record.data);
+
+    // a last record without its delimiter is still stored, but ends loops
+    return status || found == 0;
+}
+
+static int builtin_memstats(Command *command, BuiltinOutput *out){
+    if (command->args[1] != NULL){
+        ERR_PRINT(ERR_MEMSTATS_USAGE);
+        return 2;
+    }
+    return write_mem_stats(out) < 0;
+}
+
+static int builtin_memo(Command *command, BuiltinOutput *out){
+    char **args = command->args;
+    int i = 1;
+    while (args[i] != NULL && strcmp(args[i], "-i") == 0){
+        if (args[i + 1] == NULL){
+            ERR_PRINT(ERR_MEMO_USAGE);
+            return 2;
+        }
+        i += 2;
+    }
+    if (args[i] == NULL || args[i][0] == '-'){
+        ERR_PRINT(ERR_MEMO_USAGE);
+        return 2;
+    }
+    return memo_run(command, i, out);
+}
+
+static int builtin_exec(Command *command, BuiltinOutput *out){
+    if (out->capture != NULL){
+        ERR_PRINT(ERR_EXEC_CAPTURE);
+        return 1;
+    }
+
+    // with no command, the redirections stay on the shell itself
+    char **args = command->args + 1;
+    if (args[0] == NULL){
+        return exec_in_place(NULL, NULL, command->stdin_fd, out->fd) < 0;
+    }
+    // exec replaces the shell, so `exec echo` means the echo on PATH
+    char *exec_path = resolve_on_path(args[0], *command->variables);
+    if (exec_path == NULL){
+        ERR_PRINT(ERR_NO_EXECU, args[0]);
+        return EXEC_FAILED_STATUS;
+    }
+    // if this returns, the exec failed (perhaps with the fds already moved)
+    exec_in_place(exec_path, args, command->stdin_fd, out->fd);
+    mem_free(exec_path);
+    return EXEC_FAILED_STATUS;
+}
+
+static int builtin_xbatch(Command *command, BuiltinOutput *out){
+    char **args = command->args;
+    long max_jobs = 1;
+    long num_fixed = -1;
+    int i = 1;
+    for (; args[i] != NULL && args[i][0] == '-'; i += 2){
+        long *option = NULL;
+        if (strcmp(args[i], "-P") == 0) option = &max_jobs;
+        else if (strcmp(args[i], "-k") == 0) option = &num_fixed;
+        if (option == NULL || args[i + 1] == NULL){
+            ERR_PRINT(ERR_XBATCH_USAGE);
+            return 2;
+        }
+        char *end;
+        errno = 0;
+        *option = strtol(args[i + 1], &end, 10);
+        if (errno != 0 || *end != '\0' || end == args[i + 1] || *option < 0 ||
+            *option > INT_MAX || max_jobs == 0){
+            ERR_PRINT(ERR_XBATCH_USAGE);
+            return 2;
+        }
+    }
+    if (args[i] == NULL){
+        ERR_PRINT(ERR_XBATCH_USAGE);
+        return 2;
+    }
+
+    // by default the command's leading options (up to a --) go in every batch
+    int num_args = 0;
+    while (args[i + 1 + num_args] != NULL){
+        num_args++;
+    }
+    if (num_fixed < 0){
+        num_fixed = 0;
+        while (num_fixed < num_args && args[i + 1 + num_fixed][0] == '-'){
+            if (strcmp(args[i + 1 + num_fixed++], "--") == 0) break;
+        }
+    }
+    if (num_fixed > num_args){
+        ERR_PRINT(ERR_XBATCH_USAGE);
+        return 2;
+    }
+    return xbatch_run(command, i, num_fixed, max_jobs, out);
+}
+
+static int builtin_every(Command *command, BuiltinOutput *out){
+    char **args = command->args;
+    uint8_t catch_up = 0;
+    uint64_t max_runs = UINT64_MAX;
+    int i = 1;
+    for (; args[i] != NULL && args[i][0] == '-'; i++){
+        if (strcmp(args[i], "-c") == 0){
+            catch_up = 1;
+        }
+        else if (strcmp(args[i], "-n") == 0 && args[i + 1] != NULL){
+            char *end;
+            errno = 0;
+            max_runs = strtoull(args[++i], &end, 10);
+            if (errno != 0 || *end != '\0' || end == args[i] || max_runs == 0){
+                ERR_PRINT(ERR_EVERY_USAGE);
+                return 2;
+            }
+        }
+        else {
+            ERR_PRINT(ERR_EVERY_USAGE);
+            return 2;
+        }
+    }
+    if (args[i] == NULL || args[i + 1] == NULL){
+        ERR_PRINT(ERR_EVERY_USAGE);
+        return 2;
+    }
+
+    uint64_t interval;
+    if (parse_interval(args[i], &interval) < 0){
+        ERR_PRINT(ERR_EVERY_INTERVAL, args[i]);
+        return 2;
+    }
+    return every_run(command, i + 1, interval, catch_up, max_runs, out);
+}
+
+static const Builtin builtins[] = {
+    {CD, builtin_cd, 1},
+    {"echo", builtin_echo, 0},
+    {"every", builtin_every, 0},
+    {"exec", builtin_exec, 1},
+    {"memo", builtin_memo, 0},
+    {"memstats", builtin_memstats, 1},
+    {"parsecache", builtin_parsecache, 1},
+    {"pin", builtin_pin, 1},
+    {"pwd", builtin_pwd, 0},
+    {"read", builtin_read, 1},
+    {"ulimit", builtin_ulimit, 1},
+    {"xbatch", builtin_xbatch, 0},
+    {NULL, NULL, 0}
+};
+
+
+/* HELPERS */
+
+const Builtin *find_builtin(const char *name){
+    if (name == NULL){
+        return NULL;
+    }
+    for (int i = 0; builtins[i].name != NULL; i++){
+        if (strcmp(builtins[i].name, name) == 0){
+            return &builtins[i];
+        }
+    }
+    return NULL;
+}
+
+int builtin_write(BuiltinOutput *out, const char *data, size_t n){
+    if (out->capture != NULL){
+        return expand_buffer_append(out->capture, data, n);
+    }
+
+    while (n > 0){
+        ssize_t written = write(out->fd, data, n);
+        if (written < 0){
+            if (errno == EINTR) continue;
+            perror("builtin_write");
+            return -1;
+        }
+        data += written;
+        n -= written;
+    }
+    return 0;
+}
+
+int builtin_write_fd(BuiltinOutput *out, int fd){
+    char chunk[FD_READER_BUF];
+    if (lseek(fd, 0, SEEK_SET) < 0){
+        perror("builtin_write_fd");
+        return -1;
+    }
+    ssize_t n;
+    while ((n = read(fd, chunk, FD_READER_BUF)) > 0){
+        if (builtin_write(out, chunk, n) < 0){
+            return -1;
+        }
+    }
+    if (n < 0 || ftruncate(fd, 0) < 0 || lseek(fd, 0, SEEK_SET) < 0){
+        perror("builtin_write_fd");
+        return -1;
+    }
+    return 0;
+}
+
+int apply_child_limits(void){
+    for (int i = 0; i < NUM_LIMIT_OPTIONS; i++){
+        if (!child_limit_set[i]) continue;
+
+        struct rlimit limit;
+        if (getrlimit(limit_options[i].resource, &limit) < 0){
+            perror("apply_child_limits");
+            return -1;
+        }
+        limit.rlim_cur = child_limits[i];
+        if (setrlimit(limit_options[i].resource, &limit) < 0){
+            perror("apply_child_limits");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int run_builtin(Command *command, ExpandBuffer *capture){
+    const Builtin *builtin = find_builtin(command->args[0]);
+    BuiltinOutput out = {command->stdout_fd, capture};
+
+    int redir_fd = -1;
+    if (capture == NULL && command->redir_out_path != NULL){
+        redir_fd = open_redirect_out(command);
+        if (redir_fd < 0){
+            return -1;
+        }
+        out.fd = redir_fd;
+    }
+
+    // input redirections only matter to builtins that read, but are set
+    // up for all of them, as they would be for a program
+    int saved_stdin = command->stdin_fd;
+    int in_fd = -1;
+    if (command->here_doc != NULL){
+        in_fd = open_here_doc(command->here_doc);
+    }
+    else if (command->redir_in_path != NULL){
+        in_fd = open(command->redir_in_path, O_RDONLY | O_CLOEXEC);
+        if (in_fd < 0) perror(command->redir_in_path);
+    }
+    if (in_fd < 0 && (command->here_doc != NULL || command->redir_in_path != NULL)){
+        if (redir_fd >= 0) close(redir_fd);
+        return 1;
+    }
+    if (in_fd >= 0){
+        command->stdin_fd = in_fd;
+    }
+
+    // anything the shell printed itself should come out first
+    fflush(stdout);
+    int status = builtin->func(command, &out);
+
+    if (in_fd >= 0){
+        sync_fd_reader(in_fd);
+        close(in_fd);
+        command->stdin_fd = saved_stdin;
+    }
+    if (redir_fd >= 0){
+        close(redir_fd);
+    }
+    return status;
+}
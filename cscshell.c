@@ -4,15 +4,23 @@
 /*****************************************************************************/
 
 #include "cscshell.h"
+#include <limits.h>
 
 
 void print_help(){
     printf("CSC209 Shell\n");
     printf("Usage: cscshell [OPTION]... [SCRIPT-FILE]\n");
     printf("Options:\n");
+    printf("  -c COMMAND\t\t\tRun COMMAND (lines separated by newlines) and exit\n");
     printf("  -h, --help\t\t\tDisplay this help message\n");
     printf("  -i, --init-file=FILE\t\tUse a specific init file. Default is ~/.cscshell_init\n");
-    printf("If no script file is given, cscshell will run in interactive mode\n");
+    printf("      --serve SOCKET\t\tServe requests on a Unix domain socket (see cscshell-client)\n");
+    printf("      --mem-stats\t\t\tCount allocations by subsystem, reported at exit\n");
+    printf("      --parallel-lines=N\t\tRun up to N independent lines of SCRIPT-FILE at once\n");
+    printf("      --stats\t\t\tPrint resource usage of the whole session at exit\n");
+    printf("      --trace=FILE\t\tWrite JSON-lines phase timings to FILE\n");
+    printf("If no script file is given, cscshell will run in interactive mode,\n");
+    printf("or read commands from stdin without prompting if it isn't a terminal\n");
 }
 
 
@@ -23,14 +31,21 @@ char *prompt(char *line, size_t line_length){
         return (char *) -1;
     }
 
+    // getlogin_r needs a controlling terminal, which containers often lack
     char user_buff[MAX_USER_BUF];
     if (getlogin_r(user_buff, MAX_USER_BUF)){
-        perror("prompt:");
-        return (char *) -1;
+        struct passwd *user = getpwuid(geteuid());
+        if (user == NULL){
+            perror("prompt:");
+            return (char *) -1;
+        }
+        snprintf(user_buff, MAX_USER_BUF, "%s", user->pw_name);
     }
 
-    printf("%s@<%s> %s", user_buff, cwd_buff, PROMPT_STR);
-    return fgets(line, line_length, stdin);
+    char prompt_text[MAX_PATH_STR + MAX_USER_BUF + sizeof(PROMPT_STR) + 4];
+    snprintf(prompt_text, sizeof(prompt_text), "%s@<%s> %s", user_buff, cwd_buff,
+             PROMPT_STR);
+    return read_edited_line(prompt_text, line, line_length);
 }
 
 
@@ -38,46 +53,54 @@ int run_interactive(Variable **root){
     long error;
     char line[MAX_SINGLE_LINE];
 
-    #ifdef DEBUG
-    printf("Interactive CSCSHELL starting...\n");
-    #endif
-
-    
+    int last_status = 0;
     while ((error = (long) prompt(line, MAX_SINGLE_LINE)) > 0) {
         // kill the newline
-        line[strlen(line) - 1] = '\0';
+        line[strcspn(line, "\n")] = '\0';
 
-        Command *commands = parse_line(line, root);
-        if (commands == (Command *) -1){
-            ERR_PRINT(ERR_PARSING_LINE);
-            continue;
-        }
-        if (commands == NULL) continue;
+        char *block = complete_block(line, stdin, 1);
+        if (block == NULL) continue;
 
-        int *last_ret_code_pt = execute_line(commands);
-        if (last_ret_code_pt == (int *) -1){
-            ERR_PRINT(ERR_EXECUTE_LINE);
-            free(last_ret_code_pt);
+        int line_error = run_line(block, root, &last_status);
+        mem_free(block);
+        if (line_error == -2){
             return -1;
         }
-        free(last_ret_code_pt);
     }
     printf("\n");
 
-    #ifdef DEBUG
-    printf("\nInteractive CSCSHELL exiting...\n");
-    #endif
-
     printf("shell error: %ld\n", error);
     // 0 on EOF, -1 on other errors
     return (int) error;
 }
 
 
+/*
+** Runs commands piped in on stdin, with no prompt. Lines are read no
+** further ahead than the one running, so the commands can read the rest.
+*/
+int run_batch(Variable **root){
+    // stdin is shared with the commands (and read) that lines run, so it's
+    // read through read_record: whatever they read starts after their line
+    FILE *stream = open_record_stream(STDIN_FILENO);
+    if (stream == NULL){
+        return -1;
+    }
+
+    int last_status = 0;
+    int error = run_stream(stream, root, &last_status);
+    fclose(stream);
+    return error < 0 ? error : last_status;
+}
+
+
 int main(int argc, char *argv[]){
 
     int num_args_parsed = 0;
     char *init_file = DEFAULT_INIT;
+    char *command_string = NULL;
+    char *serve_path = NULL;
+    int workers = 1;
 
     for (int i=1; i < argc; i++){
         if (strcmp(argv[i], "-h") == 0 ||
@@ -98,16 +121,68 @@ int main(int argc, char *argv[]){
             }
         }
 
-        else if (strncmp(argv[1], LONG_INIT_ARG,
+        else if (strcmp(argv[i], COMMAND_ARG) == 0){
+            if (i + 1 < argc){
+                command_string = argv[i + 1];
+                i++;
+                num_args_parsed += 2;
+            }
+            else{
+                fprintf(stderr, ERR_COMMAND_MISSING);
+                return -1;
+            }
+        }
+
+        else if (strcmp(argv[i], LONG_SERVE_ARG) == 0){
+            if (i + 1 < argc){
+                serve_path = argv[i + 1];
+                i++;
+                num_args_parsed += 2;
+            }
+            else{
+                fprintf(stderr, ERR_SERVE_MISSING);
+                return -1;
+            }
+        }
+
+        else if (strncmp(argv[i], LONG_INIT_ARG,
                          strlen(LONG_INIT_ARG)) == 0){
             num_args_parsed++;
-            init_file = strchr(argv[1], '=') + 1;
+            init_file = strchr(argv[i], '=') + 1;
+        }
+
+        else if (strcmp(argv[i], LONG_MEM_STATS_ARG) == 0){
+            num_args_parsed++;
+            mem_stats.enabled = 1;
+        }
+
+        else if (strncmp(argv[i], LONG_PARALLEL_ARG,
+                         strlen(LONG_PARALLEL_ARG)) == 0){
+            num_args_parsed++;
+            char *count = argv[i] + strlen(LONG_PARALLEL_ARG);
+            char *end;
+            long parsed = strtol(count, &end, 10);
+            if (*count == '\0' || *end != '\0' || parsed < 1 || parsed > INT_MAX){
+                ERR_PRINT(ERR_PARALLEL_ARG, count);
+                return -1;
+            }
+            workers = (int) parsed;
         }
-    }
 
-    #ifdef DEBUG
-    printf("Using init file at: %s\n", init_file);
-    #endif
+        else if (strcmp(argv[i], LONG_STATS_ARG) == 0){
+            num_args_parsed++;
+            session_stats.enabled = 1;
+        }
+
+        else if (strncmp(argv[i], LONG_TRACE_ARG,
+                         strlen(LONG_TRACE_ARG)) == 0){
+            num_args_parsed++;
+            if (trace_open(argv[i] + strlen(LONG_TRACE_ARG)) < 0){
+                return -1;
+            }
+        }
+    }
+    gettimeofday(&session_stats.start, NULL);
 
     Variable *start_of_vars = NULL;
     if (run_script(init_file, &start_of_vars) < 0){
@@ -119,15 +194,39 @@ int main(int argc, char *argv[]){
         strcmp(start_of_vars->name, PATH_VAR_NAME) > 0) {
         ERR_PRINT(ERR_PATH_INIT, init_file);
     }
+    // the init file itself always runs one line after another
+    parallel_lines = workers;
 
     int ret_code;
-    if (num_args_parsed < argc-1){
+    if (serve_path != NULL){
+        ret_code = serve(serve_path, &start_of_vars);
+    }
+    else if (command_string != NULL){
+        tail_exec = !session_stats.enabled && !mem_stats.enabled && !TRACE_ON;
+        ret_code = run_command_string(command_string, &start_of_vars);
+    }
+    else if (num_args_parsed < argc-1){
+        tail_exec = !session_stats.enabled && !mem_stats.enabled && !TRACE_ON;
         ret_code = run_script(argv[argc-1], &start_of_vars);
     }
+    else if (!isatty(STDIN_FILENO)){
+        ret_code = run_batch(&start_of_vars);
+    }
     else{
         ret_code = run_interactive(&start_of_vars);
     }
 
     free_variable(start_of_vars, NON_ZERO_BYTE);
+    free_functions();
+    parse_cache_clear();
+    redir_cache_clear();
+    if (session_stats.enabled){
+        print_session_stats(stderr);
+    }
+    if (mem_stats.enabled){
+        // what is still live here was leaked (or is kept for the whole session)
+        BuiltinOutput report = {STDERR_FILENO, NULL};
+        write_mem_stats(&report);
+    }
     return ret_code;
 }
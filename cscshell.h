@@ -9,6 +9,8 @@
 #ifndef CSCSHELL_H
 #define CSCSHELL_H
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -20,13 +22,26 @@
 #include <sys/wait.h>
 #include <fcntl.h>
 
+#include <sys/time.h>
+#include <sys/resource.h>
+
 #include <dirent.h>
 #include <pwd.h>
 #include <errno.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 // Arg help
 #define LONG_HELP_ARG "--help"
 #define LONG_INIT_ARG "--init-file="
+#define LONG_STATS_ARG "--stats"
+#define LONG_MEM_STATS_ARG "--mem-stats"
+#define COMMAND_ARG "-c"
+#define LONG_SERVE_ARG "--serve"
+#define LONG_TRACE_ARG "--trace="
+#define LONG_PARALLEL_ARG "--parallel-lines="
 #define DEFAULT_INIT "./cscshell_init"
 
 // Buffer sizes
@@ -44,9 +59,73 @@
 #define PARSING_START_MARKER '<'
 #define PARSING_END_MARKER '>'
 #define NON_ZERO_BYTE 0x42
+#define STATEMENT_SEPARATOR ';'
+#define BLOCK_LINE_SEPARATOR "; "
+#define KW_FOR "for"
+#define KW_WHILE "while"
+#define KW_IN "in"
+#define KW_DO "do"
+#define KW_DONE "done"
+#define CONTINUATION_PROMPT_STR "> "
+#define SUBST_OPEN '('
+#define SUBST_CLOSE ')'
+#define CAPTURE_READ_CHUNK 4096
+#define HERE_DOC_MARKER "<<"
+#define HERE_DOC_MEMFD_NAME "cscshell-heredoc"
+#define EXEC_FAILED_STATUS 127
+#define ULIMIT_UNLIMITED "unlimited"
+#define TRACE_DETAIL_MAX 256
+#define GLOB_CHARS "*?["
+#define COMMENT_MARKER '#'
+#define FUNC_PARENS "()"
+#define FUNC_OPEN "{"
+#define FUNC_CLOSE "}"
+#define MAX_FUNCTION_DEPTH 1000
+#define PIN_OFF 0
+#define PIN_ADJACENT 1
+#define PIN_L3 2
+#define PIN_SPREAD 3
+#define SERVE_BACKLOG 64
+#define SERVE_MAX_REQUEST (1 << 20)
+#define SERVE_STDIN 1
+#define SERVE_STDOUT 2
+#define MEM_VARIABLES 0
+#define MEM_EXPANSION 1
+#define MEM_PARSE 2
+#define MEM_EXECUTION 3
+#define NUM_MEM_TAGS 4
+#define TEE_OPERATOR "|&"
+#define FANOUT_CHUNK (1 << 16)
+#define FANOUT_WRITE_BUF (1 << 14)
+#define SCAN_INLINE_BYTES MAX_SINGLE_LINE
+#define SCAN_INLINE_WORDS (SCAN_INLINE_BYTES / 64)
+#define WORD_BREAK_CHARS " \t<>"
+#define LINE_OUTPUT_MEMFD_NAME "cscshell-line"
+#define MEMO_MEMFD_NAME "cscshell-memo"
+#define MEMO_DIR_VAR "MEMO_DIR"
+#define MEMO_DEFAULT_DIR "cscshell/memo"
+#define BRACE_MAX_WORDS (1 << 24)
+#define EVERY_MEMFD_NAME "cscshell-every"
+#define XBATCH_MEMFD_NAME "cscshell-xbatch"
+#define XBATCH_HEADROOM 2048
+#define ARG_TOO_LONG_STATUS 126
+#define LINE_FAILED_STATUS 255
+#define FD_READER_BUF (1 << 16)
+#define READ_DEFAULT_VAR "REPLY"
+#define DEFAULT_IFS " \t\n"
+#define PARSE_CACHE_SIZE 256
+#define PARSE_CACHE_BUCKETS 512
+#define REDIR_CACHE_SIZE 16
+#define LINE_HISTORY_SIZE 500
+#define LINE_ESC_TIMEOUT_MS 50
+#define CPU_SYSFS_FMT "/sys/devices/system/cpu/cpu%d/cache/index%d/%s"
 
 // Error Strings
 #define ERR_ARGS_MISSING "Missing init file path after argument: '-i'\n"
+#define ERR_COMMAND_MISSING "Missing command string after argument: '-c'\n"
+#define ERR_SERVE_MISSING "Missing socket path after argument: '--serve'\n"
+#define ERR_SERVE_REQUEST "serve: malformed request from client\n"
+#define ERR_SERVE_NOT_SOCKET "serve: not replacing '%s', which is not a socket\n"
 #define ERR_PATH_INIT "PATH not defined in init file %s, or not at the head \
 of the variable list."
 #define ERR_PARSING_LINE "Could not parse line into commands.\n"
@@ -60,10 +139,45 @@ of the variable list."
 #define ERR_NO_EXECU "Could not resolve executable [%s]\n"
 #define ERR_VAR_USAGE "Variable could not be parsed from %s\n"
 #define ERR_VAR_NOT_FOUND "Could not find variable: <%s>\n"
+#define ERR_LOOP_SYNTAX "Malformed loop near: %s\n"
+#define ERR_SUBST_SYNTAX "Missing ')' in command substitution: %s\n"
+#define ERR_HEREDOC "Here-document not terminated by: %s\n"
+#define ERR_ULIMIT_USAGE "ulimit: usage: ulimit [-a] [-cdfnstuv] [limit]\n"
+#define ERR_ULIMIT_VALUE "ulimit: invalid limit: %s\n"
+#define ERR_FUNC_SYNTAX "Malformed function definition near: %s\n"
+#define ERR_FUNC_DEPTH "Maximum function call depth (%d) exceeded in %s\n"
+#define ERR_PIN_USAGE "pin: usage: pin [off|adjacent|l3|spread]\n"
+#define ERR_MEMSTATS_USAGE "memstats: usage: memstats\n"
+#define ERR_READ_USAGE "read: usage: read [-d delim] [name ...]\n"
+#define ERR_ARITH "Bad arithmetic expression: %.*s\n"
+#define ERR_PARSECACHE_USAGE "parsecache: usage: parsecache [-c]\n"
+#define ERR_MEMO_USAGE "memo: usage: memo [-i FILE]... COMMAND [ARG]...\n"
+#define ERR_EVERY_USAGE "every: usage: every [-c] [-n COUNT] INTERVAL COMMAND [ARG]...\n"
+#define ERR_BRACE_TOO_LARGE "Brace expansion of %s makes more than %d words\n"
+#define ERR_ARG_MAX "%s: argument list too long (%zu bytes, the limit is %ld); \
+see xbatch\n"
+#define ERR_ARG_TOO_LONG "%s: argument too long for any batch: %.40s...\n"
+#define ERR_XBATCH_USAGE "xbatch: usage: xbatch [-P JOBS] [-k FIXED] COMMAND [ARG]...\n"
+#define ERR_EXEC_CAPTURE "exec: cannot replace the shell inside a substitution\n"
+#define ERR_EVERY_INTERVAL "every: invalid interval: %s\n"
+#define ERR_PARALLEL_ARG "Bad worker count for --parallel-lines: %s\n"
+#define ERR_UNCLOSED_BLOCK "Reached end of input inside an unclosed loop.\n"
 
 #define ERR_PRINT(...) fprintf(stderr, "ERROR: ");\
     fprintf(stderr, __VA_ARGS__);
 
+/*
+** Phase tracing (--trace=FILE). When tracing is off these cost a single
+** compare: TRACE_START doesn't read the clock, TRACE_END does nothing.
+*/
+#define TRACE_ON (trace_fd >= 0)
+#define TRACE_START() (TRACE_ON ? trace_clock() : 0)
+#define TRACE_END(phase, start, pid, detail) \
+    do { if (TRACE_ON) trace_event(phase, start, pid, detail); } while (0)
+// an event with no duration, such as why a line failed to parse
+#define TRACE_NOTE(phase, detail) \
+    do { if (TRACE_ON) trace_event(phase, trace_clock(), getpid(), detail); } while (0)
+
 /*
 ** Two structures for maintaining a singly-linked list of:
 **
@@ -81,6 +195,16 @@ typedef struct Variable{
     struct Variable *next;
 } Variable;
 
+/*
+** Output redirections after the first one on a command (cmd >a >b >>c),
+** which the shell fans the output out to.
+*/
+typedef struct OutTarget {
+    char *path;
+    uint8_t append;
+    struct OutTarget *next;
+} OutTarget;
+
 typedef struct Command {
     char *exec_path;
     char **args;
@@ -90,8 +214,222 @@ typedef struct Command {
     char *redir_in_path;
     char *redir_out_path;
     uint8_t redir_append;
+    char *here_doc;
+    struct Variable **variables;  // the variables the line was parsed with
+    struct OutTarget *more_out;   // further output targets, in order
+    struct Command *tee_next;     // on a pipeline's head: the next pipeline
+                                  // after a "|&", fed the same output
 } Command;
 
+/*
+** A growable, always null terminated string used while expanding a line.
+*/
+typedef struct ExpandBuffer {
+    char *data;
+    size_t len;
+    size_t cap;
+} ExpandBuffer;
+
+/*
+** Where a builtin writes its output: either straight into a capture buffer
+** (for in-process command substitution) or to a file descriptor.
+*/
+typedef struct BuiltinOutput {
+    int fd;
+    ExpandBuffer *capture;
+} BuiltinOutput;
+
+/*
+** Builtins get the whole command: its args, its stdin_fd (already pointed
+** at any input redirection) and the variable list.
+*/
+typedef int (*BuiltinFunc)(Command *command, BuiltinOutput *out);
+
+typedef struct Builtin {
+    const char *name;
+    BuiltinFunc func;
+    uint8_t shell_state;  // reads or changes the shell's own state, so it
+                          // can't run off in a worker of --parallel-lines
+} Builtin;
+
+/*
+** Resource usage of the whole session, gathered from every child reaped.
+*/
+typedef struct SessionStats {
+    uint8_t enabled;
+    uint64_t forks;
+    uint64_t exec_failures;
+    struct timeval child_utime;
+    struct timeval child_stime;
+    long peak_child_rss_kb;
+    struct timeval start;
+} SessionStats;
+
+extern SessionStats session_stats;
+
+/*
+** Allocation accounting for --mem-stats, per subsystem tag (MEM_*).
+*/
+typedef struct MemTagStats {
+    size_t live_bytes;
+    size_t peak_bytes;
+    uint64_t allocs;
+    uint64_t frees;
+} MemTagStats;
+
+typedef struct MemStats {
+    uint8_t enabled;
+    MemTagStats tags[NUM_MEM_TAGS];
+    size_t total_live;
+    size_t total_peak;
+} MemStats;
+
+extern MemStats mem_stats;
+extern int trace_fd;
+
+/*
+** Where the characters the parser cares about are in a line, one bit per
+** byte: meta has the blanks and every metacharacter (# = < > | $), vars
+** just the '$'s. Lines up to SCAN_INLINE_BYTES long use the inline words.
+*/
+typedef struct LineScan {
+    uint64_t *meta;
+    uint64_t *vars;
+    size_t length;
+    uint64_t inline_words[2 * SCAN_INLINE_WORDS];
+} LineScan;
+
+/*
+** Read-ahead for one seekable fd used by the read builtin. buf holds the
+** bytes [start, end) that were read but not handed out yet.
+*/
+typedef struct FdReader {
+    int fd;
+    char *buf;
+    size_t start;
+    size_t end;
+    struct FdReader *next;
+} FdReader;
+
+/*
+** Directory listings read while expanding globs, kept for one line so that
+** several patterns in the same directory only read it once.
+*/
+typedef struct DirListing {
+    char *path;
+    char **names;   // sorted
+    int count;
+    struct DirListing *next;
+} DirListing;
+
+/*
+** Where a brace expansion has got to (see brace_iter_init).
+*/
+typedef struct BraceIter {
+    const char *text;
+    struct BraceWord *word;  // NULL if text has nothing to expand
+    size_t next;
+    size_t count;
+    char *buf;               // the last word made
+    size_t cap;
+} BraceIter;
+
+typedef struct GlobCache {
+    DirListing *listings;
+} GlobCache;
+
+/*
+** A pre-parsed line of statements (separated by ';'), used for loops.
+**
+** Pipelines are parsed once into a template Command list whose args may
+** still contain '$' usages; these are only substituted (and the executable
+** only re-resolved) for the args that actually need it, on every run.
+*/
+#define STMT_PIPELINE 0
+#define STMT_ASSIGN 1
+#define STMT_FOR 2
+#define STMT_WHILE 3
+#define STMT_FUNCTION 4
+
+struct Function;
+
+typedef struct Statement {
+    uint8_t kind;
+    uint8_t needs_expand;
+    char *text;              // ASSIGN: NAME=VALUE, FOR: the loop variable
+    char *items;             // FOR: the raw word list after 'in'
+    Command *commands;       // PIPELINE: the template commands, or NULL if
+                             // text has to be expanded before parsing
+    struct Statement *cond;  // WHILE: the condition statement
+    struct Statement *body;  // FOR/WHILE: the loop body
+    struct Function *function; // FUNCTION: the definition
+    struct Statement *next;
+} Statement;
+
+/*
+** A shell function: a name and its already parsed body. The function
+** table and every definition statement each hold a reference.
+*/
+typedef struct Function {
+    char *name;
+    Statement *body;
+    int refs;
+    struct Function *next;
+} Function;
+
+/*
+** Frames of the --serve protocol. A request is this header, carrying the
+** client's stdin and/or stdout (in that order, as flagged) as SCM_RIGHTS,
+** followed by length bytes of command text. The reply is the int32_t exit
+** code of the text's last line, -1 if it couldn't run.
+*/
+typedef struct ServeHeader {
+    uint32_t length;
+    uint32_t flags;
+} ServeHeader;
+
+/*
+** The args of the innermost function call, $0 being the function name.
+** NULL outside of any function.
+*/
+extern char **positional_params;
+
+/*
+** A parsed line kept by the parse cache. The key is the raw line together
+** with the variable generation it was parsed under. Entries are hashed
+** into chains and kept in a most recently used first list.
+*/
+typedef struct ParseCacheEntry {
+    char *line;
+    uint64_t generation;
+    Command *commands;
+    int refs;
+    struct ParseCacheEntry *chain;
+    struct ParseCacheEntry *prev;
+    struct ParseCacheEntry *next;
+} ParseCacheEntry;
+
+typedef struct ParseCacheStats {
+    uint64_t hits;
+    uint64_t misses;
+    int entries;
+} ParseCacheStats;
+
+extern ParseCacheStats parse_cache_stats;
+
+/*
+** Bumped on every change that could make an old parse of the same text
+** wrong: variables being set, functions being defined, the cwd changing.
+*/
+extern uint64_t variable_generation;
+
+/*
+** Set while parsing a line whose plan depends on more than its text and
+** the variables ($(...) output, glob matches, positional parameters), so
+** the parse cache leaves it out.
+*/
+extern uint8_t parse_volatile;
+
 
 /*
 ** The following functions are provided for you in _shell.c
@@ -133,6 +471,23 @@ Command *parse_line(char *line, Variable **variables);
 char *replace_variables_mk_line(const char *line,
                                 Variable *variables);
 
+/*
+** Classifies every byte of line in one pass (with SSE2 or AVX2 where the
+** CPU has them), filling in scan. Returns 0 on success, -1 on error.
+*/
+int scan_line(const char *line, size_t length, LineScan *scan);
+
+/*
+** Returns the position of the first bit set in bits at or after from, or
+** length if there is none.
+*/
+size_t scan_next(const uint64_t *bits, size_t length, size_t from);
+
+/*
+** Frees what scan_line allocated for a long line.
+*/
+void free_line_scan(LineScan *scan);
+
 /*
 ** This function is provided for you and should not be modified.
 **
@@ -159,6 +514,15 @@ int cd_cscshell(const char *target_dir);
 */
 char *resolve_executable(const char *command_name, Variable *path);
 
+/*
+** Like resolve_executable, but always searches PATH: a builtin or function
+** of the same name is not returned as its bare name. Used by exec, which
+** replaces the shell with a program and so can never run a builtin.
+**
+** Returns a heap string with the path, or NULL if none was found.
+*/
+char *resolve_on_path(const char *command_name, Variable *path);
+
 /*
 ** Executes a single "line" of commands (through pipes)
 ** If a command fails, the rest of the line should not be executed.
@@ -181,11 +545,43 @@ int *execute_line(Command *head);
 */
 int run_command(Command *command);
 
+/*
+** Replaces the shell with the program at exec_path, run with args, once
+** in_fd and out_fd are moved onto stdin and stdout (unless they are them
+** already). With args NULL, only moves the fds, for the rest of the session.
+**
+** Returns 0 if args is NULL and the fds were moved, -1 on error (including
+** any exec that returns).
+*/
+int exec_in_place(char *exec_path, char **args, int in_fd, int out_fd);
+
+/*
+** Whether run_stream may exec the last line of its stream in place of the
+** shell, rather than forking it and waiting (script and -c modes). It is
+** only done for a single program, and not while stats or a trace still
+** have to be written at exit.
+*/
+extern uint8_t tail_exec;
+
+/*
+** Starts every command of the pipeline at head, connected by pipes,
+** without waiting for them. pids must have room for all of them.
+**
+** Returns the number of commands started, -1 if one could not be.
+*/
+int start_pipeline(Command *head, pid_t *pids);
+
+/*
+** Waits for num_pids children. Returns the exit code of the last one, or
+** -1 on error.
+*/
+int wait_pipeline(pid_t *pids, int num_pids);
+
 /*
 ** Executes an entire script line-by-line.
-** Stops and indicates an error as soon as any line fails.
 **
-** Returns 0 on success, -1 on error
+** Returns the exit status of the last line, -1 if any line could not be
+** run
 */
 int run_script(char *file_path, Variable **root);
 
@@ -202,4 +598,542 @@ void free_command(Command *command);
 ** list starting at var, else just var.
  */
 void free_variable(Variable *var, uint8_t recursive);
+
+/*
+** Shell extensions (not part of the original assignment).
+*/
+
+/*
+** Helpers for ExpandBuffer. All return 0 on success, -1 on error
+** (after which the buffer has been freed).
+*/
+int expand_buffer_init(ExpandBuffer *buf, size_t cap);
+int expand_buffer_reserve(ExpandBuffer *buf, size_t n);
+int expand_buffer_append(ExpandBuffer *buf, const char *src, size_t n);
+
+/*
+** Finds the ')' matching the '(' at open. Returns NULL if there is none.
+*/
+const char *find_subst_close(const char *open);
+
+/*
+** Sets (or creates) the variable name to a copy of value.
+**
+** Returns 0 on success, -1 on error.
+*/
+int set_variable(Variable **variables, const char *name, const char *value);
+
+/*
+** Finds the variable called var_name. Returns NULL if it isn't set.
+*/
+Variable *search_for_var(Variable **variables, char *var_name);
+
+/*
+** Evaluates the integer expression in the len bytes at expr, as found in
+** $(( )), into *result. Returns 0 on success, -1 on error (reported).
+*/
+int eval_arith(const char *expr, size_t len, Variable *variables, int64_t *result);
+
+/*
+** Given the first '(' of "$((", returns the last ')' of the matching "))",
+** or NULL if the text is not an arithmetic expansion.
+*/
+const char *find_arith_close(const char *open);
+
+/*
+** Checks if the length bytes at text use "$(...)", which may run anything
+** while the text is expanded. "$((...))" is only arithmetic.
+*/
+uint8_t has_substitution(const char *text, size_t length);
+
+/*
+** Validates and stores the assignment found at line[i] == '='.
+**
+** Returns 0 on success, -1 on error.
+*/
+int retrieve_variable(char *line, Variable **variables, int i);
+
+/*
+** Parses an already expanded line into commands, with the same return
+** values as parse_line. If defer_vars is non-zero, '$' usages are left in
+** the args and executables using them are not resolved; see expand_commands.
+*/
+Command *parse_commands(char *line, Variable **variables, uint8_t defer_vars);
+
+/*
+** Makes a fresh copy of a template command list with variables substituted
+** in the args that use them, re-resolving executables only when needed.
+**
+** Returns (Command *) -1 on error. Free the result with free_command.
+*/
+Command *expand_commands(Command *template, Variable **variables);
+
+/*
+** Finds where a comment starts: a '#' at the start of the line or after a
+** blank ($# is not a comment). Returns NULL if there is none.
+*/
+char *find_comment(const char *line);
+
+/*
+** Checks if line is a variable assignment: its first word holds a '='.
+** An '=' in any later word is just part of an argument.
+*/
+uint8_t is_assignment(const char *line);
+
+/*
+** Returns non-zero if the line has to go through parse_statements,
+** i.e. it has several statements, opens a loop or defines a function.
+*/
+uint8_t is_compound_line(const char *line);
+
+/*
+** Looks up a shell function by name. Returns NULL if there is none.
+*/
+Function *find_function(const char *name);
+
+/*
+** Runs the function named by command->args[0] in the shell process, with
+** $1..$N bound to the rest of the args. Returns its exit code.
+*/
+int call_function(Command *command);
+
+/*
+** Frees every defined function.
+*/
+void free_functions(void);
+
+/*
+** Returns how many loops or functions are left open at the end of text. A positive
+** value means more lines are needed to complete the block.
+*/
+int block_depth(const char *text);
+
+/*
+** Parses a line of ';' separated statements, including for/while loops,
+** into a statement list. Every pipeline is parsed exactly once here.
+**
+** Returns NULL for a line with no statements, (Statement *) -1 on error.
+*/
+Statement *parse_statements(const char *text, Variable **variables);
+
+/*
+** Executes a statement list. Returns the exit code of the last statement.
+*/
+int execute_statements(Statement *stmt, Variable **variables);
+
+/*
+** Frees a statement list, including nested loop bodies.
+*/
+void free_statement(Statement *stmt);
+
+/*
+** Returns non-zero if name matches the glob pattern (*, ? and [...]).
+*/
+int glob_match(const char *pattern, const char *name);
+
+/*
+** Replaces every arg (after the command name) that is a glob pattern with
+** the sorted paths it matches, or leaves it as is if nothing matches.
+**
+** Returns 0 on success, -1 on error (the args are then left unchanged).
+*/
+int expand_globs(Command *command, GlobCache *cache);
+
+/*
+** Expands a single word, as expand_globs does each arg, into a NULL
+** terminated array of its matches in order (the word itself if it matches
+** nothing). Free the entries and the array with mem_free.
+**
+** Returns NULL on error.
+*/
+char **expand_glob_word(const char *word, GlobCache *cache);
+
+/*
+** Frees every listing held by a glob cache.
+*/
+void free_glob_cache(GlobCache *cache);
+
+/*
+** Replaces every arg (after the command name) with a list {a,b} or a
+** sequence {1..10} or {a..e} (optionally ..STEP) in it with the words it
+** expands to, in order. Each word is made straight into the new args,
+** which are allocated once, at their final size.
+**
+** Returns 0 on success, -1 on error (the args are then left unchanged).
+*/
+int expand_braces(Command *command);
+
+/*
+** Goes through the brace expansion of word one word at a time, making each
+** only when asked for it. word must outlive the iterator.
+** Returns 0 on success, -1 on error.
+*/
+int brace_iter_init(BraceIter *iter, const char *word);
+
+/*
+** Returns the next word of the expansion (valid until the next call), or
+** NULL once there are no more.
+*/
+const char *brace_iter_next(BraceIter *iter);
+
+/*
+** Frees what an iterator holds.
+*/
+void free_brace_iter(BraceIter *iter);
+
+/*
+** Looks up a builtin command by name. Returns NULL if it isn't one.
+*/
+const Builtin *find_builtin(const char *name);
+
+/*
+** Writes n bytes of data to a builtin's output.
+** Returns 0 on success, -1 on error.
+*/
+int builtin_write(BuiltinOutput *out, const char *data, size_t n);
+
+/*
+** Writes everything in the file at fd, from its start, to a builtin's
+** output, then empties it to be written again. Returns 0 on success, -1 on
+** error.
+*/
+int builtin_write_fd(BuiltinOutput *out, int fd);
+
+/*
+** Runs the command in command->args from first on for the memo builtin.
+** Its exit code and output are stored on disk, under a hash of the
+** program (and its mtime), the args, the cwd, the environment, and the
+** size and mtime of its input and of every file declared with -i before
+** first. When the same hash comes up again, they are replayed from there
+** instead of running the command.
+**
+** Returns the exit code of the command, -1 on error.
+*/
+int memo_run(Command *command, int first, BuiltinOutput *out);
+
+/*
+** Whether any command of the line (or of its |& branches) that would be
+** exec'd has more args and environment than the kernel takes (ARG_MAX),
+** or an arg over its limit for one string. Says so if it does.
+*/
+uint8_t exceeds_arg_max(Command *head);
+
+/*
+** Runs the command in command->args from first on for the xbatch builtin,
+** as many times as it takes to pass every arg after its first num_fixed
+** ones, each time with as many of them as fit under ARG_MAX (and always
+** with the fixed ones). Up to max_jobs batches run at once.
+**
+** Returns the highest exit code of any batch, -1 on error.
+*/
+int xbatch_run(Command *command, int first, int num_fixed, int max_jobs,
+               BuiltinOutput *out);
+
+/*
+** Parses an interval for the every builtin: a number of seconds, or one
+** followed by ms, us, s, m or h. Returns 0 on success, -1 if it is not one.
+*/
+int parse_interval(const char *text, uint64_t *ns);
+
+/*
+** Runs the command in command->args from first on for the every builtin:
+** once right away, then every interval ns, on a schedule that doesn't
+** drift. A tick that comes while the last run is still going is skipped,
+** unless catch_up is set, when it runs as soon as that one exits. Stops
+** after max_runs runs or on SIGINT, then writes run time and start lag
+** statistics to stderr.
+**
+** Returns the exit code of the last run, 130 if interrupted, -1 on error.
+*/
+int every_run(Command *command, int first, uint64_t interval, uint8_t catch_up,
+              uint64_t max_runs, BuiltinOutput *out);
+
+/*
+** Runs a builtin command in the shell process, honouring its output
+** redirection. If capture is not NULL, the output is appended to it instead.
+**
+** Returns the exit code of the builtin.
+*/
+int run_builtin(Command *command, ExpandBuffer *capture);
+
+/*
+** Opens the output redirection target of a command, truncating or
+** appending as requested (appends through redir_cache_open). Returns an fd
+** the caller closes, or -1 on error.
+*/
+int open_redirect_out(Command *command);
+
+/*
+** Opens path with flags (and mode, if it is created) through the shell's
+** cache of open redirection files, keyed by path and flags. A cached fd is
+** used again while stat still finds the same file at path; the least
+** recently used is closed to make room. Only for O_APPEND: the fd's offset
+** is shared by everything it is handed to.
+**
+** Returns a new close-on-exec fd the caller closes, -1 on error.
+*/
+int redir_cache_open(const char *path, int flags, mode_t mode);
+
+/*
+** Closes every file held by the redirection cache.
+*/
+void redir_cache_clear(void);
+
+/*
+** Runs the command line text and appends everything it writes to stdout
+** to out, minus trailing newlines. Single builtins run without forking.
+**
+** Returns the exit code of the line, or -1 if it could not run.
+*/
+int capture_command(const char *text, Variable *variables, ExpandBuffer *out);
+
+/*
+** Applies the limits set with the ulimit builtin. Only called in children,
+** right before they exec. Returns 0 on success, -1 on error.
+*/
+int apply_child_limits(void);
+
+/*
+** Sets the CPU placement policy for pipeline stages by name (off, adjacent,
+** l3 or spread). Returns 0 on success, -1 if the name is unknown.
+*/
+int set_pin_policy(const char *name);
+
+/*
+** Returns the name of the current CPU placement policy.
+*/
+const char *pin_policy_name(void);
+
+/*
+** Picks the CPUs for stage (counting from 0) of a num_stages long pipeline,
+** according to the pin policy, for the next command run_command forks. A
+** no-op when the policy is off. Returns 0 on success, -1 on error.
+*/
+int pin_stage(int stage, int num_stages);
+
+/*
+** In a forked child: moves it onto the CPUs pin_stage picked, if any,
+** before it execs, so everything it starts stays there too.
+*/
+void apply_stage_pin(void);
+
+/*
+** In the shell, once a child is forked: forgets the CPUs picked for it.
+*/
+void clear_stage_pin(void);
+
+/*
+** Checks if the line at head has to be fanned out by the shell: more than
+** one output target, or pipelines joined with "|&".
+*/
+uint8_t needs_fanout(Command *head);
+
+/*
+** Runs a line that needs_fanout. The output of the first pipeline is
+** copied to every output target and "|&" pipeline inside the kernel, with
+** tee(2) and splice(2), by the shell itself.
+**
+** Returns a heap int with the exit code of the last pipeline (-1 on error).
+*/
+int *execute_fanout(Command *head);
+
+/*
+** Reads one record, up to delim (which is dropped), from fd into record.
+** Seekable fds are read a buffer at a time; pipes are peeked with tee(2)
+** so only the record is consumed; anything else is read byte by byte.
+**
+** Returns 1 if a record ended with delim, 0 at EOF (record holds anything
+** read before it), -1 on error.
+*/
+int read_record(int fd, char delim, ExpandBuffer *record);
+
+/*
+** Gives back everything the read buffers hold but haven't handed out,
+** seeking each fd back to where the reading really got to. Called before
+** anything else may use those fds (forks, exec, replacing stdin).
+*/
+void sync_fd_readers(void);
+
+/*
+** sync_fd_readers for fd alone, before it is closed or replaced.
+*/
+void sync_fd_reader(int fd);
+
+/*
+** sync_fd_readers for the fds a command's child can read: child_stdin
+** (-1 if its stdin is redirected from a file) and any fd without
+** FD_CLOEXEC. The rest keep their read-ahead across the fork.
+*/
+void sync_inherited_fd_readers(int child_stdin);
+
+/*
+** Drops every read buffer without seeking. For a child just forked: the
+** buffers are the parent's, and its fds may no longer be the same files.
+*/
+void forget_fd_readers(void);
+
+/*
+** Opens a stdio stream of fd's lines, read with read_record (and so through
+** the same buffer as the read builtin), never reading past the line that
+** was last taken from it.
+**
+** Returns the stream, or NULL on error.
+*/
+FILE *open_record_stream(int fd);
+
+/*
+** Puts a here-document into a sealed memfd. Returns a read-only fd
+** positioned at its start, or -1 on error.
+*/
+int open_here_doc(const char *content);
+
+/*
+** Looks line up in the parse cache. On a hit the entry is held until
+** parse_cache_release. Returns the entry, or NULL on a miss.
+*/
+ParseCacheEntry *parse_cache_lookup(const char *line);
+
+/*
+** Keeps commands, the parse of line, in the parse cache, which then owns
+** it. The entry is held until parse_cache_release. Returns the entry, or
+** NULL if it couldn't be stored (commands then still belong to the caller).
+*/
+ParseCacheEntry *parse_cache_store(const char *line, Command *commands);
+
+/*
+** Lets go of an entry from parse_cache_lookup or parse_cache_store.
+*/
+void parse_cache_release(ParseCacheEntry *entry);
+
+/*
+** Drops every entry of the parse cache.
+*/
+void parse_cache_clear(void);
+
+/*
+** Waits for a child like waitpid, adding its resource usage to
+** session_stats. Returns the pid, or -1 on error.
+*/
+pid_t wait_child(pid_t pid, int *status);
+
+/*
+** Prints the --stats report for the whole session to stream.
+*/
+void print_session_stats(FILE *stream);
+
+/*
+** malloc, calloc, realloc, strdup and strndup, with the block counted
+** against tag (one of MEM_*) while --mem-stats is on. Any pointer, tracked
+** or not, may be given to mem_free.
+*/
+void *mem_alloc(size_t size, int tag);
+void *mem_calloc(size_t count, size_t size, int tag);
+void *mem_realloc(void *ptr, size_t size, int tag);
+char *mem_strdup(const char *str, int tag);
+char *mem_strndup(const char *str, size_t n, int tag);
+void mem_free(void *ptr);
+
+/*
+** Writes the --mem-stats table: live and peak bytes, allocations and frees
+** per tag. Returns 0 on success, -1 on error.
+*/
+int write_mem_stats(BuiltinOutput *out);
+
+/*
+** Opens the trace file, truncating it. Returns 0 on success, -1 on error.
+*/
+int trace_open(const char *path);
+
+/*
+** Returns the monotonic clock in nanoseconds.
+*/
+uint64_t trace_clock(void);
+
+/*
+** Starts numbering events for the next line of input.
+*/
+void trace_next_line(void);
+
+/*
+** Writes one JSON-lines event for a phase that began at start (from
+** trace_clock) and ends now. Use the TRACE_* macros instead.
+*/
+void trace_event(const char *phase, uint64_t start, pid_t pid,
+                 const char *detail);
+
+/*
+** Parses and executes a single complete line (or block) of input.
+**
+** Returns 0 once the line ran, storing its exit code in *last_status,
+** -1 if the line could not be parsed (*last_status is then
+** LINE_FAILED_STATUS), -2 if the shell should stop.
+*/
+int run_line(char *line, Variable **root, int *last_status);
+
+/*
+** Finds the next here-document operator (but not a here-string) in text,
+** copying its delimiter word into delim (of size delim_cap).
+**
+** Returns a pointer just past the delimiter, or NULL if there is none.
+*/
+const char *next_here_doc(const char *text, char *delim, size_t delim_cap);
+
+/*
+** Reads further lines from stream until every loop opened by line is
+** closed, joining them with ';'. The here-document bodies that follow any
+** of those lines are read with it, and appended after the whole block in
+** the order of their operators, one line each.
+**
+** Returns a heap string with the complete block, or NULL on EOF / error.
+*/
+char *complete_block(const char *line, FILE *stream, uint8_t interactive);
+
+/*
+** Runs every line (and block) read from stream, without any prompt, storing
+** the exit code of the last one in *last_status.
+**
+** Returns 0 on EOF, -1 if a line failed, -2 if the shell should stop.
+*/
+int run_stream(FILE *stream, Variable **root, int *last_status);
+
+/*
+** The most lines of a script run_script may run at once (--parallel-lines),
+** 1 to run them one after another.
+*/
+extern int parallel_lines;
+
+/*
+** Like run_stream, but runs lines that don't depend on each other at the
+** same time, up to parallel_lines of them. Lines depend on each other when
+** they share a file (a redirection or argument), and lines that use or
+** change the shell's own state (assignments, cd, functions, loops, globs,
+** substitutions) run in the shell with everything before them done. Every
+** line's output is still written in script order, and nothing after a line
+** that stops the shell is written.
+**
+** Returns 0 on EOF, -1 if a line failed, -2 if the shell should stop.
+*/
+int run_stream_parallel(FILE *stream, Variable **root, int *last_status);
+
+/*
+** Shows prompt_text and reads a line into line (at most line_length - 1
+** bytes), with emacs style editing and history when stdin and stdout are a
+** terminal, or just like fgets (keeping the newline) when they aren't.
+**
+** Returns line, NULL at EOF (^D on an empty line), (char *) -1 on error.
+*/
+char *read_edited_line(const char *prompt_text, char *line, size_t line_length);
+
+/*
+** Runs text (lines separated by newlines) as if read from a script.
+** Returns the exit code of its last line, or -1 if the shell should stop.
+*/
+int run_command_string(char *text, Variable **root);
+
+/*
+** Serves requests on a Unix domain socket at socket_path until SIGINT or
+** SIGTERM, each client in its own fork of the shell. Returns 0 once
+** stopped, -1 if the socket could not be set up.
+*/
+int serve(const char *socket_path, Variable **root);
 #endif
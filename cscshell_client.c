@@ -0,0 +1,84 @@
+/*****************************************************************************/
+/*                           CSC209-24s A3 CSCSHELL                          */
+/*       Copyright 2024 -- Demetres Kostas PhD (aka Darlene Heliokinde)      */
+/*****************************************************************************/
+
+/*
+** A small client for cscshell --serve. Each COMMAND is sent as one request,
+** with this process' stdin and stdout passed along for it to use, and the
+** client exits with the exit code of the last one.
+**
+** Usage: cscshell-client SOCKET COMMAND...
+*/
+
+#include "cscshell.h"
+
+
+/**
+ * @brief Sends one request, with our stdin and stdout attached
+ *
+ * @return int: 0 on success, -1 on error
+ */
+static int send_request(int server, const char *text){
+    ServeHeader header = {strlen(text), SERVE_STDIN | SERVE_STDOUT};
+    int fds[2] = {STDIN_FILENO, STDOUT_FILENO};
+
+    char control[CMSG_SPACE(sizeof(fds))] = {0};
+    struct iovec iov = {&header, sizeof(header)};
+    struct msghdr msg = {0};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    if (sendmsg(server, &msg, 0) != sizeof(header)){
+        return -1;
+    }
+
+    size_t remaining = header.length;
+    while (remaining > 0){
+        ssize_t sent = write(server, text, remaining);
+        if (sent < 0){
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        text += sent;
+        remaining -= sent;
+    }
+    return 0;
+}
+
+
+int main(int argc, char *argv[]){
+    if (argc < 3){
+        fprintf(stderr, "Usage: %s SOCKET COMMAND...\n", argv[0]);
+        return 2;
+    }
+
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, argv[1], sizeof(addr.sun_path) - 1);
+
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server < 0 || connect(server, (struct sockaddr *) &addr, sizeof(addr)) < 0){
+        perror(argv[1]);
+        return 2;
+    }
+
+    int32_t status = 0;
+    for (int i = 2; i < argc; i++){
+        if (send_request(server, argv[i]) < 0 ||
+            recv(server, &status, sizeof(status), MSG_WAITALL) != sizeof(status)){
+            perror("cscshell-client");
+            return 2;
+        }
+    }
+    close(server);
+    return status < 0 ? 255 : status;
+}
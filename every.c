@@ -0,0 +1,341 @@
+/*****************************************************************************/
+/*                           CSC209-24s A3 CSCSHELL                          */
+/*       Copyright 2024 -- Demetres Kostas PhD (aka Darlene Heliokinde)      */
+/*****************************************************************************/
+
+#include "cscshell.h"
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+
+
+/*
+** every runs its command at once and then on each tick of a periodic
+** timerfd. The kernel keeps the ticks on the original schedule however
+** late a run starts, so they don't drift. The shell waits in poll for the
+** next tick or for the run to end (through a pidfd for it). A tick that
+** comes while a run is still going is skipped, or with -c kept and run as
+** soon as the current one finishes.
+*/
+
+// What is known of every run so far
+typedef struct EveryStats {
+    uint64_t *durations;  // ns from start to exit, of every finished run
+    size_t num_runs;
+    size_t cap;
+    uint64_t skipped;
+    uint64_t failed;
+    uint64_t total_lag;   // ns from the tick to the start, over finished runs
+    uint64_t max_lag;
+} EveryStats;
+
+static volatile sig_atomic_t every_interrupted = 0;
+
+
+/* HELPERS */
+
+static void every_on_interrupt(int signum){
+    (void) signum;
+    every_interrupted = 1;
+}
+
+/**
+ * @brief Formats ns as a number in the largest unit it doesn't go under
+ */
+static void format_duration(char *buf, size_t n, uint64_t ns){
+    if (ns >= 1000000000ull){
+        snprintf(buf, n, "%.3fs", ns / 1e9);
+    }
+    else if (ns >= 1000000ull){
+        snprintf(buf, n, "%.3fms", ns / 1e6);
+    }
+    else {
+        snprintf(buf, n, "%.3fus", ns / 1e3);
+    }
+}
+
+static int compare_durations(const void *a, const void *b){
+    uint64_t x = *(const uint64_t *) a;
+    uint64_t y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Writes the run counts and the spread of run times to stderr
+ */
+static void report_every_stats(EveryStats *stats){
+    fprintf(stderr, "---- every: %zu runs, %lu skipped, %lu failed ----\n",
+            stats->num_runs, (unsigned long) stats->skipped,
+            (unsigned long) stats->failed);
+    if (stats->num_runs == 0){
+        return;
+    }
+
+    qsort(stats->durations, stats->num_runs, sizeof(uint64_t), compare_durations);
+    uint64_t total = 0;
+    for (size_t i = 0; i < stats->num_runs; i++){
+        total += stats->durations[i];
+    }
+    uint64_t points[] = {
+        stats->durations[0],
+        total / stats->num_runs,
+        stats->durations[(stats->num_runs - 1) / 2],
+        stats->durations[(stats->num_runs - 1) * 95 / 100],
+        stats->durations[stats->num_runs - 1],
+    };
+    const char *names[] = {"min", "avg", "p50", "p95", "max"};
+    fprintf(stderr, "run time:  ");
+    for (int i = 0; i < 5; i++){
+        char value[MAX_USER_BUF];
+        format_duration(value, MAX_USER_BUF, points[i]);
+        fprintf(stderr, " %s %s", names[i], value);
+    }
+
+    char avg_lag[MAX_USER_BUF];
+    char max_lag[MAX_USER_BUF];
+    format_duration(avg_lag, MAX_USER_BUF, stats->total_lag / stats->num_runs);
+    format_duration(max_lag, MAX_USER_BUF, stats->max_lag);
+    fprintf(stderr, "\nstart lag:  avg %s max %s\n", avg_lag, max_lag);
+}
+
+/**
+ * @brief Adds a finished run to stats, with how long after its tick it
+ * started
+ *
+ * @return int: 0 on success, -1 on error
+ */
+static int record_run(EveryStats *stats, uint64_t duration, uint64_t lag,
+                      int status){
+    if (stats->num_runs == stats->cap){
+        size_t cap = stats->cap == 0 ? 64 : stats->cap * 2;
+        uint64_t *grown = mem_realloc(stats->durations, sizeof(uint64_t) * cap,
+                                      MEM_EXECUTION);
+        if (grown == NULL){
+            perror("every");
+            return -1;
+        }
+        stats->durations = grown;
+        stats->cap = cap;
+    }
+    stats->durations[stats->num_runs++] = duration;
+    stats->total_lag += lag;
+    stats->max_lag = lag > stats->max_lag ? lag : stats->max_lag;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0){
+        stats->failed++;
+    }
+    return 0;
+}
+
+/**
+ * @brief Starts one run of the command, with its stdout going to out_fd
+ *
+ * @param pidfd: filled in with an fd that polls readable once it exits
+ * @return pid_t: the pid of the run, -1 on error
+ */
+static pid_t start_run(Command *child, Command *command, int out_fd, int *pidfd){
+    // run_command closes both in the parent; the originals stay ours
+    child->stdout_fd = dup(out_fd);
+    child->stdin_fd = command->stdin_fd == STDIN_FILENO ? STDIN_FILENO :
+                      dup(command->stdin_fd);
+    if (child->stdout_fd < 0 || child->stdin_fd < 0){
+        perror("every");
+        if (child->stdout_fd >= 0) close(child->stdout_fd);
+        if (child->stdin_fd > STDIN_FILENO) close(child->stdin_fd);
+        return -1;
+    }
+
+    pid_t pid = run_command(child);
+    if (pid < 0){
+        return -1;
+    }
+    // a child that already exited is still there to open until it's reaped
+    *pidfd = syscall(SYS_pidfd_open, pid, 0);
+    if (*pidfd < 0){
+        perror("every");
+        int status;
+        kill(pid, SIGKILL);
+        wait_child(pid, &status);
+        return -1;
+    }
+    return pid;
+}
+
+
+/* SHELL EXTENSION FUNCTIONS */
+
+int parse_interval(const char *text, uint64_t *ns){
+    char *end;
+    errno = 0;
+    double value = strtod(text, &end);
+    if (errno != 0 || end == text || value <= 0){
+        return -1;
+    }
+
+    double scale;
+    if (*end == '\0' || strcmp(end, "s") == 0) scale = 1e9;
+    else if (strcmp(end, "ms") == 0) scale = 1e6;
+    else if (strcmp(end, "us") == 0) scale = 1e3;
+    else if (strcmp(end, "m") == 0) scale = 60e9;
+    else if (strcmp(end, "h") == 0) scale = 3600e9;
+    else return -1;
+
+    // below a microsecond, the ticks would come faster than any run
+    if (value * scale < 1e3 || value * scale > 1e18){
+        return -1;
+    }
+    *ns = (uint64_t) (value * scale);
+    return 0;
+}
+
+int every_run(Command *command, int first, uint64_t interval, uint8_t catch_up,
+              uint64_t max_runs, BuiltinOutput *out){
+    // the command is resolved once, for every run
+    Command child = *command;
+    child.args = command->args + first;
+    child.next = NULL;
+    child.tee_next = NULL;
+    child.more_out = NULL;
+    child.redir_in_path = NULL;
+    child.redir_out_path = NULL;
+    child.here_doc = NULL;
+    child.exec_path = NULL;
+    if (find_builtin(child.args[0]) == NULL && find_function(child.args[0]) == NULL){
+        child.exec_path = resolve_executable(child.args[0], *command->variables);
+        if (child.exec_path == NULL){
+            ERR_PRINT(ERR_NO_EXECU, child.args[0]);
+            return EXEC_FAILED_STATUS;
+        }
+    }
+
+    // a captured output is collected from a memfd after each run
+    int out_fd = out->capture == NULL ? out->fd :
+                 memfd_create(EVERY_MEMFD_NAME, MFD_CLOEXEC);
+    int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (out_fd < 0 || timer_fd < 0){
+        perror("every");
+        if (out->capture != NULL && out_fd >= 0) close(out_fd);
+        if (timer_fd >= 0) close(timer_fd);
+        mem_free(child.exec_path);
+        return -1;
+    }
+
+    struct sigaction interrupt = {0};
+    struct sigaction saved;
+    sigset_t interrupt_mask;
+    interrupt.sa_handler = every_on_interrupt;
+    sigemptyset(&interrupt_mask);
+    sigaddset(&interrupt_mask, SIGINT);
+    every_interrupted = 0;
+    sigaction(SIGINT, &interrupt, &saved);
+
+    EveryStats stats = {0};
+    int status = 0;
+    int result = -1;
+    pid_t running = -1;
+    int pidfd = -1;
+    uint64_t pending = 1; // the first run goes right away
+    uint64_t started = 0;
+    uint64_t run_start = 0;
+    uint64_t run_lag = 0;
+    uint64_t due = trace_clock(); // when the next run to start was meant to
+
+    struct itimerspec period = {
+        {interval / 1000000000ull, interval % 1000000000ull},
+        {interval / 1000000000ull, interval % 1000000000ull},
+    };
+    if (timerfd_settime(timer_fd, 0, &period, NULL) < 0){
+        perror("every");
+        goto every_cleanup;
+    }
+
+    while (!every_interrupted){
+        if (running < 0 && pending > 0 && started < max_runs){
+            pending--;
+            run_start = trace_clock();
+            running = start_run(&child, command, out_fd, &pidfd);
+            if (running < 0){
+                goto every_cleanup;
+            }
+            started++;
+            run_lag = run_start > due ? run_start - due : 0;
+            due += interval;
+        }
+        if (running < 0 && started == max_runs){
+            result = 0;
+            break;
+        }
+
+        // SIGINT is only let in while waiting, so it can't come just
+        // before the wait and be missed until the next tick
+        struct pollfd fds[2] = {{timer_fd, POLLIN, 0}, {pidfd, POLLIN, 0}};
+        sigset_t waiting;
+        sigprocmask(SIG_BLOCK, &interrupt_mask, &waiting);
+        int ready = every_interrupted ? 0 :
+                    ppoll(fds, running < 0 ? 1 : 2, NULL, &waiting);
+        sigprocmask(SIG_SETMASK, &waiting, NULL);
+        if (ready < 0 && errno != EINTR){
+            perror("every");
+            goto every_cleanup;
+        }
+        if (ready <= 0){
+            continue;
+        }
+
+        if (fds[0].revents & POLLIN){
+            uint64_t ticks;
+            if (read(timer_fd, &ticks, sizeof(ticks)) == sizeof(ticks) &&
+                started < max_runs){
+                if (catch_up){
+                    pending += ticks;
+                }
+                else {
+                    // only the newest tick runs, and only if nothing is
+                    // running already
+                    uint64_t missed = running < 0 ? ticks - 1 : ticks;
+                    stats.skipped += missed;
+                    pending = running < 0 ? 1 : 0;
+                    due += interval * missed;
+                }
+            }
+        }
+        if (running >= 0 && (fds[1].revents & POLLIN)){
+            if (wait_child(running, &status) == -1){
+                perror("waitpid");
+                goto every_cleanup;
+            }
+            close(pidfd);
+            running = -1;
+            if (record_run(&stats, trace_clock() - run_start, run_lag, status) < 0 ||
+                (out->capture != NULL && builtin_write_fd(out, out_fd) < 0)){
+                goto every_cleanup;
+            }
+        }
+    }
+    if (every_interrupted){
+        result = 128 + SIGINT;
+    }
+
+every_cleanup:
+    if (running >= 0){
+        // it was sent the interrupt too if it shares our terminal
+        kill(running, SIGINT);
+        wait_child(running, &status);
+        close(pidfd);
+        if (out->capture != NULL){
+            builtin_write_fd(out, out_fd);
+        }
+    }
+    sigaction(SIGINT, &saved, NULL);
+    report_every_stats(&stats);
+    mem_free(stats.durations);
+    close(timer_fd);
+    if (out->capture != NULL){
+        close(out_fd);
+    }
+    mem_free(child.exec_path);
+    if (result == 0 && WIFEXITED(status)){
+        result = WEXITSTATUS(status);
+    }
+    return result;
+}
@@ -0,0 +1,293 @@
+/*****************************************************************************/
+/*                           CSC209-24s A3 CSCSHELL                          */
+/*       Copyright 2024 -- Demetres Kostas PhD (aka Darlene Heliokinde)      */
+/*****************************************************************************/
+
+#include "cscshell.h"
+
+
+/*
+** A fanned out line is run as: the first pipeline writing into a pipe the
+** shell holds, every "|&" pipeline reading from a pipe of its own, and the
+** shell copying between them. Each chunk is tee'd (duplicated, not
+** consumed) once per extra target and spliced into the last one, so the
+** data never comes up into the shell. The exception is files appended to:
+** splice refuses O_APPEND fds, and without O_APPEND writers sharing the
+** file would overwrite each other, so those are written to from the shell.
+*/
+
+
+/* HELPERS */
+
+/**
+ * @brief Opens a fan-out file target
+ *
+ * @return int: the fd, -1 on error
+ */
+static int open_fanout_file(const char *path, uint8_t append){
+    int flags = O_WRONLY | O_CREAT | O_CLOEXEC | (append ? O_APPEND : O_TRUNC);
+    int fd = open(path, flags, 0644);
+    if (fd < 0){
+        perror(path);
+    }
+    return fd;
+}
+
+/**
+ * @brief Moves exactly n bytes, already waiting in the pipe from, to to. If
+ * to stops taking them (the reader went away), the rest go to discard so
+ * from is left empty either way.
+ *
+ * @return int: 0 on success, -1 if to failed
+ */
+static int splice_all(int from, int to, size_t n, int discard){
+    int failed = 0;
+    while (n > 0){
+        ssize_t moved = splice(from, NULL, failed ? discard : to, NULL, n, SPLICE_F_MOVE);
+        if (moved < 0 && errno == EINTR) continue;
+        if (moved <= 0){
+            if (failed){
+                return -1; // not even the discard would take them
+            }
+            if (errno != EPIPE){
+                perror("splice");
+            }
+            failed = 1;
+            continue;
+        }
+        n -= moved;
+    }
+    return failed ? -1 : 0;
+}
+
+/**
+ * @brief Like splice_all, for the O_APPEND files splice refuses: the bytes
+ * are read up and written, each write landing at the end of the file.
+ *
+ * @return int: 0 on success, -1 if to failed
+ */
+static int write_all(int from, int to, size_t n, int discard){
+    char buf[FANOUT_WRITE_BUF];
+    while (n > 0){
+        ssize_t got = read(from, buf, n < FANOUT_WRITE_BUF ? n : FANOUT_WRITE_BUF);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0){
+            perror("read");
+            return -1;
+        }
+        n -= got;
+        for (char *data = buf; got > 0; ){
+            ssize_t written = write(to, data, got);
+            if (written < 0 && errno == EINTR) continue;
+            if (written < 0){
+                perror("write");
+                // leave from empty, as splice_all does
+                if (n > 0) splice_all(from, discard, n, discard);
+                return -1;
+            }
+            data += written;
+            got -= written;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Copies everything from source to every target until source hits
+ * EOF or no target is left. A target that fails is closed and set to -1.
+ * Targets that are appending are written to, and never handed the chunk.
+ */
+static void pump_fanout(int source, int *targets, const uint8_t *appending,
+                        int num_targets){
+    int scratch[2];
+    int discard = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    if (pipe2(scratch, O_CLOEXEC) < 0 || discard < 0){
+        perror("fanout");
+        if (discard >= 0) close(discard);
+        return;
+    }
+
+    while (1){
+        int last = -1;
+        uint8_t any_open = 0;
+        for (int i = 0; i < num_targets; i++){
+            if (targets[i] < 0) continue;
+            any_open = 1;
+            if (!appending[i]) last = i;
+        }
+        if (!any_open){
+            break;
+        }
+
+        // duplicate the chunk for every target but the last
+        ssize_t chunk = -1;
+        for (int i = 0; i < num_targets; i++){
+            if (targets[i] < 0 || i == last){
+                continue;
+            }
+            ssize_t copied;
+            do {
+                // blocks until there is data, like read would
+                copied = tee(source, scratch[1], chunk < 0 ? FANOUT_CHUNK : chunk, 0);
+            } while (copied < 0 && errno == EINTR);
+            if (copied <= 0){
+                if (copied < 0) perror("tee");
+                chunk = 0;
+                break;
+            }
+            chunk = copied;
+            int moved = appending[i] ? write_all(scratch[0], targets[i], copied, discard) :
+                                       splice_all(scratch[0], targets[i], copied, discard);
+            if (moved < 0){
+                close(targets[i]);
+                targets[i] = -1;
+            }
+        }
+        if (chunk == 0){
+            break;
+        }
+
+        // then hand the chunk itself to the last one (or drop it, when
+        // every target left was written a copy)
+        if (last < 0){
+            splice_all(source, discard, chunk, discard);
+        }
+        else if (chunk < 0){
+            ssize_t moved;
+            do {
+                moved = splice(source, NULL, targets[last], NULL, FANOUT_CHUNK,
+                               SPLICE_F_MOVE);
+            } while (moved < 0 && errno == EINTR);
+            if (moved == 0){
+                break;
+            }
+            if (moved < 0){
+                if (errno != EPIPE) perror("splice");
+                close(targets[last]);
+                targets[last] = -1;
+            }
+        }
+        else if (splice_all(source, targets[last], chunk, discard) < 0){
+            close(targets[last]);
+            targets[last] = -1;
+        }
+    }
+
+    close(scratch[0]);
+    close(scratch[1]);
+    close(discard);
+}
+
+
+/* SHELL EXTENSION FUNCTIONS */
+
+uint8_t needs_fanout(Command *head){
+    Command *last = head;
+    while (last->next != NULL){
+        last = last->next;
+    }
+    return head->tee_next != NULL || last->more_out != NULL;
+}
+
+int *execute_fanout(Command *head){
+    int *exit_code = mem_alloc(sizeof(int), MEM_EXECUTION);
+    *exit_code = -1;
+
+    Command *last = head;
+    int num_commands = 0;
+    for (Command *curr = head; curr != NULL; curr = curr->next){
+        last = curr;
+        num_commands++;
+    }
+    int num_targets = last->redir_out_path != NULL;
+    for (OutTarget *out = last->more_out; out != NULL; out = out->next){
+        num_targets++;
+    }
+    for (Command *branch = head->tee_next; branch != NULL; branch = branch->tee_next){
+        num_targets++;
+        for (Command *curr = branch; curr != NULL; curr = curr->next){
+            num_commands++;
+        }
+    }
+
+    pid_t *pid_list = mem_alloc(sizeof(pid_t) * num_commands, MEM_EXECUTION);
+    int *targets = mem_alloc(sizeof(int) * num_targets, MEM_EXECUTION);
+    uint8_t *appending = mem_calloc(num_targets, sizeof(uint8_t), MEM_EXECUTION);
+    int source[2] = {-1, -1};
+    int num_pids = 0;
+    int num_open = 0;
+    if (pid_list == NULL || targets == NULL || appending == NULL ||
+        pipe2(source, O_CLOEXEC) < 0){
+        perror("fanout");
+        goto fanout_cleanup;
+    }
+
+    // the files, in the order they were given
+    if (last->redir_out_path != NULL){
+        appending[num_open] = last->redir_append;
+        targets[num_open] = open_fanout_file(last->redir_out_path, last->redir_append);
+        if (targets[num_open++] < 0) goto fanout_cleanup;
+    }
+    for (OutTarget *out = last->more_out; out != NULL; out = out->next){
+        appending[num_open] = out->append;
+        targets[num_open] = open_fanout_file(out->path, out->append);
+        if (targets[num_open++] < 0) goto fanout_cleanup;
+    }
+
+    // the producer writes to us rather than to its files. The line may be
+    // cached and run again, so its own fields are put back after.
+    char *out_path = last->redir_out_path;
+    int out_fd = last->stdout_fd;
+    last->redir_out_path = NULL;
+    last->stdout_fd = source[1];
+    int started = start_pipeline(head, pid_list);
+    last->redir_out_path = out_path;
+    last->stdout_fd = out_fd;
+    if (started < 0){
+        goto fanout_cleanup;
+    }
+    source[1] = -1; // run_command closed it once it forked
+    num_pids = started;
+
+    for (Command *branch = head->tee_next; branch != NULL; branch = branch->tee_next){
+        int feed[2];
+        if (pipe2(feed, O_CLOEXEC) < 0){
+            perror("fanout");
+            goto fanout_cleanup;
+        }
+        targets[num_open++] = feed[1];
+        branch->stdin_fd = feed[0];
+        started = start_pipeline(branch, pid_list + num_pids);
+        branch->stdin_fd = STDIN_FILENO;
+        if (started < 0){
+            goto fanout_cleanup;
+        }
+        num_pids += started;
+    }
+
+    // a branch that exits early must not take the shell down with it
+    struct sigaction ignore = {0};
+    struct sigaction saved;
+    ignore.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &ignore, &saved);
+    pump_fanout(source[0], targets, appending, num_targets);
+    sigaction(SIGPIPE, &saved, NULL);
+
+fanout_cleanup:
+    // closing the targets is what lets the branches see EOF
+    for (int i = 0; i < num_open; i++){
+        if (targets[i] >= 0) close(targets[i]);
+    }
+    if (source[0] >= 0) close(source[0]);
+    if (source[1] >= 0) close(source[1]);
+    if (num_open == num_targets && num_pids == num_commands){
+        *exit_code = wait_pipeline(pid_list, num_pids);
+    }
+    else if (num_pids > 0){
+        wait_pipeline(pid_list, num_pids);
+    }
+    mem_free(targets);
+    mem_free(appending);
+    mem_free(pid_list);
+    return exit_code;
+}
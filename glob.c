@@ -0,0 +1,383 @@
+/*****************************************************************************/
+/*                           CSC209-24s A3 CSCSHELL                          */
+/*       Copyright 2024 -- Demetres Kostas PhD (aka Darlene Heliokinde)      */
+/*****************************************************************************/
+
+#include "cscshell.h"
+
+
+/* HELPERS */
+
+/**
+ * @brief Compares two strings through pointers to them, for qsort
+ */
+static int compare_names(const void *a, const void *b){
+    return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+/**
+ * @brief Matches a single character against a [...] bracket expression
+ *
+ * @param bracket: points at the opening '['
+ * @param c: the character
+ * @param end: set to just past the closing ']'
+ * @return int: 1 if it matches, 0 if not, -1 if the bracket isn't closed
+ *         (in which case '[' is an ordinary character)
+ */
+static int match_bracket(const char *bracket, char c, const char **end){
+    const char *p = bracket + 1;
+    uint8_t negate = (*p == '!' || *p == '^');
+    if (negate) p++;
+
+    uint8_t matched = 0;
+    const char *first = p;
+    // a ']' right at the start is part of the set
+    while (*p != '\0' && (*p != ']' || p == first)){
+        if (p[1] == '-' && p[2] != ']' && p[2] != '\0'){
+            if (p[0] <= c && c <= p[2]) matched = 1;
+            p += 3;
+        }
+        else {
+            if (*p == c) matched = 1;
+            p++;
+        }
+    }
+    if (*p != ']'){
+        return -1;
+    }
+    *end = p + 1;
+    return matched != negate;
+}
+
+/**
+ * @brief Reads a directory into the cache, sorted, unless it is cached.
+ *
+ * @param cache: the per-line cache
+ * @param dir_path: the directory ("" for the current one)
+ * @return DirListing*: the listing, NULL if the directory can't be read
+ */
+static DirListing *list_directory(GlobCache *cache, const char *dir_path){
+    for (DirListing *curr = cache->listings; curr != NULL; curr = curr->next){
+        if (strcmp(curr->path, dir_path) == 0){
+            return curr;
+        }
+    }
+
+    DIR *dir = opendir(*dir_path == '\0' ? "." : dir_path);
+    if (dir == NULL){
+        return NULL;
+    }
+
+    DirListing *listing = mem_calloc(1, sizeof(DirListing), MEM_EXPANSION);
+    if (listing == NULL){
+        perror("list_directory");
+        closedir(dir);
+        return NULL;
+    }
+    listing->path = mem_strdup(dir_path, MEM_EXPANSION);
+
+    int cap = 16;
+    listing->names = mem_alloc(sizeof(char *) * cap, MEM_EXPANSION);
+    struct dirent *entry;
+    while (listing->names != NULL && (entry = readdir(dir)) != NULL){
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0){
+            continue;
+        }
+        if (listing->count == cap){
+            cap *= 2;
+            char **grown = mem_realloc(listing->names, sizeof(char *) * cap,
+                                       MEM_EXPANSION);
+            if (grown == NULL){
+                perror("list_directory");
+                break;
+            }
+            listing->names = grown;
+        }
+        listing->names[listing->count++] = mem_strdup(entry->d_name, MEM_EXPANSION);
+    }
+    closedir(dir);
+    qsort(listing->names, listing->count, sizeof(char *), compare_names);
+
+    listing->next = cache->listings;
+    cache->listings = listing;
+    return listing;
+}
+
+/**
+ * @brief Appends a copy of text to a growing, NULL terminated args array
+ *
+ * @return int: 0 on success, -1 on failure
+ */
+static int push_arg(char ***args, int *num_args, int *cap, const char *text){
+    char *arg = mem_strdup(text, MEM_EXPANSION);
+    if (arg == NULL){
+        perror("expand_globs");
+        return -1;
+    }
+    if (*num_args + 1 >= *cap){
+        *cap *= 2;
+        char **grown = mem_realloc(*args, sizeof(char *) * *cap, MEM_EXPANSION);
+        if (grown == NULL){
+            perror("expand_globs");
+            mem_free(arg);
+            return -1;
+        }
+        *args = grown;
+    }
+    (*args)[(*num_args)++] = arg;
+    (*args)[*num_args] = NULL;
+    return 0;
+}
+
+/**
+ * @brief Expands the pattern components from comp onwards below the path
+ * built so far, depth first, appending every match to args. Since each
+ * listing is sorted, the matches come out sorted too.
+ *
+ * @param path: the path built so far, with room for MAX_PATH_STR bytes
+ * @param path_len: the length of path
+ * @param comp: the remaining pattern, starting at a component
+ * @param must_check: set below a glob, where literal components may not exist
+ * @return int: the number of matches, -1 on error
+ */
+static int expand_component(char *path, size_t path_len, const char *comp,
+                            uint8_t must_check, GlobCache *cache,
+                            char ***args, int *num_args, int *cap){
+    size_t comp_len = strcspn(comp, "/");
+    const char *rest = comp[comp_len] == '/' ? comp + comp_len + 1 : NULL;
+    while (rest != NULL && *rest == '/') rest++;
+
+    if (comp_len == 0){
+        // pattern ended with a slash: only directories match
+        struct stat info;
+        if (stat(path, &info) < 0 || !S_ISDIR(info.st_mode)){
+            return 0;
+        }
+        return push_arg(args, num_args, cap, path) < 0 ? -1 : 1;
+    }
+    if (path_len + comp_len + 2 >= MAX_PATH_STR){
+        return 0;
+    }
+
+    char pattern[comp_len + 1];
+    strncpy(pattern, comp, comp_len);
+    pattern[comp_len] = '\0';
+
+    if (strpbrk(pattern, GLOB_CHARS) == NULL){
+        strcpy(path + path_len, pattern);
+        size_t new_len = path_len + comp_len;
+        if (rest != NULL){
+            path[new_len++] = '/';
+            path[new_len] = '\0';
+            return expand_component(path, new_len, rest, must_check, cache,
+                                    args, num_args, cap);
+        }
+        struct stat info;
+        if (must_check && lstat(path, &info) < 0){
+            return 0;
+        }
+        return push_arg(args, num_args, cap, path) < 0 ? -1 : 1;
+    }
+
+    path[path_len] = '\0';
+    DirListing *listing = list_directory(cache, path);
+    if (listing == NULL){
+        return 0;
+    }
+
+    int found = 0;
+    for (int i = 0; i < listing->count; i++){
+        const char *name = listing->names[i];
+        // hidden files only match a pattern that starts with '.'
+        if (name[0] == '.' && pattern[0] != '.') continue;
+        if (!glob_match(pattern, name)) continue;
+
+        size_t name_len = strlen(name);
+        if (path_len + name_len + 2 >= MAX_PATH_STR) continue;
+        strcpy(path + path_len, name);
+
+        int matched;
+        if (rest != NULL){
+            path[path_len + name_len] = '/';
+            path[path_len + name_len + 1] = '\0';
+            matched = expand_component(path, path_len + name_len + 1, rest, 1,
+                                       cache, args, num_args, cap);
+        }
+        else {
+            matched = push_arg(args, num_args, cap, path) < 0 ? -1 : 1;
+        }
+        if (matched < 0){
+            return -1;
+        }
+        found += matched;
+    }
+    return found;
+}
+
+/**
+ * @brief Appends the matches of one word, in order, or the word itself if
+ * it isn't a pattern or matches nothing
+ *
+ * @return int: 0 on success, -1 on failure
+ */
+static int expand_word(const char *word, GlobCache *cache,
+                       char ***args, int *num_args, int *cap){
+    int matched = 0;
+    if (strpbrk(word, GLOB_CHARS) != NULL){
+        char path[MAX_PATH_STR];
+        size_t path_len = 0;
+        const char *comp = word;
+        if (*word == '/'){
+            path[path_len++] = '/';
+            comp += strspn(word, "/");
+        }
+        path[path_len] = '\0';
+        matched = expand_component(path, path_len, comp, 0, cache,
+                                   args, num_args, cap);
+    }
+
+    // no match (or not a pattern): the word is kept literally
+    if (matched == 0){
+        matched = push_arg(args, num_args, cap, word);
+    }
+    return matched < 0 ? -1 : 0;
+}
+
+
+/* SHELL EXTENSION FUNCTIONS */
+
+int glob_match(const char *pattern, const char *name){
+    // Greedy matching that only ever remembers the most recent '*': on a
+    // mismatch we resume right after it, one character further along the
+    // name. No recursion, and O(len(pattern) * len(name)) at worst.
+    const char *star = NULL;
+    const char *star_name = NULL;
+
+    while (*name != '\0'){
+        const char *after_bracket;
+        int bracket;
+        if (*pattern == '*'){
+            star = ++pattern;
+            star_name = name;
+            continue;
+        }
+        if (*pattern == '?'){
+            pattern++;
+            name++;
+            continue;
+        }
+        if (*pattern == '['){
+            bracket = match_bracket(pattern, *name, &after_bracket);
+            if (bracket == 1){
+                pattern = after_bracket;
+                name++;
+                continue;
+            }
+            if (bracket == -1 && *name == '['){
+                pattern++;
+                name++;
+                continue;
+            }
+        }
+        else if (*pattern != '\0' && *pattern == *name){
+            pattern++;
+            name++;
+            continue;
+        }
+
+        if (star == NULL){
+            return 0;
+        }
+        pattern = star;
+        name = ++star_name;
+    }
+
+    while (*pattern == '*'){
+        pattern++;
+    }
+    return *pattern == '\0';
+}
+
+int expand_globs(Command *command, GlobCache *cache){
+    int i = 1;
+    while (command->args[i] != NULL &&
+           strpbrk(command->args[i], GLOB_CHARS) == NULL){
+        i++;
+    }
+    if (command->args[i] == NULL){
+        return 0; // nothing to expand, leave the args alone
+    }
+    // the matches depend on the filesystem, not just the line
+    parse_volatile = 1;
+
+    int cap = i + 8;
+    int num_args = i;
+    char **args = mem_alloc(sizeof(char *) * cap, MEM_EXPANSION);
+    if (args == NULL){
+        perror("expand_globs");
+        return -1;
+    }
+    // args before the first pattern move across as they are
+    memcpy(args, command->args, sizeof(char *) * i);
+    args[num_args] = NULL;
+
+    int num_original = i;
+    while (command->args[num_original] != NULL){
+        num_original++;
+    }
+    uint8_t replaced[num_original];
+    memset(replaced, 0, num_original);
+
+    for (; command->args[i] != NULL; i++){
+        if (expand_word(command->args[i], cache, &args, &num_args, &cap) < 0){
+            // the original args are untouched, only drop what we built
+            for (int j = 0; j < num_args; j++){
+                if (j >= num_original || args[j] != command->args[j]) mem_free(args[j]);
+            }
+            mem_free(args);
+            return -1;
+        }
+        replaced[i] = 1;
+    }
+
+    for (int j = 0; j < num_original; j++){
+        if (replaced[j]) mem_free(command->args[j]);
+    }
+    mem_free(command->args);
+    command->args = args;
+    return 0;
+}
+
+void free_glob_cache(GlobCache *cache){
+    DirListing *curr = cache->listings;
+    while (curr != NULL){
+        DirListing *next = curr->next;
+        for (int i = 0; i < curr->count; i++){
+            mem_free(curr->names[i]);
+        }
+        mem_free(curr->names);
+        mem_free(curr->path);
+        mem_free(curr);
+        curr = next;
+    }
+    cache->listings = NULL;
+}
+
+char **expand_glob_word(const char *word, GlobCache *cache){
+    int cap = 8;
+    int num_matches = 0;
+    char **matches = mem_alloc(sizeof(char *) * cap, MEM_EXPANSION);
+    if (matches == NULL){
+        perror("expand_globs");
+        return NULL;
+    }
+    matches[0] = NULL;
+    if (expand_word(word, cache, &matches, &num_matches, &cap) < 0){
+        for (int i = 0; i < num_matches; i++){
+            mem_free(matches[i]);
+        }
+        mem_free(matches);
+        return NULL;
+    }
+    return matches;
+}
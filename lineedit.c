@@ -0,0 +1,481 @@
+/*****************************************************************************/
+/*                           CSC209-24s A3 CSCSHELL                          */
+/*       Copyright 2024 -- Demetres Kostas PhD (aka Darlene Heliokinde)      */
+/*****************************************************************************/
+
+#include "cscshell.h"
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+
+
+/*
+** The terminal is only in raw mode while a line is being edited. The row
+** after the prompt is modelled in shown, so after each batch of input only
+** the cells from the first one that changed on are written, along with
+** any cursor movement, in a single write. Keys that arrive together (a
+** paste, or typing while the terminal is busy with other output) are all
+** applied before that one redraw. Input is read a byte at a time and never
+** past the end of the line, so typeahead is left for what the line runs.
+** A line too long for the row scrolls sideways. Columns are counted per
+** UTF-8 character.
+*/
+
+typedef struct LineEditor {
+    char *buf;            // the caller's line
+    size_t len;
+    size_t pos;           // the cursor, as a byte offset into buf
+    size_t max;           // the most bytes buf takes
+    size_t offset;        // the first byte of buf on screen
+    size_t start_col;     // the column just after the prompt
+    char *shown;          // what the screen shows after the prompt
+    size_t shown_len;
+    size_t shown_cursor;  // the cursor's column, past start_col
+    int browsing;         // the history entry being edited, or history_len
+    char *saved;          // the new line, while browsing history
+} LineEditor;
+
+static char *history[LINE_HISTORY_SIZE];
+static int history_len = 0;
+static char *kill_buf = NULL;
+
+#define KEY_CTRL(key) ((key) & 0x1f)
+#define KEY_BACKSPACE 127
+#define KEY_ESCAPE 27
+#define NO_BYTE -1
+#define END_OF_INPUT -2
+
+
+/* HELPERS */
+
+static uint8_t is_continuation(char c){
+    return ((unsigned char) c & 0xc0) == 0x80;
+}
+
+/**
+ * @brief The columns n bytes of UTF-8 take, one per character
+ */
+static size_t columns(const char *text, size_t n){
+    size_t cols = 0;
+    for (size_t i = 0; i < n; i++){
+        cols += !is_continuation(text[i]);
+    }
+    return cols;
+}
+
+static size_t prev_char(LineEditor *ed, size_t pos){
+    while (pos > 0 && is_continuation(ed->buf[--pos]));
+    return pos;
+}
+
+static size_t next_char(LineEditor *ed, size_t pos){
+    while (pos < ed->len && is_continuation(ed->buf[++pos]));
+    return pos;
+}
+
+static size_t prev_word(LineEditor *ed, size_t pos){
+    while (pos > 0 && ed->buf[pos - 1] == ' ') pos--;
+    while (pos > 0 && ed->buf[pos - 1] != ' ') pos--;
+    return pos;
+}
+
+static size_t next_word(LineEditor *ed, size_t pos){
+    while (pos < ed->len && ed->buf[pos] == ' ') pos++;
+    while (pos < ed->len && ed->buf[pos] != ' ') pos++;
+    return pos;
+}
+
+static size_t term_width(void){
+    struct winsize size;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) < 0 || size.ws_col == 0){
+        return 80;
+    }
+    return size.ws_col;
+}
+
+/**
+ * @brief Writes all of data, waiting for room if the terminal is busy
+ *
+ * @return int: 0 on success, -1 on error
+ */
+static int write_all(const char *data, size_t n){
+    while (n > 0){
+        ssize_t written = write(STDOUT_FILENO, data, n);
+        if (written < 0){
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN){
+                struct pollfd out = {STDOUT_FILENO, POLLOUT, 0};
+                poll(&out, 1, -1);
+                continue;
+            }
+            return -1;
+        }
+        data += written;
+        n -= written;
+    }
+    return 0;
+}
+
+/**
+ * @brief Waits up to timeout ms (forever if negative) for input
+ *
+ * @return int: 1 if there is some, 0 if not
+ */
+static int input_ready(int timeout){
+    struct pollfd in = {STDIN_FILENO, POLLIN, 0};
+    int ready;
+    do {
+        ready = poll(&in, 1, timeout);
+    } while (ready < 0 && errno == EINTR);
+    return ready > 0;
+}
+
+/**
+ * @brief Reads the next byte of input, waiting up to timeout ms (forever
+ * if negative). Only one byte is taken from the terminal at a time: what
+ * follows the line belongs to whatever runs next.
+ *
+ * @return int: the byte, NO_BYTE if none came in time, END_OF_INPUT at EOF
+ */
+static int next_byte(int timeout){
+    if (!input_ready(timeout)){
+        return NO_BYTE;
+    }
+    unsigned char c;
+    ssize_t got;
+    do {
+        got = read(STDIN_FILENO, &c, 1);
+    } while (got < 0 && errno == EINTR);
+    return got == 1 ? c : END_OF_INPUT;
+}
+
+/**
+ * @brief Adds a move of the cursor to col (past start_col) to out
+ */
+static int move_to(ExpandBuffer *out, LineEditor *ed, size_t col){
+    char move[MAX_USER_BUF];
+    int n = 0;
+    if (col < ed->shown_cursor){
+        n = snprintf(move, MAX_USER_BUF, "\x1b[%zuD", ed->shown_cursor - col);
+    }
+    else if (col > ed->shown_cursor){
+        n = snprintf(move, MAX_USER_BUF, "\x1b[%zuC", col - ed->shown_cursor);
+    }
+    ed->shown_cursor = col;
+    return expand_buffer_append(out, move, n);
+}
+
+/**
+ * @brief Brings the screen up to date with the line, writing only what
+ * changed, then tail (if not NULL), all in one write
+ *
+ * @return int: 0 on success, -1 on error
+ */
+static int refresh(LineEditor *ed, const char *tail){
+    size_t width = term_width();
+    size_t avail = width > ed->start_col + 1 ? width - ed->start_col - 1 : 1;
+
+    // scroll so the cursor stays on screen
+    if (ed->pos < ed->offset){
+        ed->offset = ed->pos;
+    }
+    while (columns(ed->buf + ed->offset, ed->pos - ed->offset) > avail){
+        ed->offset = next_char(ed, ed->offset);
+    }
+    size_t end = ed->offset;
+    for (size_t cols = 0; end < ed->len && cols < avail; cols++){
+        end = next_char(ed, end);
+    }
+    const char *view = ed->buf + ed->offset;
+    size_t view_len = end - ed->offset;
+
+    // everything before the first changed character is left alone
+    size_t same = 0;
+    while (same < view_len && same < ed->shown_len && view[same] == ed->shown[same]){
+        same++;
+    }
+    while (same > 0 && same < view_len && is_continuation(view[same])){
+        same--;
+    }
+    size_t view_cols = columns(view, view_len);
+    size_t shown_cols = columns(ed->shown, ed->shown_len);
+
+    ExpandBuffer out;
+    if (expand_buffer_init(&out, MAX_USER_BUF) < 0){
+        return -1;
+    }
+    int error = 0;
+    if (same < view_len || view_cols < shown_cols){
+        error |= move_to(&out, ed, columns(view, same));
+        error |= expand_buffer_append(&out, view + same, view_len - same);
+        ed->shown_cursor = view_cols;
+        if (view_cols < shown_cols){
+            error |= expand_buffer_append(&out, "\x1b[K", 3);
+        }
+    }
+    error |= move_to(&out, ed, columns(view, ed->pos - ed->offset));
+    if (tail != NULL){
+        error |= expand_buffer_append(&out, tail, strlen(tail));
+    }
+    memcpy(ed->shown, view, view_len);
+    ed->shown_len = view_len;
+
+    if (!error && out.len > 0){
+        error = write_all(out.data, out.len);
+    }
+    mem_free(out.data);
+    return error ? -1 : 0;
+}
+
+/**
+ * @brief Starts a fresh row: the prompt, and nothing after it yet
+ */
+static int start_row(LineEditor *ed, const char *prompt_text, const char *before){
+    ed->start_col = columns(prompt_text, strlen(prompt_text)) % term_width();
+    ed->shown_len = 0;
+    ed->shown_cursor = 0;
+    ed->offset = 0;
+    return write_all(before, strlen(before)) < 0 ||
+           write_all(prompt_text, strlen(prompt_text)) < 0 ? -1 : 0;
+}
+
+static void insert_text(LineEditor *ed, const char *text, size_t n){
+    if (ed->len + n > ed->max){
+        write_all("\a", 1);
+        return;
+    }
+    memmove(ed->buf + ed->pos + n, ed->buf + ed->pos, ed->len - ed->pos);
+    memcpy(ed->buf + ed->pos, text, n);
+    ed->len += n;
+    ed->pos += n;
+}
+
+/**
+ * @brief Deletes bytes [from, to), keeping them for yanking if kill is set
+ */
+static void delete_range(LineEditor *ed, size_t from, size_t to, uint8_t kill){
+    if (from >= to){
+        return;
+    }
+    if (kill){
+        char *killed = strndup(ed->buf + from, to - from);
+        if (killed != NULL){
+            free(kill_buf);
+            kill_buf = killed;
+        }
+    }
+    memmove(ed->buf + from, ed->buf + to, ed->len - to);
+    ed->len -= to - from;
+    ed->pos = from;
+}
+
+static void set_line(LineEditor *ed, const char *text){
+    size_t n = strlen(text);
+    n = n > ed->max ? ed->max : n;
+    memcpy(ed->buf, text, n);
+    ed->len = ed->pos = n;
+}
+
+/**
+ * @brief Moves through the history by step (-1 older, 1 newer)
+ */
+static void browse_history(LineEditor *ed, int step){
+    int target = ed->browsing + step;
+    if (target < 0 || target > history_len){
+        return;
+    }
+    if (ed->browsing == history_len){
+        free(ed->saved);
+        ed->saved = strndup(ed->buf, ed->len);
+    }
+    ed->browsing = target;
+    set_line(ed, target == history_len ? (ed->saved ? ed->saved : "") : history[target]);
+}
+
+static void add_history(const char *line){
+    if (line[0] == '\0' ||
+        (history_len > 0 && strcmp(history[history_len - 1], line) == 0)){
+        return;
+    }
+    char *copy = strdup(line);
+    if (copy == NULL){
+        return;
+    }
+    if (history_len == LINE_HISTORY_SIZE){
+        free(history[0]);
+        memmove(history, history + 1, sizeof(char *) * (LINE_HISTORY_SIZE - 1));
+        history_len--;
+    }
+    history[history_len++] = copy;
+}
+
+/**
+ * @brief Applies an escape sequence: an arrow or editing key, or a
+ * meta (alt) key. Its bytes may still be on their way.
+ */
+static void handle_escape(LineEditor *ed){
+    int c = next_byte(LINE_ESC_TIMEOUT_MS);
+    if (c == '[' || c == 'O'){
+        // CSI: parameters, then a final byte
+        char params[MAX_USER_BUF];
+        size_t n = 0;
+        while ((c = next_byte(LINE_ESC_TIMEOUT_MS)) >= 0 && c >= 0x20 && c < 0x40){
+            if (n + 1 < MAX_USER_BUF) params[n++] = c;
+        }
+        params[n] = '\0';
+        switch (c){
+            case 'A': browse_history(ed, -1); break;
+            case 'B': browse_history(ed, 1); break;
+            case 'C': ed->pos = next_char(ed, ed->pos); break;
+            case 'D': ed->pos = prev_char(ed, ed->pos); break;
+            case 'H': ed->pos = 0; break;
+            case 'F': ed->pos = ed->len; break;
+            case '~':
+                if (strcmp(params, "1") == 0 || strcmp(params, "7") == 0) ed->pos = 0;
+                else if (strcmp(params, "4") == 0 || strcmp(params, "8") == 0) ed->pos = ed->len;
+                else if (strcmp(params, "3") == 0){
+                    delete_range(ed, ed->pos, next_char(ed, ed->pos), 0);
+                }
+                break;
+        }
+        return;
+    }
+
+    switch (c){
+        case 'b': ed->pos = prev_word(ed, ed->pos); break;
+        case 'f': ed->pos = next_word(ed, ed->pos); break;
+        case 'd': delete_range(ed, ed->pos, next_word(ed, ed->pos), 1); break;
+        case KEY_BACKSPACE: delete_range(ed, prev_word(ed, ed->pos), ed->pos, 1); break;
+    }
+}
+
+/**
+ * @brief The prompt and read, without editing, when there is no terminal
+ */
+static char *read_plain_line(const char *prompt_text, char *line, size_t line_length){
+    printf("%s", prompt_text);
+    fflush(stdout);
+    return fgets(line, line_length, stdin);
+}
+
+
+/* SHELL EXTENSION FUNCTIONS */
+
+char *read_edited_line(const char *prompt_text, char *line, size_t line_length){
+    fflush(stdout);
+    const char *term = getenv("TERM");
+    struct termios saved;
+    if (!isatty(STDIN_FILENO) || !isatty(STDOUT_FILENO) ||
+        (term != NULL && strcmp(term, "dumb") == 0) ||
+        tcgetattr(STDIN_FILENO, &saved) < 0){
+        return read_plain_line(prompt_text, line, line_length);
+    }
+
+    // no echo, no line buffering, and ^C ^Z ^S come to us as keys. Output
+    // processing stays on for whatever else writes to the terminal. CR still
+    // becomes NL as it arrives, so typeahead left in the terminal after the
+    // line is made of lines the next command can read.
+    struct termios raw = saved;
+    raw.c_iflag &= ~(BRKINT | INPCK | ISTRIP | IXON);
+    raw.c_cflag |= CS8;
+    raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    if (tcsetattr(STDIN_FILENO, TCSADRAIN, &raw) < 0){
+        return read_plain_line(prompt_text, line, line_length);
+    }
+
+    LineEditor ed = {0};
+    ed.buf = line;
+    ed.max = line_length - 1;
+    ed.browsing = history_len;
+    ed.shown = malloc(line_length);
+    char *result = line;
+    if (ed.shown == NULL || start_row(&ed, prompt_text, "") < 0){
+        result = (char *) -1;
+    }
+
+    while (result == line){
+        int c = next_byte(-1);
+        uint8_t done = 0;
+        switch (c){
+            case END_OF_INPUT:
+                result = NULL;
+                continue;
+            case '\r':
+            case '\n':
+                done = 1;
+                break;
+            case KEY_CTRL('d'):
+                if (ed.len == 0){
+                    result = NULL;
+                    continue;
+                }
+                delete_range(&ed, ed.pos, next_char(&ed, ed.pos), 0);
+                break;
+            case KEY_CTRL('c'):
+                ed.len = ed.pos = 0;
+                ed.browsing = history_len;
+                start_row(&ed, prompt_text, "^C\r\n");
+                break;
+            case KEY_CTRL('l'):
+                start_row(&ed, prompt_text, "\x1b[H\x1b[2J");
+                break;
+            case KEY_CTRL('a'): ed.pos = 0; break;
+            case KEY_CTRL('e'): ed.pos = ed.len; break;
+            case KEY_CTRL('b'): ed.pos = prev_char(&ed, ed.pos); break;
+            case KEY_CTRL('f'): ed.pos = next_char(&ed, ed.pos); break;
+            case KEY_CTRL('p'): browse_history(&ed, -1); break;
+            case KEY_CTRL('n'): browse_history(&ed, 1); break;
+            case KEY_CTRL('h'):
+            case KEY_BACKSPACE:
+                delete_range(&ed, prev_char(&ed, ed.pos), ed.pos, 0);
+                break;
+            case KEY_CTRL('k'): delete_range(&ed, ed.pos, ed.len, 1); break;
+            case KEY_CTRL('u'): delete_range(&ed, 0, ed.pos, 1); break;
+            case KEY_CTRL('w'): delete_range(&ed, prev_word(&ed, ed.pos), ed.pos, 1); break;
+            case KEY_CTRL('y'):
+                if (kill_buf != NULL) insert_text(&ed, kill_buf, strlen(kill_buf));
+                break;
+            case KEY_CTRL('t'):
+                // swaps the two characters before the cursor (single bytes)
+                if (ed.pos > 0 && ed.len > 1){
+                    size_t at = ed.pos == ed.len ? ed.pos - 1 : ed.pos;
+                    char swap = ed.buf[at];
+                    ed.buf[at] = ed.buf[at - 1];
+                    ed.buf[at - 1] = swap;
+                    ed.pos = at + 1;
+                }
+                break;
+            case KEY_ESCAPE:
+                handle_escape(&ed);
+                break;
+            default:
+                if (c >= 0x20){
+                    char byte = c;
+                    insert_text(&ed, &byte, 1);
+                }
+                break;
+        }
+
+        if (done){
+            ed.pos = ed.len;
+            ed.buf[ed.len] = '\0';
+            add_history(ed.buf);
+            refresh(&ed, "\r\n");
+            break;
+        }
+        // redraw once whatever has already arrived is applied
+        if (!input_ready(0) && refresh(&ed, NULL) < 0){
+            result = (char *) -1;
+        }
+    }
+
+    tcsetattr(STDIN_FILENO, TCSADRAIN, &saved);
+    free(ed.shown);
+    free(ed.saved);
+    if (result == line){
+        line[ed.len] = '\0';
+    }
+    return result;
+}
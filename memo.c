@@ -0,0 +1,358 @@
+/*****************************************************************************/
+/*                           CSC209-24s A3 CSCSHELL                          */
+/*       Copyright 2024 -- Demetres Kostas PhD (aka Darlene Heliokinde)      */
+/*****************************************************************************/
+
+#include "cscshell.h"
+#include <sys/mman.h>
+
+
+/*
+** The memo store is two directories: keys/ maps the hash of everything a
+** command depends on to its exit code and the hash of its output, and
+** objects/ holds each distinct output once, named by its own hash.
+** Entries are written to a temporary file and renamed into place, so a
+** reader never sees half of one.
+*/
+typedef unsigned __int128 MemoHash;
+
+#define FNV128_OFFSET (((MemoHash) 0x6c62272e07bb0142ULL << 64) | 0x62b821756295c58dULL)
+#define FNV128_PRIME (((MemoHash) 0x0000000001000000ULL << 64) | 0x000000000000013bULL)
+#define MEMO_HEX_LEN 32
+
+
+/* HELPERS */
+
+/**
+ * @brief FNV-1a, 128 bits wide, over n more bytes
+ */
+static void hash_bytes(MemoHash *hash, const void *data, size_t n){
+    const uint8_t *bytes = data;
+    for (size_t i = 0; i < n; i++){
+        *hash ^= bytes[i];
+        *hash *= FNV128_PRIME;
+    }
+}
+
+/**
+ * @brief Hashes a string with its terminator, so "ab" "c" and "a" "bc"
+ * differ
+ */
+static void hash_string(MemoHash *hash, const char *str){
+    hash_bytes(hash, str, strlen(str) + 1);
+}
+
+/**
+ * @brief Hashes which file is at path and its size and mtime, or that it
+ * is missing. A file rewritten in place gets a new mtime.
+ */
+static void hash_file_state(MemoHash *hash, const char *path){
+    struct stat info;
+    hash_string(hash, path);
+    if (stat(path, &info) < 0){
+        hash_string(hash, "missing");
+        return;
+    }
+    hash_bytes(hash, &info.st_dev, sizeof(info.st_dev));
+    hash_bytes(hash, &info.st_ino, sizeof(info.st_ino));
+    hash_bytes(hash, &info.st_size, sizeof(info.st_size));
+    hash_bytes(hash, &info.st_mtim, sizeof(info.st_mtim));
+}
+
+static void hash_to_hex(MemoHash hash, char hex[MEMO_HEX_LEN + 1]){
+    snprintf(hex, MEMO_HEX_LEN + 1, "%016llx%016llx",
+             (unsigned long long) (hash >> 64), (unsigned long long) hash);
+}
+
+/**
+ * @brief Hashes everything the command at args[first] may depend on: the
+ * program, its args, the cwd, the environment and its inputs.
+ *
+ * @return int: 1 if the command can be memoized, 0 if its stdin is
+ * something (a pipe, a socket) that can't be hashed without reading it
+ */
+static int hash_command(MemoHash *key, Command *command, int first,
+                        const char *exec_path){
+    hash_string(key, exec_path);
+    if (strchr(exec_path, '/') != NULL){
+        hash_file_state(key, exec_path); // a rebuilt program is a new one
+    }
+    for (int i = first; command->args[i] != NULL; i++){
+        hash_string(key, command->args[i]);
+    }
+
+    char cwd[MAX_PATH_STR];
+    hash_string(key, getcwd(cwd, MAX_PATH_STR) != NULL ? cwd : "");
+    for (char **var = environ; *var != NULL; var++){
+        hash_string(key, *var);
+    }
+
+    // the inputs declared with -i
+    for (int i = 1; i < first; i++){
+        if (strcmp(command->args[i], "-i") == 0){
+            hash_file_state(key, command->args[++i]);
+        }
+    }
+
+    if (command->here_doc != NULL){
+        hash_string(key, command->here_doc);
+        return 1;
+    }
+    if (command->redir_in_path != NULL){
+        hash_file_state(key, command->redir_in_path);
+        return 1;
+    }
+    struct stat info;
+    if (fstat(command->stdin_fd, &info) < 0){
+        return 0;
+    }
+    if (S_ISREG(info.st_mode)){
+        off_t offset = lseek(command->stdin_fd, 0, SEEK_CUR);
+        hash_bytes(key, &info.st_dev, sizeof(info.st_dev));
+        hash_bytes(key, &info.st_ino, sizeof(info.st_ino));
+        hash_bytes(key, &info.st_size, sizeof(info.st_size));
+        hash_bytes(key, &info.st_mtim, sizeof(info.st_mtim));
+        hash_bytes(key, &offset, sizeof(offset));
+        return 1;
+    }
+    // a terminal or /dev/null isn't input anyone means to memoize
+    return S_ISCHR(info.st_mode);
+}
+
+/**
+ * @brief Makes a directory and any parents it is missing, like mkdir -p
+ *
+ * @return int: 0 on success, -1 on error
+ */
+static int make_dirs(const char *path){
+    char partial[MAX_PATH_STR];
+    snprintf(partial, MAX_PATH_STR, "%s", path);
+    for (char *slash = strchr(partial + 1, '/'); ; slash = strchr(slash + 1, '/')){
+        if (slash != NULL) *slash = '\0';
+        if (mkdir(partial, 0755) < 0 && errno != EEXIST){
+            perror(partial);
+            return -1;
+        }
+        if (slash == NULL) return 0;
+        *slash = '/';
+    }
+}
+
+/**
+ * @brief Finds (and makes) the store: $MEMO_DIR, or cscshell/memo under
+ * $XDG_CACHE_HOME or ~/.cache
+ *
+ * @param dir: filled in with the path of the store
+ * @return int: 0 on success, -1 on error
+ */
+static int memo_dir(Variable **variables, char dir[MAX_PATH_STR]){
+    Variable *configured = search_for_var(variables, MEMO_DIR_VAR);
+    const char *cache_home = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    if (configured != NULL && configured->value[0] != '\0'){
+        snprintf(dir, MAX_PATH_STR, "%s", configured->value);
+    }
+    else if (cache_home != NULL && cache_home[0] != '\0'){
+        snprintf(dir, MAX_PATH_STR, "%s/%s", cache_home, MEMO_DEFAULT_DIR);
+    }
+    else if (home != NULL){
+        snprintf(dir, MAX_PATH_STR, "%s/.cache/%s", home, MEMO_DEFAULT_DIR);
+    }
+    else {
+        return -1;
+    }
+
+    char sub[MAX_PATH_STR];
+    snprintf(sub, MAX_PATH_STR, "%s/keys", dir);
+    if (make_dirs(sub) < 0){
+        return -1;
+    }
+    snprintf(sub, MAX_PATH_STR, "%s/objects", dir);
+    return make_dirs(sub);
+}
+
+/**
+ * @brief Runs the command at args[first] with its stdout going into fd
+ *
+ * @return int: its exit code, -1 if it couldn't be started
+ */
+static int run_into(Command *command, int first, char *exec_path, int fd){
+    Command child = *command;
+    child.args = command->args + first;
+    child.exec_path = exec_path;
+    child.next = NULL;
+    child.tee_next = NULL;
+    child.more_out = NULL;
+    child.redir_in_path = NULL;
+    child.redir_out_path = NULL;
+    child.here_doc = NULL;
+
+    // run_command closes both in the parent; the originals stay ours
+    child.stdout_fd = dup(fd);
+    child.stdin_fd = command->stdin_fd == STDIN_FILENO ? STDIN_FILENO :
+                     dup(command->stdin_fd);
+    if (child.stdout_fd < 0 || child.stdin_fd < 0){
+        perror("memo");
+        if (child.stdout_fd >= 0) close(child.stdout_fd);
+        if (child.stdin_fd > STDIN_FILENO) close(child.stdin_fd);
+        return -1;
+    }
+
+    pid_t pid = run_command(&child);
+    if (pid < 0){
+        close(child.stdout_fd);
+        if (child.stdin_fd != STDIN_FILENO) close(child.stdin_fd);
+        return -1;
+    }
+    return wait_pipeline(&pid, 1);
+}
+
+/**
+ * @brief Writes everything in fd to the builtin's output, hashing it on
+ * the way if content isn't NULL
+ *
+ * @return int: 0 on success, -1 on error
+ */
+static int replay_output(int fd, BuiltinOutput *out, MemoHash *content){
+    char chunk[FD_READER_BUF];
+    if (lseek(fd, 0, SEEK_SET) < 0){
+        perror("memo");
+        return -1;
+    }
+    while (1){
+        ssize_t got = read(fd, chunk, FD_READER_BUF);
+        if (got < 0 && errno == EINTR) continue;
+        if (got < 0){
+            perror("memo");
+            return -1;
+        }
+        if (got == 0){
+            return 0;
+        }
+        if (content != NULL){
+            hash_bytes(content, chunk, got);
+        }
+        if (builtin_write(out, chunk, got) < 0){
+            return -1;
+        }
+    }
+}
+
+/**
+ * @brief Looks a key up in the store, replaying its output on a hit
+ *
+ * @return int: the stored exit code, -1 on a miss
+ */
+static int replay_entry(const char *dir, const char *key_hex, BuiltinOutput *out){
+    char path[MAX_PATH_STR];
+    snprintf(path, MAX_PATH_STR, "%s/keys/%s", dir, key_hex);
+    FILE *entry = fopen(path, "re");
+    if (entry == NULL){
+        return -1;
+    }
+    int status;
+    char object_hex[MEMO_HEX_LEN + 1];
+    int fields = fscanf(entry, "%d %32s", &status, object_hex);
+    fclose(entry);
+    if (fields != 2){
+        return -1;
+    }
+
+    snprintf(path, MAX_PATH_STR, "%s/objects/%s", dir, object_hex);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0){
+        return -1; // the object was cleaned away; run it again
+    }
+    int replayed = replay_output(fd, out, NULL);
+    close(fd);
+    return replayed < 0 ? 1 : status;
+}
+
+/**
+ * @brief Files a finished run: its output under its own hash, then the key
+ * pointing at it
+ */
+static void store_entry(const char *dir, const char *key_hex, const char *tmp_path,
+                        MemoHash content, int status){
+    char object_hex[MEMO_HEX_LEN + 1];
+    hash_to_hex(content, object_hex);
+    char path[MAX_PATH_STR];
+    snprintf(path, MAX_PATH_STR, "%s/objects/%s", dir, object_hex);
+    if (rename(tmp_path, path) < 0){
+        perror("memo");
+        unlink(tmp_path);
+        return;
+    }
+
+    char entry_tmp[MAX_PATH_STR];
+    snprintf(entry_tmp, MAX_PATH_STR, "%s/keys/.tmp-XXXXXX", dir);
+    int fd = mkostemp(entry_tmp, O_CLOEXEC);
+    if (fd < 0){
+        perror("memo");
+        return;
+    }
+    dprintf(fd, "%d %s\n", status, object_hex);
+    close(fd);
+    snprintf(path, MAX_PATH_STR, "%s/keys/%s", dir, key_hex);
+    if (rename(entry_tmp, path) < 0){
+        perror("memo");
+        unlink(entry_tmp);
+    }
+}
+
+
+/* SHELL EXTENSION FUNCTIONS */
+
+int memo_run(Command *command, int first, BuiltinOutput *out){
+    char *exec_path = resolve_executable(command->args[first], *command->variables);
+    if (exec_path == NULL){
+        ERR_PRINT(ERR_NO_EXECU, command->args[first]);
+        return EXEC_FAILED_STATUS;
+    }
+
+    MemoHash key = FNV128_OFFSET;
+    char dir[MAX_PATH_STR];
+    char key_hex[MEMO_HEX_LEN + 1];
+    uint8_t cached = hash_command(&key, command, first, exec_path) &&
+                     memo_dir(command->variables, dir) == 0;
+    hash_to_hex(key, key_hex);
+
+    int status = cached ? replay_entry(dir, key_hex, out) : -1;
+    if (status >= 0){
+        mem_free(exec_path);
+        return status;
+    }
+
+    // a miss (or something we can't memoize): run it for real, into a file
+    // that becomes the stored output
+    char tmp_path[MAX_PATH_STR];
+    int fd;
+    if (cached){
+        int n = snprintf(tmp_path, MAX_PATH_STR, "%s/objects/.tmp-XXXXXX", dir);
+        fd = n < MAX_PATH_STR ? mkostemp(tmp_path, O_CLOEXEC) : -1;
+    }
+    else {
+        fd = memfd_create(MEMO_MEMFD_NAME, MFD_CLOEXEC);
+    }
+    if (fd < 0){
+        perror("memo");
+        mem_free(exec_path);
+        return -1;
+    }
+
+    status = run_into(command, first, exec_path, fd);
+    mem_free(exec_path);
+    MemoHash content = FNV128_OFFSET;
+    if (status >= 0 && replay_output(fd, out, &content) < 0){
+        status = -1;
+    }
+    close(fd);
+
+    if (cached && status >= 0 && status != EXEC_FAILED_STATUS){
+        store_entry(dir, key_hex, tmp_path, content, status);
+    }
+    else if (cached){
+        unlink(tmp_path);
+    }
+    return status;
+}
@@ -0,0 +1,230 @@
+/*****************************************************************************/
+/*                           CSC209-24s A3 CSCSHELL                          */
+/*       Copyright 2024 -- Demetres Kostas PhD (aka Darlene Heliokinde)      */
+/*****************************************************************************/
+
+#include "cscshell.h"
+
+
+MemStats mem_stats = {0};
+
+static const char *mem_tag_names[NUM_MEM_TAGS] = {
+    "variables", "expansion", "parse", "execution"
+};
+
+/*
+** The live tracked blocks, in an open addressing table keyed by pointer.
+** Only used with --mem-stats. A slot is empty (ptr NULL), live, or a
+** tombstone (ptr set, size MEM_TOMBSTONE) left behind by a free.
+*/
+typedef struct MemBlock {
+    void *ptr;
+    size_t size;
+    int tag;
+} MemBlock;
+
+#define MEM_TOMBSTONE ((size_t) -1)
+
+static MemBlock *blocks = NULL;
+static size_t blocks_cap = 0;
+static size_t blocks_used = 0; // live blocks plus tombstones
+
+
+/* HELPERS */
+
+static size_t hash_ptr(void *ptr){
+    uintptr_t key = (uintptr_t) ptr;
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    return key;
+}
+
+/**
+ * @brief Finds the slot of a live block
+ *
+ * @return MemBlock*: the slot, NULL if ptr isn't tracked
+ */
+static MemBlock *find_block(void *ptr){
+    if (blocks_cap == 0){
+        return NULL;
+    }
+    for (size_t i = hash_ptr(ptr) & (blocks_cap - 1); blocks[i].ptr != NULL;
+         i = (i + 1) & (blocks_cap - 1)){
+        if (blocks[i].ptr == ptr && blocks[i].size != MEM_TOMBSTONE){
+            return &blocks[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Debits a block from its tag and leaves a tombstone in its slot
+ */
+static void forget_block(MemBlock *block){
+    mem_stats.total_live -= block->size;
+    mem_stats.tags[block->tag].live_bytes -= block->size;
+    mem_stats.tags[block->tag].frees++;
+    block->size = MEM_TOMBSTONE;
+}
+
+/**
+ * @brief Rebuilds the table twice as large (or as large, when it is mostly
+ * tombstones), dropping the tombstones
+ *
+ * @return int: 0 on success, -1 if there is no memory for it
+ */
+static int grow_blocks(void){
+    size_t live = 0;
+    for (size_t i = 0; i < blocks_cap; i++){
+        if (blocks[i].ptr != NULL && blocks[i].size != MEM_TOMBSTONE) live++;
+    }
+    size_t new_cap = blocks_cap == 0 ? 1024 :
+                     live * 2 < blocks_cap ? blocks_cap : blocks_cap * 2;
+    MemBlock *new_blocks = calloc(new_cap, sizeof(MemBlock));
+    if (new_blocks == NULL){
+        return -1;
+    }
+
+    MemBlock *old_blocks = blocks;
+    size_t old_cap = blocks_cap;
+    blocks = new_blocks;
+    blocks_cap = new_cap;
+    blocks_used = 0;
+    for (size_t i = 0; i < old_cap; i++){
+        if (old_blocks[i].ptr != NULL && old_blocks[i].size != MEM_TOMBSTONE){
+            size_t j = hash_ptr(old_blocks[i].ptr) & (blocks_cap - 1);
+            while (blocks[j].ptr != NULL) j = (j + 1) & (blocks_cap - 1);
+            blocks[j] = old_blocks[i];
+            blocks_used++;
+        }
+    }
+    free(old_blocks);
+    return 0;
+}
+
+/**
+ * @brief Credits a new block to tag and remembers it
+ */
+static void insert_block(void *ptr, size_t size, int tag){
+    // Something freed this address without mem_free, and malloc handed it
+    // out again: the old block is gone for sure now
+    MemBlock *stale = find_block(ptr);
+    if (stale != NULL){
+        forget_block(stale);
+    }
+
+    MemTagStats *stats = &mem_stats.tags[tag];
+    stats->allocs++;
+    stats->live_bytes += size;
+    if (stats->live_bytes > stats->peak_bytes){
+        stats->peak_bytes = stats->live_bytes;
+    }
+    mem_stats.total_live += size;
+    if (mem_stats.total_live > mem_stats.total_peak){
+        mem_stats.total_peak = mem_stats.total_live;
+    }
+
+    if ((blocks_used + 1) * 4 > blocks_cap * 3 && grow_blocks() < 0){
+        return; // it just won't be debited when freed
+    }
+    size_t i = hash_ptr(ptr) & (blocks_cap - 1);
+    while (blocks[i].ptr != NULL && blocks[i].size != MEM_TOMBSTONE){
+        i = (i + 1) & (blocks_cap - 1);
+    }
+    if (blocks[i].ptr == NULL){
+        blocks_used++;
+    }
+    blocks[i].ptr = ptr;
+    blocks[i].size = size;
+    blocks[i].tag = tag;
+}
+
+/**
+ * @brief Stops tracking ptr, if it was tracked
+ */
+static void untrack(void *ptr){
+    MemBlock *block = find_block(ptr);
+    if (block != NULL){
+        forget_block(block);
+    }
+}
+
+
+/* SHELL EXTENSION FUNCTIONS */
+
+void *mem_alloc(size_t size, int tag){
+    void *ptr = malloc(size);
+    if (ptr != NULL && mem_stats.enabled){
+        insert_block(ptr, size, tag);
+    }
+    return ptr;
+}
+
+void *mem_calloc(size_t count, size_t size, int tag){
+    void *ptr = calloc(count, size);
+    if (ptr != NULL && mem_stats.enabled){
+        insert_block(ptr, count * size, tag);
+    }
+    return ptr;
+}
+
+void *mem_realloc(void *ptr, size_t size, int tag){
+    if (!mem_stats.enabled){
+        return realloc(ptr, size);
+    }
+
+    // look the old block up first, ptr can't be used once it's moved
+    MemBlock *old = ptr != NULL ? find_block(ptr) : NULL;
+    void *grown = realloc(ptr, size);
+    if (grown != NULL){
+        if (old != NULL){
+            forget_block(old);
+        }
+        insert_block(grown, size, tag);
+    }
+    return grown;
+}
+
+char *mem_strdup(const char *str, int tag){
+    return mem_strndup(str, strlen(str), tag);
+}
+
+char *mem_strndup(const char *str, size_t n, int tag){
+    size_t length = strnlen(str, n);
+    char *copy = mem_alloc(length + 1, tag);
+    if (copy != NULL){
+        memcpy(copy, str, length);
+        copy[length] = '\0';
+    }
+    return copy;
+}
+
+void mem_free(void *ptr){
+    if (ptr != NULL && mem_stats.enabled){
+        untrack(ptr);
+    }
+    free(ptr);
+}
+
+int write_mem_stats(BuiltinOutput *out){
+    char line[MAX_USER_BUF];
+    int length = snprintf(line, MAX_USER_BUF, "%-10s %12s %12s %10s %10s\n",
+                          "tag", "live", "peak", "allocs", "frees");
+    if (builtin_write(out, line, length) < 0){
+        return -1;
+    }
+    for (int i = 0; i < NUM_MEM_TAGS; i++){
+        MemTagStats *stats = &mem_stats.tags[i];
+        length = snprintf(line, MAX_USER_BUF, "%-10s %12zu %12zu %10llu %10llu\n",
+                          mem_tag_names[i], stats->live_bytes, stats->peak_bytes,
+                          (unsigned long long) stats->allocs,
+                          (unsigned long long) stats->frees);
+        if (builtin_write(out, line, length) < 0){
+            return -1;
+        }
+    }
+    length = snprintf(line, MAX_USER_BUF, "%-10s %12zu %12zu\n", "total",
+                      mem_stats.total_live, mem_stats.total_peak);
+    return builtin_write(out, line, length);
+}
@@ -0,0 +1,533 @@
+/*****************************************************************************/
+/*                           CSC209-24s A3 CSCSHELL                          */
+/*       Copyright 2024 -- Demetres Kostas PhD (aka Darlene Heliokinde)      */
+/*****************************************************************************/
+
+#include "cscshell.h"
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+
+
+int parallel_lines = 1;
+
+/*
+** A path a line touches, made absolute against the cwd it runs in. Output
+** targets are written and input redirections only read; a plain argument
+** may be either, as far as the shell can tell.
+*/
+typedef struct LinePath {
+    char *path;
+    uint8_t access;
+    struct LinePath *next;
+} LinePath;
+
+#define PATH_READ 0
+#define PATH_WRITE 1
+#define PATH_ARG 2
+
+// How a line has to be run
+#define LINE_WORKER 0  // in a worker, once no unfinished line before it
+                       // shares a path with it
+#define LINE_ASSIGN 1  // in the shell, once every line before it started
+#define LINE_SERIAL 2  // in the shell, once every line before it is done
+#define LINE_EMPTY 3
+
+#define LINE_PENDING 0
+#define LINE_RUNNING 1
+#define LINE_DONE 2
+
+#define LINE_NO_STATUS INT_MIN
+
+/*
+** What running a line gave, as run_line returns it. Kept in memory shared
+** with the workers, which fill it in.
+*/
+typedef struct LineResult {
+    int error;
+    int status; // LINE_NO_STATUS if the line ran no command
+} LineResult;
+
+typedef struct ScriptLine {
+    char *text;
+    uint8_t analysed;
+    uint8_t kind;
+    uint8_t state;
+    LinePath *paths;
+    pid_t pid;
+    int out_fd; // a worker's stdout and stderr, written out in script order
+    int err_fd;
+} ScriptLine;
+
+
+/* HELPERS */
+
+/**
+ * @brief Reads every line (and block) of the stream up front
+ *
+ * @param num_lines: set to the number of lines read
+ * @param error: set to -1 if a block was left unfinished; the lines before
+ *               it are still returned
+ * @return ScriptLine*: the lines, NULL if there are none or on error
+ */
+static ScriptLine *read_script_lines(FILE *stream, int *num_lines, int *error){
+    ScriptLine *lines = NULL;
+    int cap = 0;
+    // as in run_stream, a line is as long as it needs to be
+    char *line = NULL;
+    size_t line_cap = 0;
+
+    *num_lines = 0;
+    while (getline(&line, &line_cap, stream) != -1){
+        // kill the newline
+        line[strcspn(line, "\n")] = '\0';
+
+        char *block = complete_block(line, stream, 0);
+        if (block == NULL){
+            *error = -1;
+            break;
+        }
+        if (*num_lines == cap){
+            cap = cap == 0 ? 64 : cap * 2;
+            ScriptLine *grown = mem_realloc(lines, sizeof(ScriptLine) * cap,
+                                            MEM_EXECUTION);
+            if (grown == NULL){
+                perror("run_stream_parallel");
+                mem_free(block);
+                *error = -1;
+                break;
+            }
+            lines = grown;
+        }
+
+        ScriptLine *curr = &lines[(*num_lines)++];
+        memset(curr, 0, sizeof(ScriptLine));
+        curr->text = block;
+        curr->out_fd = -1;
+        curr->err_fd = -1;
+    }
+    free(line);
+    return lines;
+}
+
+static void free_line_paths(LinePath *paths){
+    while (paths != NULL){
+        LinePath *next = paths->next;
+        mem_free(paths->path);
+        mem_free(paths);
+        paths = next;
+    }
+}
+
+/**
+ * @brief Adds path to a line's paths, made absolute against cwd
+ */
+static void add_line_path(ScriptLine *line, const char *cwd, const char *path,
+                          uint8_t access){
+    while (strncmp(path, "./", 2) == 0){
+        path += 2;
+    }
+    LinePath *entry = mem_alloc(sizeof(LinePath), MEM_EXECUTION);
+    if (entry == NULL){
+        return;
+    }
+    if (path[0] == '/' || cwd == NULL){
+        entry->path = mem_strdup(path, MEM_EXECUTION);
+    }
+    else if ((entry->path = mem_alloc(strlen(cwd) + strlen(path) + 2,
+                                      MEM_EXECUTION)) != NULL){
+        sprintf(entry->path, "%s/%s", cwd, path);
+    }
+    if (entry->path == NULL){
+        mem_free(entry);
+        return;
+    }
+    entry->access = access;
+    entry->next = line->paths;
+    line->paths = entry;
+}
+
+/**
+ * @brief Checks if an argument could be a file. Options and numbers
+ * (sleep 1, head -n 5) are taken not to be.
+ */
+static uint8_t may_be_path(const char *arg){
+    if (arg[0] == '-' || arg[0] == '\0'){
+        return 0;
+    }
+    char *end;
+    strtod(arg, &end);
+    return *end != '\0';
+}
+
+/**
+ * @brief parse_line, with whatever it reports on stderr thrown away
+ */
+static Command *parse_quietly(char *text, Variable **root){
+    fflush(stderr);
+    int saved_err = dup(STDERR_FILENO);
+    int null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    if (saved_err >= 0 && null_fd >= 0){
+        dup2(null_fd, STDERR_FILENO);
+    }
+    Command *commands = parse_line(text, root);
+    if (saved_err >= 0){
+        dup2(saved_err, STDERR_FILENO);
+        close(saved_err);
+    }
+    if (null_fd >= 0){
+        close(null_fd);
+    }
+    return commands;
+}
+
+/**
+ * @brief Works out how a line has to be run and, for lines that can go to
+ * a worker, which paths it touches. Parse errors are kept quiet here: the
+ * line then runs in the shell, which reports them in order. The parse is
+ * left in the parse cache, so the run_line that runs the line reuses it.
+ */
+static void analyse_line(ScriptLine *line, Variable **root){
+    line->analysed = 1;
+    const char *text = line->text;
+    size_t length = strcspn(text, "\n");
+    const char *comment = find_comment(text);
+    if (comment != NULL && comment < text + length){
+        length = comment - text;
+    }
+
+    if (is_compound_line(text) || has_substitution(text, length) ||
+        strcspn(text, GLOB_CHARS) < length){
+        line->kind = LINE_SERIAL;
+        return;
+    }
+    if (is_assignment(text)){
+        line->kind = LINE_ASSIGN;
+        return;
+    }
+
+    // a repeated line is already parsed
+    ParseCacheEntry *cached = parse_cache_lookup(line->text);
+    Command *commands;
+    if (cached != NULL){
+        commands = cached->commands;
+    }
+    else {
+        parse_volatile = 0;
+        commands = parse_quietly(line->text, root);
+        if (commands == (Command *) -1){
+            line->kind = LINE_SERIAL;
+            return;
+        }
+        if (commands == NULL){
+            line->kind = LINE_EMPTY;
+            return;
+        }
+        if (!parse_volatile){
+            cached = parse_cache_store(line->text, commands);
+        }
+    }
+
+    char cwd[MAX_PATH_STR];
+    char *cwd_path = getcwd(cwd, MAX_PATH_STR);
+    line->kind = LINE_WORKER;
+    for (Command *pipeline = commands; pipeline != NULL; pipeline = pipeline->tee_next){
+        for (Command *curr = pipeline; curr != NULL; curr = curr->next){
+            const Builtin *builtin = find_builtin(curr->args[0]);
+            if (find_function(curr->args[0]) != NULL ||
+                (builtin != NULL && builtin->shell_state)){
+                line->kind = LINE_SERIAL;
+            }
+            for (int i = 1; curr->args[i] != NULL; i++){
+                if (may_be_path(curr->args[i])){
+                    add_line_path(line, cwd_path, curr->args[i], PATH_ARG);
+                }
+            }
+            if (curr->redir_in_path != NULL){
+                add_line_path(line, cwd_path, curr->redir_in_path, PATH_READ);
+            }
+            if (curr->redir_out_path != NULL){
+                add_line_path(line, cwd_path, curr->redir_out_path, PATH_WRITE);
+            }
+            for (OutTarget *out = curr->more_out; out != NULL; out = out->next){
+                add_line_path(line, cwd_path, out->path, PATH_WRITE);
+            }
+        }
+    }
+    if (cached != NULL){
+        parse_cache_release(cached);
+    }
+    else {
+        free_command(commands);
+    }
+}
+
+/**
+ * @brief Checks if two paths are the same file, or one is inside the other
+ */
+static uint8_t paths_overlap(const char *a, const char *b){
+    size_t a_length = strlen(a);
+    size_t b_length = strlen(b);
+    if (a_length > b_length){
+        const char *swap = a;
+        a = b;
+        b = swap;
+        a_length = b_length;
+    }
+    return strncmp(a, b, a_length) == 0 && (b[a_length] == '\0' || b[a_length] == '/');
+}
+
+/**
+ * @brief Checks if line i has to wait for an unfinished line before it:
+ * they share a path, and at least one of them may write it.
+ */
+static uint8_t depends_on_earlier(ScriptLine *lines, int first, int i){
+    for (int j = first; j < i; j++){
+        if (lines[j].state == LINE_DONE){
+            continue;
+        }
+        for (LinePath *a = lines[j].paths; a != NULL; a = a->next){
+            for (LinePath *b = lines[i].paths; b != NULL; b = b->next){
+                if ((a->access != PATH_READ || b->access != PATH_READ) &&
+                    paths_overlap(a->path, b->path)){
+                    return 1;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Runs a line in the shell itself, as run_stream would
+ */
+static void run_in_shell(ScriptLine *line, LineResult *result, Variable **root){
+    int status = LINE_NO_STATUS;
+    result->error = run_line(line->text, root, &status);
+    result->status = status;
+    line->state = LINE_DONE;
+}
+
+/**
+ * @brief Forks a worker that runs the line with its output going into
+ * memory files, to be written out once every line before it has been.
+ *
+ * @return int: 0 on success, -1 on error
+ */
+static int start_line(ScriptLine *line, LineResult *result, Variable **root){
+    line->out_fd = memfd_create(LINE_OUTPUT_MEMFD_NAME, MFD_CLOEXEC);
+    line->err_fd = memfd_create(LINE_OUTPUT_MEMFD_NAME, MFD_CLOEXEC);
+    if (line->out_fd < 0 || line->err_fd < 0){
+        perror("run_stream_parallel");
+        return -1;
+    }
+
+    // a worker that dies without saying how the line went failed
+    result->error = -1;
+    result->status = LINE_NO_STATUS;
+
+    // nothing buffered may be written twice, nor read ahead of the child
+    fflush(NULL);
+    sync_fd_readers();
+    pid_t pid = fork();
+    if (pid == 0){
+        dup2(line->out_fd, STDOUT_FILENO);
+        dup2(line->err_fd, STDERR_FILENO);
+        int status = LINE_NO_STATUS;
+        int error = run_line(line->text, root, &status);
+        fflush(stdout);
+        result->status = status;
+        result->error = error;
+        _exit(0);
+    }
+    if (pid < 0){
+        perror("fork");
+        return -1;
+    }
+    line->pid = pid;
+    line->state = LINE_RUNNING;
+    return 0;
+}
+
+/**
+ * @brief Copies everything written into a memory file to fd
+ */
+static void write_line_output(int from, int to){
+    off_t size = lseek(from, 0, SEEK_END);
+    off_t offset = 0;
+    while (offset < size){
+        ssize_t sent = sendfile(to, from, &offset, size - offset);
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent < 0 && (errno == EINVAL || errno == ENOSYS)){
+            break; // to can't take sendfile (an O_APPEND file, say)
+        }
+        if (sent <= 0){
+            return; // the reader is gone
+        }
+    }
+
+    char chunk[CAPTURE_READ_CHUNK];
+    while (offset < size){
+        ssize_t got = pread(from, chunk, CAPTURE_READ_CHUNK, offset);
+        if (got <= 0 || write(to, chunk, got) != got){
+            return;
+        }
+        offset += got;
+    }
+}
+
+/**
+ * @brief Reaps one worker and marks its line done
+ *
+ * @return int: 0 on success, -1 if there was none to reap
+ */
+static int reap_line(ScriptLine *lines, int first, int num_lines){
+    while (1){
+        pid_t pid = waitpid(-1, NULL, 0);
+        if (pid < 0 && errno == EINTR) continue;
+        if (pid < 0){
+            perror("waitpid");
+            return -1;
+        }
+        for (int i = first; i < num_lines; i++){
+            if (lines[i].state == LINE_RUNNING && lines[i].pid == pid){
+                lines[i].state = LINE_DONE;
+                return 0;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Writes out a finished line's output and takes in its result
+ *
+ * @return int: the line's error, as run_line returns it
+ */
+static int finish_line(ScriptLine *line, LineResult *result, int *last_status){
+    if (line->out_fd >= 0){
+        fflush(stdout);
+        write_line_output(line->out_fd, STDOUT_FILENO);
+        write_line_output(line->err_fd, STDERR_FILENO);
+        close(line->out_fd);
+        close(line->err_fd);
+        line->out_fd = line->err_fd = -1;
+    }
+    if (result->status != LINE_NO_STATUS){
+        *last_status = result->status;
+    }
+    return result->error;
+}
+
+
+/* SHELL EXTENSION FUNCTIONS */
+
+int run_stream_parallel(FILE *stream, Variable **root, int *last_status){
+    int error = 0;
+    int num_lines;
+    ScriptLine *lines = read_script_lines(stream, &num_lines, &error);
+    if (num_lines == 0){
+        mem_free(lines);
+        return error;
+    }
+
+    LineResult *results = mmap(NULL, sizeof(LineResult) * num_lines,
+                               PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (results == MAP_FAILED){
+        perror("run_stream_parallel");
+        results = NULL;
+        error = -2;
+    }
+
+    int flushed = 0;     // lines before this one are done and written out
+    int running = 0;
+    uint8_t stopping = results == NULL;
+    while (flushed < num_lines && !(stopping && running == 0)){
+        uint8_t progressed = 0;
+
+        // start whatever may start, in script order
+        uint8_t all_started = 1;
+        for (int i = flushed; i < num_lines && !stopping; i++){
+            ScriptLine *line = &lines[i];
+            if (line->state != LINE_PENDING){
+                continue;
+            }
+            if (!line->analysed){
+                analyse_line(line, root);
+            }
+
+            if (line->kind == LINE_EMPTY){
+                results[i].error = 0;
+                results[i].status = LINE_NO_STATUS;
+                line->state = LINE_DONE;
+                progressed = 1;
+                continue;
+            }
+            // nothing after these may be looked at before they have run
+            if (line->kind == LINE_SERIAL || (line->kind == LINE_ASSIGN && !all_started)){
+                break;
+            }
+            if (line->kind == LINE_ASSIGN){
+                run_in_shell(line, &results[i], root);
+                progressed = 1;
+                continue;
+            }
+
+            if (running == parallel_lines){
+                break;
+            }
+            if (depends_on_earlier(lines, flushed, i)){
+                all_started = 0;
+                continue;
+            }
+            if (start_line(line, &results[i], root) < 0){
+                results[i].error = -2;
+                line->state = LINE_DONE;
+                break;
+            }
+            running++;
+            progressed = 1;
+        }
+
+        // write out everything that's done, in script order
+        while (flushed < num_lines && !stopping){
+            ScriptLine *line = &lines[flushed];
+            if (line->state == LINE_PENDING && line->analysed &&
+                line->kind == LINE_SERIAL){
+                run_in_shell(line, &results[flushed], root);
+            }
+            if (line->state != LINE_DONE){
+                break;
+            }
+
+            int line_error = finish_line(line, &results[flushed], last_status);
+            if (line_error == -2){
+                error = -2;
+                stopping = 1;
+            }
+            else if (line_error < 0){
+                error = -1;
+            }
+            flushed++;
+            progressed = 1;
+        }
+
+        if (!progressed || (stopping && running > 0)){
+            if (running == 0 || reap_line(lines, flushed, num_lines) < 0){
+                break;
+            }
+            running--;
+        }
+    }
+
+    for (int i = 0; i < num_lines; i++){
+        if (lines[i].out_fd >= 0) close(lines[i].out_fd);
+        if (lines[i].err_fd >= 0) close(lines[i].err_fd);
+        free_line_paths(lines[i].paths);
+        mem_free(lines[i].text);
+    }
+    mem_free(lines);
+    if (results != NULL){
+        munmap(results, sizeof(LineResult) * num_lines);
+    }
+    return error;
+}
@@ -28,11 +28,86 @@ typedef struct Node {
         Node *next;
         while (curr != NULL){
             next = curr->next;
-            free(curr);
+            mem_free(curr);
             curr = next;
         }
     }
 
+/**
+ * @brief Finds the earliest location on a list that was built newest first
+ */
+static int first_location(Node *locations){
+    while (locations->next != NULL){
+        locations = locations->next;
+    }
+    return locations->data;
+}
+
+/**
+ * @brief Sets up an empty, null terminated expansion buffer
+ * 
+ * @param buf: the buffer
+ * @param cap: the initial capacity, at least 1
+ * @return int: 0 on success, -1 on failure
+ */
+int expand_buffer_init(ExpandBuffer *buf, size_t cap){
+    buf->data = mem_alloc(cap, MEM_EXPANSION);
+    if (buf->data == NULL){
+        perror("expand_buffer_init");
+        return -1;
+    }
+    buf->data[0] = '\0';
+    buf->len = 0;
+    buf->cap = cap;
+    return 0;
+}
+
+/**
+ * @brief Makes sure there is room for n more bytes (plus the terminator),
+ * doubling the buffer as needed. The buffer is freed if it cannot grow.
+ * 
+ * @param buf: the buffer
+ * @param n: the number of bytes that will be added
+ * @return int: 0 on success, -1 on failure
+ */
+int expand_buffer_reserve(ExpandBuffer *buf, size_t n){
+    if (buf->len + n + 1 <= buf->cap){
+        return 0;
+    }
+    size_t new_cap = buf->cap * 2;
+    while (buf->len + n + 1 > new_cap){
+        new_cap *= 2;
+    }
+    char *grown = mem_realloc(buf->data, new_cap, MEM_EXPANSION);
+    if (grown == NULL){
+        perror("expand_buffer_reserve");
+        mem_free(buf->data);
+        buf->data = NULL;
+        return -1;
+    }
+    buf->data = grown;
+    buf->cap = new_cap;
+    return 0;
+}
+
+/**
+ * @brief Appends n bytes of src to the buffer
+ * 
+ * @param buf: the buffer
+ * @param src: the bytes to append
+ * @param n: the number of bytes
+ * @return int: 0 on success, -1 on failure
+ */
+int expand_buffer_append(ExpandBuffer *buf, const char *src, size_t n){
+    if (expand_buffer_reserve(buf, n) < 0){
+        return -1;
+    }
+    memcpy(buf->data + buf->len, src, n);
+    buf->len += n;
+    buf->data[buf->len] = '\0';
+    return 0;
+}
+
 /**
  * @brief: Finds the variable in the linked list with the given variable name
  * 
@@ -55,6 +130,53 @@ Variable *search_for_var(Variable **variables, char *var_name){
     return requested_var;
 }
 
+/**
+ * @brief Sets the variable var_name to a copy of value, creating it if needed.
+ * PATH is always kept at the head of the list.
+ * 
+ * @param variables: pointer to the head of the linked list
+ * @param var_name: the name of the variable
+ * @param value: the new value
+ * @return int: returns 0 on success, -1 on failure
+ */
+int set_variable(Variable **variables, const char *var_name, const char *value){
+    variable_generation++;
+    Variable *search = search_for_var(variables, (char *) var_name);
+    char *new_value = mem_strdup(value, MEM_VARIABLES);
+    if (new_value == NULL){
+        perror("set_variable");
+        return -1;
+    }
+    if (search != NULL){ // Var already exists
+        mem_free(search->value);
+        search->value = new_value;
+        return 0;
+    }
+
+    Variable *new_var = mem_alloc(sizeof(Variable), MEM_VARIABLES);
+    if (new_var == NULL){
+        perror("set_variable");
+        mem_free(new_value);
+        return -1;
+    }
+    new_var->name = mem_strdup(var_name, MEM_VARIABLES);
+    new_var->value = new_value;
+    new_var->next = NULL;
+
+    if (*variables == NULL){
+        *variables = new_var;
+    }
+    else if (strcmp(var_name, PATH_VAR_NAME) == 0){
+        new_var->next = *variables;
+        *variables = new_var;
+    }
+    else { // Just append as 2nd element so you never accidentally replace the head.
+        new_var->next = (*variables)->next;
+        (*variables)->next = new_var;
+    }
+    return 0;
+}
+
 /**
  * @brief This function is used to help with parse_line, where we have found the location
  * of an equals sign, and want to load the variable into our variables linked list. Also
@@ -68,9 +190,7 @@ Variable *search_for_var(Variable **variables, char *var_name){
 int retrieve_variable(char *line, Variable **variables, int i){
     // Error checking, check that there is no space on either side of the equals sign
     if (i == 0 || line[i - 1] == ' ' || line[i - 1] == '\t'){
-        #ifdef DEBUG
-            ERR_PRINT(ERR_VAR_START);
-        #endif
+        TRACE_NOTE("parse_error", "assignment starts with '='");
         return -1;
     }
 
@@ -78,62 +198,28 @@ int retrieve_variable(char *line, Variable **variables, int i){
     int final_char_index = 0;
     for (int j = i - 1; j >= 0; j--){
         if (line[j] == ' ' || line[j] == '\t'){
-            final_char_index = j;
+            final_char_index = j + 1;
             break;
         }
         else if (!isalpha(line[j]) && line[j] != '_'){
-            #ifdef DEBUG
-                ERR_PRINT(ERR_VAR_NAME, &(line[j]));
-            #endif
+            TRACE_NOTE("parse_error", &(line[j]));
             return -1;
         }
     }
 
     // Load variable name
-    // TODO: malloc check
     int length = i - final_char_index;
-    char * var_name = malloc(sizeof(char) * (length + 1));
+    char var_name[length + 1];
     strncpy(var_name, line + final_char_index, length);
     var_name[length] = '\0';
 
-    // Load value until null terminator
-    int value_length = strlen(line + i); // Note: this should work b/c we include 1 extra for \0
-    // TODO: malloc check
-    char * var_value = malloc(sizeof(char) * (value_length));
-    var_value = strncpy(var_value, line + i + 1, value_length);
-    var_value[value_length] = '\0';
-
-    // Build variable struct
-    // TODO: malloc check
-    Variable *new_var = malloc(sizeof(Variable));
-    new_var->name = var_name;
-    new_var->value = var_value;
-    new_var->next = NULL;
-
-    // Add to variables list
-    Variable *search = search_for_var(variables, var_name); 
-    if (search != NULL){ // Var already exists
-        free(search->value);
-        search->value = var_value;
-    }
-    else{ //insert new variable
-        if (variables == NULL){
-            variables = &new_var;
-            new_var->next = NULL;
-        }
-        else if (strcmp(var_name, "PATH") == 0){
-            Variable * old_head = *variables;
-            *variables = new_var;
-            new_var->next = old_head;
-        }
-        else { // Just append as 2nd element so you never accidentally replace the head.
-            Variable *old_2nd = (*variables)->next;
-            (*variables)->next = new_var;
-            new_var->next = old_2nd;
-        }
+    // Value runs until the null terminator
+    char *var_value = line + i + 1;
+    if (set_variable(variables, var_name, var_value) < 0){
+        return -1;
     }
 
-    if (strlen(var_value) == 0){
+    if (strlen(line + i + 1) == 0){
         return -1;
     }
     return 0;
@@ -148,42 +234,64 @@ void make_command_default_null(Command *commands){
     commands->stdin_fd = 0;
     commands->redir_in_path = NULL;
     commands->stdout_fd = 0;
+    commands->here_doc = NULL;
+    commands->variables = NULL;
+    commands->more_out = NULL;
+    commands->tee_next = NULL;
 }
 
-void debug_parse_commands(Command *commands){
-    if (commands == NULL){
-        return;
+/**
+ * @brief Adds an output target to a command. The first one is its
+ * redir_out_path, any more go on its more_out list, in order.
+ * 
+ * @return int: 0 on success, -1 on failure
+ */
+static int add_out_target(Command *command, char *path, uint8_t append){
+    if (command->redir_out_path == NULL){
+        command->redir_out_path = path;
+        command->redir_append = append;
+        return 0;
     }
-    else if (commands->next == NULL){
 
-        printf("exec: %s\n",commands->exec_path);
-        int i = 0;
-        while(commands->args !=NULL && (commands->args)[i] != NULL){
-            printf("%d\n", i);
-            printf("%s\n", (commands->args)[i]);
-            i++;
-        }
+    OutTarget *target = mem_alloc(sizeof(OutTarget), MEM_PARSE);
+    if (target == NULL){
+        return -1;
+    }
+    target->path = path;
+    target->append = append;
+    target->next = NULL;
 
-        printf("redir_app: %d\n", commands->redir_append);
-        printf("redir_app: %d\n", commands->redir_append);
-        printf("out redir: %s\n",commands->redir_out_path);
-        printf("in redir: %s\n",commands->redir_in_path);
+    OutTarget **tail = &command->more_out;
+    while (*tail != NULL){
+        tail = &(*tail)->next;
     }
-    else{
-        debug_parse_commands(commands->next);
-        printf("exec: %s\n",commands->exec_path);
-        int i = 0;
-        while(commands->args !=NULL && (commands->args)[i] != NULL){
-            printf("%d\n", i);
-            printf("%s\n", (commands->args)[i]);
-            i++;
-        }
+    *tail = target;
+    return 0;
+}
 
-        printf("redir_app: %d\n", commands->redir_append);
-        printf("redir_app: %d\n", commands->redir_append);
-        printf("out redir: %s\n",commands->redir_out_path);
-        printf("in redir: %s\n",commands->redir_in_path);
+/**
+ * @brief Takes the next here-document body, which runs until a line that
+ * is exactly the delimiter.
+ * 
+ * @param bodies: the remaining body text, advanced past the delimiter line
+ * @param delim: the delimiter word
+ * @return char*: a heap copy of the body, NULL if it is not terminated
+ */
+static char *take_here_doc(char **bodies, const char *delim){
+    size_t delim_length = strlen(delim);
+    char *start = *bodies;
+    char *line = start;
+
+    while (line != NULL){
+        char *end = strchr(line, '\n');
+        size_t length = end != NULL ? (size_t) (end - line) : strlen(line);
+        if (length == delim_length && strncmp(line, delim, length) == 0){
+            *bodies = end != NULL ? end + 1 : NULL;
+            return mem_strndup(start, line - start, MEM_PARSE);
+        }
+        line = end != NULL ? end + 1 : NULL;
     }
+    return NULL;
 }
 
 /**
@@ -191,29 +299,61 @@ void debug_parse_commands(Command *commands){
  * 
  * @param section: the section of the line we're working with  
  * @param commands: the command object we're loading into
+ * @param defer_vars: leave executables that use variables unresolved
+ * @param bodies: the here-document bodies following the line, advanced past
+ *                any that this command uses
+ * @param scan: the scan of the whole line
+ * @param offset: where section starts in the line
  * @return int: returns 0 on success, -1 on failure
  */
-int load_single_command(char *section, Command *command, Variable **variables){
+int load_single_command(char *section, Command *command, Variable **variables,
+                        uint8_t defer_vars, char **bodies, const LineScan *scan,
+                        size_t offset){
     int num_args = 0;
     char **args = NULL;
     char *curr_arg = NULL;
     char *out_redir = NULL;
     char *in_redir = NULL;
-    int mode = 0; // mode 0 = load into args, mode 1 = load into in_redir, mode 2 = load into out
-
-    for (int i = 0; i < strlen(section); i++){
-        if (section[i] == '<'){
+    char *here_word = NULL;
+    uint8_t out_append = 0;
+    uint8_t missing_word = 0; // a redirection hasn't been given its word yet
+    // mode 0 = load into args, mode 1 = load into in_redir, mode 2 = load into out,
+    // mode 3 = load a here-string, mode 4 = load a here-document delimiter
+    int mode = 0;
+    size_t length = strlen(section);
+
+    for (size_t i = 0; i < length; i++){
+        if (section[i] == '<' && section[i + 1] == '<'){
+            num_args = 0;
+            curr_arg = NULL;
+            missing_word = 1;
+            mode = 4;
+            i++;
+            if (section[i + 1] == '<'){
+                mode = 3;
+                i++;
+            }
+        }
+        else if (section[i] == '<'){
             num_args = 0; 
+            curr_arg = NULL;
+            missing_word = 1;
             mode = 1;
-            in_redir = malloc(sizeof(char));
         }
         else if (section[i] == '>'){
+            // cmd >a >b: the output goes to every one of them
+            if (out_redir != NULL && add_out_target(command, out_redir, out_append) < 0){
+                return -1;
+            }
             num_args = 0; 
+            curr_arg = NULL;
+            out_redir = NULL;
+            out_append = 0;
+            missing_word = 1;
             mode = 2;
-            out_redir = malloc(sizeof(char));
-            if (i < strlen(section) - 1 && section[i + 1] == '>'){
+            if (i < length - 1 && section[i + 1] == '>'){
                 i++;
-                command->redir_append = 1;
+                out_append = 1;
             }
         }
 
@@ -221,10 +361,10 @@ int load_single_command(char *section, Command *command, Variable **variables){
             curr_arg = NULL;
             
             // Skip all whitespaces
-            while(i < strlen(section) - 1 && (section[i + 1] == ' ' || section[i + 1] == '\t')){
+            while(i < length - 1 && (section[i + 1] == ' ' || section[i + 1] == '\t')){
                 i++;
             }
-            if (strlen(section) - 1 == i){
+            if (length - 1 == i){
                 break;
             }
             // If we make it here, we've found a non-space character, prep to add a new argument
@@ -234,14 +374,14 @@ int load_single_command(char *section, Command *command, Variable **variables){
             
             // First we need to check if we're in a compatible mode for loading in another argument
             // We've loaded no arguments, and we're not loading redirections
-            if (args == NULL && mode != 1 && mode != 2){
+            if (args == NULL && mode == 0){
                 //todo malloc check
-                args = malloc(sizeof(char *) * 2);
+                args = mem_alloc(sizeof(char *) * 2, MEM_PARSE);
                 args[1] = NULL;
             }
             // We've loaded arguments, so need to make space for 1 more (and we're not loading redirections)
-            else if (mode != 1 && mode != 2){
-                args = realloc(args, sizeof(char *) * (num_args + 1));
+            else if (mode == 0){
+                args = mem_realloc(args, sizeof(char *) * (num_args + 1), MEM_PARSE);
                 args[num_args] = NULL;
             }
             // We're in the mode of loading redirections, but more than 1 argument appears
@@ -251,30 +391,28 @@ int load_single_command(char *section, Command *command, Variable **variables){
             // }
         }
 
-        else { // We have found nothing interesting and should just load what we found into the current arg
+        else { // We have found a word, and load all of it into the current arg at once
 
             if (args == NULL){
                 //todo malloc check
-                args = malloc(sizeof(char *) * 2);
+                args = mem_alloc(sizeof(char *) * 2, MEM_PARSE);
                 args[1] = NULL;
             }
-            else if (mode != 1 && mode != 2){
-                args = realloc(args, sizeof(char *) * (num_args + 1));
+            else if (mode == 0){
+                args = mem_realloc(args, sizeof(char *) * (num_args + 1), MEM_PARSE);
                 args[num_args] = NULL;
             }
 
-            if (curr_arg == NULL){
-                curr_arg = malloc(sizeof(char)*2);
-                curr_arg[0] = section[i];
-                curr_arg[1] = '\0';
-            }
-
-            else{ // make sure args is null terminated
-                int curr_length = strlen(curr_arg);
-                curr_arg = realloc(curr_arg, curr_length + 2);
-                curr_arg[curr_length] = section[i];
-                curr_arg[curr_length + 1] = '\0';
+            // it runs up to the next blank or redirection, and only
+            // metacharacters can be either
+            size_t end = i + 1;
+            while ((end = scan_next(scan->meta, offset + length, offset + end) - offset) < length &&
+                   strchr(WORD_BREAK_CHARS, section[end]) == NULL){
+                end++;
             }
+            // every other branch leaves curr_arg NULL, so this is a new one
+            curr_arg = mem_strndup(section + i, end - i, MEM_PARSE);
+            i = end - 1;
             
             if(mode == 0 && num_args == 0){
                 num_args += 1;
@@ -286,33 +424,79 @@ int load_single_command(char *section, Command *command, Variable **variables){
 
             else if (mode == 1){
                 if (num_args > 1){
-                    #ifdef DEBUG
-                        ERR_PRINT("More than 1 arg for input redirection.\n");
-                    #endif
+                    TRACE_NOTE("parse_error", "more than 1 arg for input redirection");
                     return -1;
                 }
                 in_redir = curr_arg;
+                missing_word = 0;
             }
 
             else if (mode == 2){
                 if (num_args > 1){
-                    #ifdef DEBUG
-                        ERR_PRINT("More than 1 arg for output redirection.\n");
-                    #endif
+                    TRACE_NOTE("parse_error", "more than 1 arg for output redirection");
                     return -1;
                 }
                 out_redir = curr_arg;
+                missing_word = 0;
+            }
+
+            else {
+                if (num_args > 1){
+                    TRACE_NOTE("parse_error", "more than 1 arg for here-document");
+                    return -1;
+                }
+                here_word = curr_arg;
+                missing_word = 0;
             }
         }
         
     }
+
+    if (missing_word){
+        TRACE_NOTE("parse_error", "redirection without a word");
+        return -1;
+    }
+    if (out_redir != NULL && add_out_target(command, out_redir, out_append) < 0){
+        return -1;
+    }
+
+    if (here_word != NULL){
+        if (in_redir != NULL){
+            TRACE_NOTE("parse_error", "both input redirection and here-document given");
+            return -1;
+        }
+        if (mode == 3){
+            // a here-string is the word plus a newline
+            size_t word_length = strlen(here_word);
+            command->here_doc = mem_realloc(here_word, word_length + 2, MEM_PARSE);
+            command->here_doc[word_length] = '\n';
+            command->here_doc[word_length + 1] = '\0';
+        }
+        else {
+            command->here_doc = take_here_doc(bodies, here_word);
+            if (command->here_doc == NULL){
+                ERR_PRINT(ERR_HEREDOC, here_word);
+                mem_free(here_word);
+                return -1;
+            }
+            mem_free(here_word);
+        }
+    }
+
     command->args = args;
-    if (args != NULL){
+    if (args != NULL && defer_vars && strchr(args[0], VARIABLE_PARSE_MARKER)){
+        command->exec_path = NULL; // resolved by expand_commands
+    }
+    else if (args != NULL){
+        uint64_t trace_start = TRACE_START();
         char *exceutable = resolve_executable(args[0], *variables);
-        #ifdef DEBUG
-            printf("%s\n", exceutable);
-        #endif
-        if(exceutable == NULL){
+        TRACE_END("resolve", trace_start, getpid(), args[0]);
+        if(exceutable == NULL && defer_vars){
+            // may be a function that isn't defined yet (or calls itself),
+            // so look again when the statement runs
+            command->exec_path = NULL;
+        }
+        else if(exceutable == NULL){
             return -1;
         }
         else{
@@ -320,9 +504,9 @@ int load_single_command(char *section, Command *command, Variable **variables){
         }
     }
     command->redir_in_path = in_redir;
-    command->redir_out_path = out_redir;
     command->stdin_fd = STDIN_FILENO;
     command->stdout_fd = STDOUT_FILENO;
+    command->variables = variables;
 
     return 0;
 }
@@ -333,40 +517,48 @@ int load_single_command(char *section, Command *command, Variable **variables){
  * @param line 
  * @param variables 
  * @param commands 
+ * @param defer_vars 
+ * @param bodies 
  * @return int 
  */
-int load_commands(char *line, Variable **variables, Command *commands){
-    char *toksave1;
+int load_commands(char *line, Variable **variables, Command *commands,
+                  uint8_t defer_vars, char *bodies, const LineScan *scan){
     char *toksave2;
 
     // TODO: make sure u null terminate args
     //discard anything after comments
-    char *delim = "#";
-    char *section = strtok_r(line, delim, &toksave1); // the section we are going to continue to work with.
+    char *comment = find_comment(line);
+    if (comment != NULL){
+        *comment = '\0';
+    }
+    char *section = line; // the section we are going to continue to work with.
+
+    // new stages go on after the last one, without walking the list
+    Command *tail = commands;
+    while (tail->next != NULL){
+        tail = tail->next;
+    }
 
     char *token = strtok_r(section, "|", &toksave2);
     while (token != NULL){
-        #ifdef DEBUG
-            printf("token: %s\n", token);
-        #endif
         // Determine if need to make a new Command object
         Command * curr_command;
-        if (commands->exec_path == NULL){
+        if (commands->args == NULL){
             curr_command = commands;
         }
         else{
-            curr_command = malloc(sizeof(Command));
+            curr_command = mem_alloc(sizeof(Command), MEM_PARSE);
+            if (curr_command == NULL){
+                perror("load_commands");
+                return -1;
+            }
             make_command_default_null(curr_command);
-
-            Command *traverse = commands;
-            // Add new commands to list
-            while (traverse->next != NULL){
-                traverse = traverse->next;
-            }   
-            traverse->next = curr_command;
+            tail->next = curr_command;
+            tail = curr_command;
         }
         
-        if (load_single_command(token, curr_command, variables) < 0){
+        if (load_single_command(token, curr_command, variables, defer_vars,
+                                &bodies, scan, token - line) < 0){
             // free_command(commands); TODO, get this to work
             return -1;
         }
@@ -377,6 +569,81 @@ int load_commands(char *line, Variable **variables, Command *commands){
     return 0;
 }
 
+char *find_comment(const char *line){
+    for (const char *c = line; *c != '\0'; c++){
+        if (*c == COMMENT_MARKER &&
+            (c == line || c[-1] == ' ' || c[-1] == '\t')){
+            return (char *) c;
+        }
+    }
+    return NULL;
+}
+
+uint8_t is_assignment(const char *line){
+    const char *word = line + strspn(line, " \t");
+    if (*word == COMMENT_MARKER){
+        return 0;
+    }
+    return strcspn(word, "=") < strcspn(word, " \t\n");
+}
+
+/**
+ * @brief Expands a positional or special parameter ($1, ${10}, $#, $@)
+ * of the innermost function call. Unset ones expand to nothing.
+ * 
+ * @param name: the parameter name
+ * @param out: the buffer to append the value to
+ * @return int: 0 on success, -1 on failure
+ */
+static int expand_positional(const char *name, ExpandBuffer *out){
+    int argc = 0;
+    while (positional_params != NULL && positional_params[argc] != NULL){
+        argc++;
+    }
+
+    if (strcmp(name, "#") == 0){
+        char count[MAX_USER_BUF];
+        int length = snprintf(count, MAX_USER_BUF, "%d", argc > 0 ? argc - 1 : 0);
+        return expand_buffer_append(out, count, length);
+    }
+    if (strcmp(name, "@") == 0 || strcmp(name, "*") == 0){
+        for (int i = 1; i < argc; i++){
+            if ((i > 1 && expand_buffer_append(out, " ", 1) < 0) ||
+                expand_buffer_append(out, positional_params[i],
+                                     strlen(positional_params[i])) < 0){
+                return -1;
+            }
+        }
+        return 0;
+    }
+
+    int index = atoi(name);
+    if (index >= argc){
+        return 0;
+    }
+    return expand_buffer_append(out, positional_params[index],
+                                strlen(positional_params[index]));
+}
+
+/**
+ * @brief Finds the ')' closing a command substitution, allowing nesting
+ * 
+ * @param open: points at the opening '('
+ * @return const char*: the matching ')', NULL if there isn't one
+ */
+const char *find_subst_close(const char *open){
+    int depth = 0;
+    for (const char *c = open; *c != '\0'; c++){
+        if (*c == SUBST_OPEN){
+            depth++;
+        }
+        else if (*c == SUBST_CLOSE && --depth == 0){
+            return c;
+        }
+    }
+    return NULL;
+}
+
 /* OFFICIAL ASSIGNMENT FUNCTIONS */
 
 // COMPLETE
@@ -386,8 +653,17 @@ char *resolve_executable(const char *command_name, Variable *path){
         return NULL;
     }
 
-    if (strcmp(command_name, CD) == 0){
-        return strdup(CD);
+    // functions and builtins (including cd) don't live on the PATH
+    if (find_function(command_name) != NULL || find_builtin(command_name) != NULL){
+        return mem_strdup(command_name, MEM_PARSE);
+    }
+    return resolve_on_path(command_name, path);
+}
+
+char *resolve_on_path(const char *command_name, Variable *path){
+
+    if (command_name == NULL || path == NULL){
+        return NULL;
     }
 
     if (strcmp(path->name, PATH_VAR_NAME) != 0){
@@ -398,7 +674,7 @@ char *resolve_executable(const char *command_name, Variable *path){
     char *exec_path = NULL;
 
     if (strchr(command_name, '/')){
-        exec_path = strdup(command_name);
+        exec_path = mem_strdup(command_name, MEM_PARSE);
         if (exec_path == NULL){
             perror("resolve_executable");
             return NULL;
@@ -407,7 +683,7 @@ char *resolve_executable(const char *command_name, Variable *path){
     }
 
     // we create a duplicate so that we can mess it up with strtok
-    char *path_to_toke = strdup(path->value);
+    char *path_to_toke = mem_strdup(path->value, MEM_PARSE);
     if (path_to_toke == NULL){
         perror("resolve_executable");
         return NULL;
@@ -442,7 +718,7 @@ char *resolve_executable(const char *command_name, Variable *path){
                 // +1 null term, +1 possible missing '/'
                 size_t buflen = strlen(current_path) +
                     strlen(command_name) + 1 + 1;
-                exec_path = (char *) malloc(buflen);
+                exec_path = (char *) mem_alloc(buflen, MEM_PARSE);
                 // also sets remaining buf to 0
                 strncpy(exec_path, current_path, buflen);
                 if (current_path[strlen(current_path)-1] != '/'){
@@ -459,15 +735,55 @@ char *resolve_executable(const char *command_name, Variable *path){
     } while ((current_path = strtok(CONTINUE_SEARCH, ":")));
 
 res_ex_cleanup:
-    free(path_to_toke);
+    mem_free(path_to_toke);
     return exec_path;
 }
 
 Command *parse_line(char *line, Variable **variables){
-    line = replace_variables_mk_line(line, *variables);
-    if (line == NULL){
+    uint64_t trace_start = TRACE_START();
+    char *expanded = replace_variables_mk_line(line, *variables);
+    TRACE_END("expand", trace_start, getpid(), line);
+    if (expanded == NULL || expanded == (char *) -1){
         return (Command *) -1;
     }
+    line = expanded;
+
+    trace_start = TRACE_START();
+    Command *commands = parse_commands(line, variables, 0);
+    TRACE_END("parse", trace_start, getpid(), line);
+    mem_free(line);
+    return commands;
+}
+
+Command *parse_commands(char *line, Variable **variables, uint8_t defer_vars){
+    // Any here-document bodies follow the first line
+    char *bodies = strchr(line, '\n');
+    if (bodies != NULL){
+        *bodies++ = '\0';
+    }
+
+    // "cmd |& a |& b": every pipeline is parsed on its own, a and b are
+    // chained on cmd's tee_next and fed what cmd writes
+    char *comment = find_comment(line);
+    char *tee_op = strstr(line, TEE_OPERATOR);
+    if (tee_op != NULL && (comment == NULL || tee_op < comment)){
+        if (bodies != NULL){
+            return (Command *) -1; // the bodies can't be shared out
+        }
+        *tee_op = '\0';
+        Command *branches = parse_commands(tee_op + strlen(TEE_OPERATOR),
+                                           variables, defer_vars);
+        if (branches == NULL || branches == (Command *) -1){
+            return (Command *) -1;
+        }
+        Command *producer = parse_commands(line, variables, defer_vars);
+        if (producer == NULL || producer == (Command *) -1){
+            free_command(branches);
+            return (Command *) -1;
+        }
+        producer->tee_next = branches;
+        return producer;
+    }
 
     // store indexes of special characters
     int equal_loc = 2147483647;
@@ -479,23 +795,35 @@ Command *parse_line(char *line, Variable **variables){
     Command *commands = NULL;
 
 
-    // search for existence of special characters to determine how we're going to handle this line
-    for (int i = 0; i < strlen(line); i++){
+    size_t length = strlen(line);
+    LineScan scan;
+    if (scan_line(line, length, &scan) < 0){
+        return (Command *) -1;
+    }
+
+    // only the first word can be an assignment: `echo a=b` is a command
+    uint8_t assigning = !defer_vars && is_assignment(line);
+
+    // search for existence of special characters to determine how we're going to handle this line,
+    // jumping straight from one to the next
+    for (size_t i = scan_next(scan.meta, length, 0); i < length;
+         i = scan_next(scan.meta, length, i + 1)){
         // If we see an =, -> we have to deal with variable assignment
-        if (line[i] == '#'){
+        if (line[i] == COMMENT_MARKER &&
+            (i == 0 || line[i - 1] == ' ' || line[i - 1] == '\t')){
             comment_loc = i;
             break; // Note: we return here b/c once we see an =, theres nothing left to parse.
         }
         // if we see a #, we know a comment follows and can therefore ignore it
-        else if (line[i] == '='){
+        else if (line[i] == '=' && assigning){
             equal_loc = i;
             break;
         }
         else if (line[i] == '>'){
             // If we notice its an append output redir, we will mark it accordingly.
-            if (i < strlen(line) - 1 && line[i + 1] == '>'){
+            if (i < length - 1 && line[i + 1] == '>'){
                 Node *old_head = out_app_redir_loc;
-                Node *new_out_app_redir = malloc(sizeof(Node));
+                Node *new_out_app_redir = mem_alloc(sizeof(Node), MEM_PARSE);
                 new_out_app_redir->data = i;
                 new_out_app_redir->next = old_head;
                 out_app_redir_loc = new_out_app_redir;
@@ -503,15 +831,19 @@ Command *parse_line(char *line, Variable **variables){
             }
             else{
                 Node *old_head = out_redir_loc;
-                Node *new_out_redir = malloc(sizeof(Node));
+                Node *new_out_redir = mem_alloc(sizeof(Node), MEM_PARSE);
                 new_out_redir->data = i;
                 new_out_redir->next = old_head;
                 out_redir_loc = new_out_redir;
             }
         }
+        else if (line[i] == '<' && line[i + 1] == '<'){
+            // here-documents and here-strings may go on any command
+            i += strspn(line + i, "<") - 1;
+        }
         else if (line[i] == '<'){
             Node * old_head = in_redir_loc;
-            Node *new_in_redir = malloc(sizeof(Node));
+            Node *new_in_redir = mem_alloc(sizeof(Node), MEM_PARSE);
             new_in_redir->data = i;
             new_in_redir->next = old_head;
             in_redir_loc = new_in_redir;
@@ -519,7 +851,7 @@ Command *parse_line(char *line, Variable **variables){
 
         else if (line[i] == '|'){
             Node *old_head = pipe_loc;
-            Node *new_pipe = malloc(sizeof(Node));
+            Node *new_pipe = mem_alloc(sizeof(Node), MEM_PARSE);
             new_pipe->data = i;
             new_pipe->next = old_head;
             pipe_loc = new_pipe;
@@ -529,6 +861,7 @@ Command *parse_line(char *line, Variable **variables){
     /* Check validity of special characters*/
     // There exists a variable assignment, and it occurs before any comment location
     if (equal_loc != 2147483647 && equal_loc < comment_loc){
+        free_line_scan(&scan);
         if (retrieve_variable(line, variables, equal_loc) == -1){
             // TODO: free most recent variable?
             free_command(commands);
@@ -539,26 +872,22 @@ Command *parse_line(char *line, Variable **variables){
     }
     // if we spot a # immendiately, we can return.
     else if (comment_loc == 0){
+        free_line_scan(&scan);
         return NULL;
     }
     // Clearly some kind of command or blank, we will handle accordingly
     else{
-        if (out_app_redir_loc != NULL && (out_app_redir_loc->next != NULL || out_redir_loc != NULL)){
-            commands = (Command *) -1;
-        }
-        else if (out_redir_loc != NULL && (out_redir_loc->next != NULL || out_app_redir_loc != NULL)){
-            commands = (Command *) -1;
-        }
-        else if (in_redir_loc != NULL && in_redir_loc->next != NULL){
+        // any number of output redirections, all on the last command
+        if (in_redir_loc != NULL && in_redir_loc->next != NULL){
             commands = (Command *) -1;
         }
         else if (in_redir_loc != NULL && pipe_loc != NULL && in_redir_loc->data > pipe_loc->data){
             commands = (Command *) -1;
         }
-        else if (out_redir_loc != NULL && pipe_loc != NULL && out_redir_loc->data < pipe_loc->data){
+        else if (out_redir_loc != NULL && pipe_loc != NULL && first_location(out_redir_loc) < pipe_loc->data){
             commands = (Command *) -1;
         }
-        else if (out_app_redir_loc != NULL && pipe_loc != NULL && out_app_redir_loc->data < pipe_loc->data){
+        else if (out_app_redir_loc != NULL && pipe_loc != NULL && first_location(out_app_redir_loc) < pipe_loc->data){
             commands = (Command *) -1;
         }
     }
@@ -566,24 +895,38 @@ Command *parse_line(char *line, Variable **variables){
     // account for if more than 1 arg is given to a redirection operator
     // TODO mallocc error
     if (commands != (Command *) -1){
-        commands = malloc(sizeof(Command));
+        commands = mem_alloc(sizeof(Command), MEM_PARSE);
         make_command_default_null(commands);
     }
 
-    if (commands != (Command *) -1 && load_commands(line, variables, commands) < 0){
-        // TODO use free commands to free all recent commands that we tried to parse.
+    if (commands != (Command *) -1 &&
+        load_commands(line, variables, commands, defer_vars, bodies, &scan) < 0){
+        free_command(commands);
         commands = (Command *) -1;
     }
 
+    // a blank (or comment only) line
     if (commands != (Command *) -1 && commands->args == NULL){
-        return NULL;
+        free_command(commands);
+        commands = NULL;
     }
 
-    #ifdef DEBUG
-        debug_parse_commands(commands);
-    #endif
+    // templates are brace expanded and globbed when they run, once their
+    // variables are known and since the files may change
+    if (commands != (Command *) -1 && commands != NULL && !defer_vars){
+        GlobCache cache = {NULL};
+        for (Command *curr = commands; curr != NULL; curr = curr->next){
+            if (expand_braces(curr) < 0 || expand_globs(curr, &cache) < 0){
+                free_command(commands);
+                commands = (Command *) -1;
+                break;
+            }
+        }
+        free_glob_cache(&cache);
+    }
 
     // free everything used
+    free_line_scan(&scan);
     free_linked_list(in_redir_loc);
     free_linked_list(out_app_redir_loc);
     free_linked_list(out_redir_loc);
@@ -593,165 +936,167 @@ Command *parse_line(char *line, Variable **variables){
 }
 
 
-/*
-** This function is partially implemented for you, but you may
-** scrap the implementation as long as it produces the same result.
-**
-** Creates a new line on the heap with all named variable *usages*
-** replaced with their associated values.
-**
-** Returns NULL if replacement parsing had an error, or (char *) -1 if
-** system calls fail and the shell needs to exit.
-*/
-char *replace_variables_mk_line(const char *line,
-                                Variable *variables){
+/**
+ * @brief The body of replace_variables_mk_line, going from one '$' of the
+ * line's scan to the next
+ */
+static char *expand_scanned_line(const char *line, size_t length,
+                                 const LineScan *scan, Variable *variables){
+    ExpandBuffer out;
+    if (expand_buffer_init(&out, length + 1) < 0){
+        return (char *) -1;
+    }
 
-    char *new_line = malloc(sizeof(char) * (strlen(line) + 1));
-    strcpy(new_line, line);
-    new_line[strlen(line)] = '\0';
-
-    char *occurrence = strchr(new_line, '$');
-    while (occurrence != NULL){
-
-        int start_of_var = occurrence - new_line + 1;
-        int end_of_var = 0;
-        int front_bracket_found = 0;
-        int back_bracket_found = 0;
-
-        // Get variable name
-        for (int i = occurrence - new_line + 1; i < strlen(new_line); i++){
-            if (new_line[i] == '{'){
-                // If { doesn't occur immediately after $ or occurs @ end of string
-                if (i != occurrence - new_line + 1 || i + 1 >= strlen(line)){
-                    #ifdef DEBUG
-                        ERR_PRINT("Invalid variable syntax: unambiguous case\n");
-                    #endif
-                    free(new_line);
-                    return NULL;
-                }
-                start_of_var = i + 1;
-                front_bracket_found = 1;
-            }
+    const char *curr = line;
+    size_t pos;
+    while ((pos = scan_next(scan->vars, length, curr - line)) < length){
+        const char *occurrence = line + pos;
+        if (expand_buffer_append(&out, curr, occurrence - curr) < 0){
+            return (char *) -1;
+        }
 
-            else if (new_line[i] == '}'){
-                // If placement of doesn't make sense, i.e. must be at index 3 at minimum to
-                // make space for proper syntax, like so: ${x}
-                // Also must have have found the first bracket.
-                if (i < 3 && front_bracket_found == 0){
-                    #ifdef DEBUG
-                        ERR_PRINT("Invalid variable syntax: unambiguous case\n");
-                    #endif
-                    free(new_line);
-                    return NULL;
-                }
-                back_bracket_found = 1;
-                end_of_var = i - 1;
-                break;
+        // Arithmetic expansion $((...)), evaluated right here
+        const char *arith_close = find_arith_close(occurrence + 1);
+        if (arith_close != NULL){
+            int64_t value;
+            if (eval_arith(occurrence + 3, arith_close - occurrence - 4,
+                           variables, &value) < 0){
+                mem_free(out.data);
+                return NULL;
+            }
+            char digits[24];
+            int length = snprintf(digits, sizeof(digits), "%lld", (long long) value);
+            if (expand_buffer_append(&out, digits, length) < 0){
+                return (char *) -1;
             }
+            curr = arith_close + 1;
+            continue;
+        }
 
-            else if (i > 0 && !isalpha(new_line[i]) && new_line[i] != '_'){
-                end_of_var = i - 1;
-                break;
+        // Command substitution $(...)
+        if (occurrence[1] == SUBST_OPEN){
+            const char *close = find_subst_close(occurrence + 1);
+            if (close == NULL){
+                ERR_PRINT(ERR_SUBST_SYNTAX, occurrence);
+                mem_free(out.data);
+                return NULL;
+            }
+            char *inner = mem_strndup(occurrence + 2, close - occurrence - 2, MEM_EXPANSION);
+            parse_volatile = 1;
+            int status = inner == NULL ? -1 : capture_command(inner, variables, &out);
+            mem_free(inner);
+            if (out.data == NULL){
+                return (char *) -1;
+            }
+            if (status < 0){
+                mem_free(out.data);
+                return NULL;
             }
+            curr = close + 1;
+            continue;
+        }
 
-            else if (i == strlen(new_line) - 1){
-                end_of_var = i;
+        // Get variable name, either $NAME or ${NAME}
+        const char *start_of_var = occurrence + 1;
+        int bracketed = (*start_of_var == '{');
+        if (bracketed){
+            start_of_var++;
+        }
+        const char *end_of_var = start_of_var;
+        uint8_t positional = 0;
+        if (strchr("#@*", *start_of_var) != NULL && *start_of_var != '\0'){
+            positional = 1;
+            end_of_var++;
+        }
+        else if (isdigit(*start_of_var)){
+            // $12 is $1 followed by '2', like other shells
+            positional = 1;
+            end_of_var++;
+            while (bracketed && isdigit(*end_of_var)){
+                end_of_var++;
             }
         }
+        while (!positional && (isalpha(*end_of_var) || *end_of_var == '_')){
+            end_of_var++;
+        }
 
-        // Miscellaneous error checks
-        // If either both were found or both were not
-        if (!((front_bracket_found && back_bracket_found) || (!front_bracket_found && !back_bracket_found))){
-            #ifdef DEBUG
-                ERR_PRINT("Invalid variable syntax: missing open/close curly brace.\n");
-            #endif
-            free(new_line);
+        if (bracketed && *end_of_var != '}'){
+            TRACE_NOTE("parse_error", "missing open/close curly brace");
+            mem_free(out.data);
             return NULL;
         }
-
-        // If the end of the variable is the same as where we found $, we must not
-        // have inputted a meaningful variable name
-        if (end_of_var == occurrence - new_line){
-            #ifdef DEBUG
-                ERR_PRINT("Invalid variable syntax: empty or invalid variable name\n");
-            #endif
-            free(new_line);
+        if (end_of_var == start_of_var){
+            TRACE_NOTE("parse_error", "empty or invalid variable name");
+            mem_free(out.data);
             return NULL;
         }
 
         // extract the name
-        char var_name[end_of_var - start_of_var + 1];
-        strncpy(var_name, new_line + start_of_var, end_of_var - start_of_var + 1);
-        var_name[end_of_var - start_of_var + 1] = '\0';
+        size_t name_length = end_of_var - start_of_var;
+        char var_name[name_length + 1];
+        strncpy(var_name, start_of_var, name_length);
+        var_name[name_length] = '\0';
+
+        if (positional){
+            parse_volatile = 1;
+            if (expand_positional(var_name, &out) < 0){
+                return (char *) -1;
+            }
+            curr = end_of_var + bracketed;
+            continue;
+        }
 
         // see if var exists
         Variable *actual_var = search_for_var(&variables, var_name);
         if (actual_var == NULL){
-            #ifdef DEBUG
-                ERR_PRINT("Variable '%s' does not exist.\n", var_name);
-            #endif
-            free(new_line);
+            TRACE_NOTE("parse_error", var_name);
+            mem_free(out.data);
             return NULL;
         }
 
-        // edit the line
-        int new_line_length = strlen(new_line) - (strlen(var_name)) + strlen(actual_var->value);
-        char * copy_of_new_line = strdup(new_line); // have a copy of the new_line so we can take pieces of it
-        int first_chunk = occurrence - new_line;
-        int middle_chunk = strlen(actual_var->value);
-        int last_chunk;
-        // curly brace was last character
-        if (back_bracket_found == 1 && end_of_var + 1 == strlen(new_line) - 1){
-            last_chunk = 0;
-        }
-        else if (back_bracket_found){
-            last_chunk = strlen(new_line) - end_of_var - 2;
+        if (expand_buffer_append(&out, actual_var->value,
+                                 strlen(actual_var->value)) < 0){
+            return (char *) -1;
         }
-        else{
-            last_chunk = strlen(new_line) - end_of_var - 1;
-        }
-        new_line = realloc(new_line, sizeof(char) * new_line_length);
-        memset(new_line, '\0', strlen(new_line));
-        strncpy(new_line, copy_of_new_line, first_chunk);
-        strncpy(new_line + first_chunk, actual_var->value, middle_chunk);
-        strncpy(new_line + first_chunk + middle_chunk, copy_of_new_line + (strlen(copy_of_new_line) - last_chunk), last_chunk);
-        new_line[new_line_length - 1] = '\0';
-        free(copy_of_new_line);
-        occurrence = strchr(new_line, '$');
-    } 
-    #ifdef DEBUG
-        printf("%s\n", new_line);
-    #endif
-    return new_line;
+        curr = end_of_var + bracketed;
+    }
+
+    if (expand_buffer_append(&out, curr, length - (curr - line)) < 0){
+        return (char *) -1;
+    }
+    return out.data;
+}
+
+/*
+** This function is partially implemented for you, but you may
+** scrap the implementation as long as it produces the same result.
+**
+** Creates a new line on the heap with all named variable *usages*
+** replaced with their associated values.
+**
+** Returns NULL if replacement parsing had an error, or (char *) -1 if
+** system calls fail and the shell needs to exit.
+*/
+char *replace_variables_mk_line(const char *line,
+                                Variable *variables){
+    size_t length = strlen(line);
+    LineScan scan;
+    if (scan_line(line, length, &scan) < 0){
+        return (char *) -1;
+    }
+    char *expanded = expand_scanned_line(line, length, &scan, variables);
+    free_line_scan(&scan);
+    return expanded;
 }
 
 
 void free_variable(Variable *var, uint8_t recursive){
-    // Recursive option
-    if (recursive != 0){
-        if (var == NULL){
-            return;
-        }
-        else if (var->next == NULL){
-            free(var->name);
-            free(var->value);
-            free(var);
-        }
-        else{
-            free_variable(var->next, recursive);
-            free(var);
-        }
-    }
-    
-    // Non-recursive option
-    else{
-        if (var == NULL){
-            return;
-        }
-        else{
-            free(var->name);
-            free(var->value);
-            free(var);
-        }
+    while (var != NULL){
+        Variable *next = var->next;
+        mem_free(var->name);
+        mem_free(var->value);
+        mem_free(var);
+        // Non-recursive option stops after the first
+        var = recursive != 0 ? next : NULL;
     }
 }
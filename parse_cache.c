@@ -0,0 +1,135 @@
+/*****************************************************************************/
+/*                           CSC209-24s A3 CSCSHELL                          */
+/*       Copyright 2024 -- Demetres Kostas PhD (aka Darlene Heliokinde)      */
+/*****************************************************************************/
+
+#include "cscshell.h"
+
+
+ParseCacheStats parse_cache_stats = {0};
+uint64_t variable_generation = 0;
+uint8_t parse_volatile = 0;
+
+static ParseCacheEntry *buckets[PARSE_CACHE_BUCKETS];
+
+// Most recently used first; the tail is the next to be evicted
+static ParseCacheEntry *lru_head = NULL;
+static ParseCacheEntry *lru_tail = NULL;
+
+
+/* HELPERS */
+
+/**
+ * @brief FNV-1a hash of a line
+ */
+static uint64_t hash_line(const char *line){
+    uint64_t hash = 14695981039346656037ULL;
+    for (; *line != '\0'; line++){
+        hash ^= (uint8_t) *line;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static void lru_unlink(ParseCacheEntry *entry){
+    if (entry->prev != NULL) entry->prev->next = entry->next;
+    else lru_head = entry->next;
+    if (entry->next != NULL) entry->next->prev = entry->prev;
+    else lru_tail = entry->prev;
+    entry->prev = entry->next = NULL;
+}
+
+static void lru_push_front(ParseCacheEntry *entry){
+    entry->prev = NULL;
+    entry->next = lru_head;
+    if (lru_head != NULL) lru_head->prev = entry;
+    else lru_tail = entry;
+    lru_head = entry;
+}
+
+/**
+ * @brief Frees an entry that is no longer in the cache or held
+ */
+static void free_entry(ParseCacheEntry *entry){
+    mem_free(entry->line);
+    free_command(entry->commands);
+    mem_free(entry);
+}
+
+/**
+ * @brief Takes an entry out of the cache. It is freed now, or by
+ * parse_cache_release if a line is still running it.
+ */
+static void remove_entry(ParseCacheEntry *entry){
+    ParseCacheEntry **link = &buckets[hash_line(entry->line) % PARSE_CACHE_BUCKETS];
+    while (*link != entry){
+        link = &(*link)->chain;
+    }
+    *link = entry->chain;
+    lru_unlink(entry);
+    parse_cache_stats.entries--;
+
+    if (--entry->refs == 0){
+        free_entry(entry);
+    }
+}
+
+
+/* SHELL EXTENSION FUNCTIONS */
+
+ParseCacheEntry *parse_cache_lookup(const char *line){
+    ParseCacheEntry *entry = buckets[hash_line(line) % PARSE_CACHE_BUCKETS];
+    while (entry != NULL && strcmp(entry->line, line) != 0){
+        entry = entry->chain;
+    }
+
+    if (entry != NULL && entry->generation != variable_generation){
+        // parsed under values that have since changed
+        remove_entry(entry);
+        entry = NULL;
+    }
+    if (entry == NULL){
+        parse_cache_stats.misses++;
+        return NULL;
+    }
+
+    parse_cache_stats.hits++;
+    lru_unlink(entry);
+    lru_push_front(entry);
+    entry->refs++;
+    return entry;
+}
+
+ParseCacheEntry *parse_cache_store(const char *line, Command *commands){
+    ParseCacheEntry *entry = mem_calloc(1, sizeof(ParseCacheEntry), MEM_PARSE);
+    if (entry == NULL || (entry->line = mem_strdup(line, MEM_PARSE)) == NULL){
+        mem_free(entry);
+        return NULL;
+    }
+    if (parse_cache_stats.entries == PARSE_CACHE_SIZE){
+        remove_entry(lru_tail);
+    }
+
+    entry->generation = variable_generation;
+    entry->commands = commands;
+    entry->refs = 2; // one for the cache, one for the caller
+
+    uint64_t bucket = hash_line(line) % PARSE_CACHE_BUCKETS;
+    entry->chain = buckets[bucket];
+    buckets[bucket] = entry;
+    lru_push_front(entry);
+    parse_cache_stats.entries++;
+    return entry;
+}
+
+void parse_cache_release(ParseCacheEntry *entry){
+    if (--entry->refs == 0){
+        free_entry(entry);
+    }
+}
+
+void parse_cache_clear(void){
+    while (lru_head != NULL){
+        remove_entry(lru_head);
+    }
+}
@@ -0,0 +1,922 @@
+/*****************************************************************************/
+/*                           CSC209-24s A3 CSCSHELL                          */
+/*       Copyright 2024 -- Demetres Kostas PhD (aka Darlene Heliokinde)      */
+/*****************************************************************************/
+
+#include "cscshell.h"
+#include <ctype.h>
+
+// inside $((...)) these would split the command template apart
+#define ARITH_UNSAFE_CHARS " \t<>|#"
+
+/* HELPERS */
+
+/**
+ * @brief Skips spaces and tabs at the front of a string
+ *
+ * @param s: the string
+ * @return char*: the first non-blank character of s
+ */
+static char *skip_blanks(char *s){
+    while (*s == ' ' || *s == '\t'){
+        s++;
+    }
+    return s;
+}
+
+/**
+ * @brief Checks if text starts with the given keyword as a whole word
+ *
+ * @param text: the text to check (already skipped past blanks)
+ * @param word: the keyword
+ * @return int: the length of the keyword if it matches, 0 if not
+ */
+static int starts_with_word(const char *text, const char *word){
+    size_t len = strlen(word);
+    if (strncmp(text, word, len) != 0){
+        return 0;
+    }
+    if (text[len] != '\0' && text[len] != ' ' && text[len] != '\t' &&
+        text[len] != STATEMENT_SEPARATOR){
+        return 0;
+    }
+    return len;
+}
+
+/**
+ * @brief Splits text into trimmed, ';' separated segments, in place.
+ * Anything after a '#' is a comment and gets discarded.
+ *
+ * @param text: the text to split, modified in place
+ * @param num_segments: set to the number of segments found
+ * @return char**: a heap array of pointers into text, NULL on error
+ */
+static char **split_segments(char *text, int *num_segments){
+    char *comment = find_comment(text);
+    if (comment != NULL){
+        *comment = '\0';
+    }
+
+    int cap = 1;
+    for (char *c = text; *c != '\0'; c++){
+        if (*c == STATEMENT_SEPARATOR) cap++;
+    }
+    char **segments = mem_alloc(sizeof(char *) * cap, MEM_PARSE);
+    if (segments == NULL){
+        perror("split_segments");
+        return NULL;
+    }
+
+    int n = 0;
+    char *start = text;
+    while (start != NULL){
+        char *end = strchr(start, STATEMENT_SEPARATOR);
+        if (end != NULL){
+            *end = '\0';
+        }
+        char *seg = skip_blanks(start);
+        size_t len = strlen(seg);
+        while (len > 0 && (seg[len - 1] == ' ' || seg[len - 1] == '\t')){
+            seg[--len] = '\0';
+        }
+        segments[n++] = seg;
+        start = end == NULL ? NULL : end + 1;
+    }
+    *num_segments = n;
+    return segments;
+}
+
+/**
+ * @brief Gives each segment that reads here-documents the bodies its
+ * operators take, from those following the whole text in order. The
+ * segment becomes "SEGMENT\nBODIES", the way parse_commands takes it.
+ *
+ * @param bodies: the bodies, NULL if there are none
+ * @param attached: num slots, set to the heap strings made (or NULL)
+ * @return int: 0 on success, -1 on error
+ */
+static int attach_here_docs(char **segs, int num, char *bodies, char **attached){
+    char delim[MAX_SINGLE_LINE];
+    for (int k = 0; k < num && bodies != NULL; k++){
+        char *start = bodies;
+        const char *scan = segs[k];
+        while (bodies != NULL &&
+               (scan = next_here_doc(scan, delim, MAX_SINGLE_LINE)) != NULL){
+            // up to and including the delimiter line
+            size_t delim_len = strlen(delim);
+            char *body_line = bodies;
+            bodies = NULL;
+            while (body_line != NULL){
+                char *end = strchr(body_line, '\n');
+                size_t len = end != NULL ? (size_t) (end - body_line) : strlen(body_line);
+                uint8_t is_delim = len == delim_len && strncmp(body_line, delim, len) == 0;
+                body_line = end != NULL ? end + 1 : NULL;
+                if (is_delim){
+                    bodies = body_line;
+                    break;
+                }
+            }
+        }
+        if (bodies == start){
+            continue;
+        }
+
+        // an unterminated body is left for parse_commands to report
+        size_t body_len = bodies != NULL ? (size_t) (bodies - start) : strlen(start);
+        attached[k] = mem_alloc(strlen(segs[k]) + body_len + 2, MEM_PARSE);
+        if (attached[k] == NULL){
+            perror("attach_here_docs");
+            return -1;
+        }
+        sprintf(attached[k], "%s\n%.*s", segs[k], (int) body_len, start);
+        segs[k] = attached[k];
+    }
+    return 0;
+}
+
+static Statement *parse_list(char **segs, int num, int *i,
+                             Variable **variables, const char *terminator);
+
+// The function table, with the most recently defined function first
+static Function *functions = NULL;
+
+char **positional_params = NULL;
+static int function_depth = 0;
+
+/**
+ * @brief Checks if text starts a function definition, "NAME()"
+ *
+ * @param text: the text to check (already skipped past blanks)
+ * @return int: the length of the name, 0 if it isn't a definition
+ */
+static int function_header(const char *text){
+    int len = 0;
+    while (isalnum(text[len]) || text[len] == '_'){
+        len++;
+    }
+    if (len == 0 || isdigit(text[0])){
+        return 0;
+    }
+    const char *after = text + len + strspn(text + len, " \t");
+    return strncmp(after, FUNC_PARENS, strlen(FUNC_PARENS)) == 0 ? len : 0;
+}
+
+/**
+ * @brief Drops a reference to a function, freeing it with the last one
+ */
+static void release_function(Function *function){
+    if (function != NULL && --function->refs == 0){
+        mem_free(function->name);
+        free_statement(function->body);
+        mem_free(function);
+    }
+}
+
+/**
+ * @brief Makes a new statement with everything zeroed out
+ *
+ * @param kind: one of the STMT_* kinds
+ * @return Statement*: the statement, NULL on error
+ */
+static Statement *new_statement(uint8_t kind){
+    Statement *stmt = mem_calloc(1, sizeof(Statement), MEM_PARSE);
+    if (stmt == NULL){
+        perror("new_statement");
+        return NULL;
+    }
+    stmt->kind = kind;
+    return stmt;
+}
+
+/**
+ * @brief Checks if seg has a "$((...))" with a blank or a character the
+ * command tokenizer treats as a metacharacter (redirection, pipe, comment)
+ */
+static uint8_t has_unsafe_arith(const char *seg){
+    for (const char *c = strchr(seg, VARIABLE_PARSE_MARKER); c != NULL;
+         c = strchr(c + 1, VARIABLE_PARSE_MARKER)){
+        const char *close = c[1] == SUBST_OPEN ? find_arith_close(c + 1) : NULL;
+        for (const char *inner = c; close != NULL && inner < close; inner++){
+            if (strchr(ARITH_UNSAFE_CHARS, *inner) != NULL) return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Parses one simple segment: either an assignment or a pipeline.
+ * Pipelines are parsed into their template commands here, exactly once.
+ *
+ * @param seg: the trimmed segment
+ * @param variables: the variable list (needed to resolve executables)
+ * @return Statement*: the statement, NULL if the segment is empty,
+ *         -1 cast as a (Statement *) on error
+ */
+static Statement *parse_simple(char *seg, Variable **variables){
+    if (*seg == '\0'){
+        return NULL;
+    }
+
+    // Only the first word can be an assignment, so test args may use '='
+    if (is_assignment(seg)){
+        Statement *stmt = new_statement(STMT_ASSIGN);
+        if (stmt == NULL) return (Statement *) -1;
+        stmt->text = mem_strdup(seg, MEM_PARSE);
+        stmt->needs_expand = strchr(seg, VARIABLE_PARSE_MARKER) != NULL;
+        return stmt;
+    }
+
+    // Substituted output may hold pipes and several words, so these lines
+    // are expanded first and then parsed, every time they run. So is
+    // arithmetic with blanks in it, which parsing would split into words;
+    // the rest of it is expanded in the parsed template like any variable.
+    if (has_substitution(seg, strlen(seg)) || has_unsafe_arith(seg)){
+        Statement *stmt = new_statement(STMT_PIPELINE);
+        if (stmt == NULL) return (Statement *) -1;
+        stmt->text = mem_strdup(seg, MEM_PARSE);
+        stmt->needs_expand = 1;
+        return stmt;
+    }
+
+    // checked first: parsing cuts any here-document bodies off seg
+    uint8_t needs_expand = strchr(seg, VARIABLE_PARSE_MARKER) != NULL;
+    Command *commands = parse_commands(seg, variables, 1);
+    if (commands == (Command *) -1){
+        return (Statement *) -1;
+    }
+    if (commands == NULL){
+        return NULL;
+    }
+
+    Statement *stmt = new_statement(STMT_PIPELINE);
+    if (stmt == NULL){
+        free_command(commands);
+        return (Statement *) -1;
+    }
+    stmt->commands = commands;
+    stmt->needs_expand = needs_expand;
+    // unresolved executables are looked up again by expand_commands
+    for (Command *pipeline = commands; pipeline != NULL; pipeline = pipeline->tee_next){
+        for (Command *curr = pipeline; curr != NULL; curr = curr->next){
+            if (curr->exec_path == NULL) stmt->needs_expand = 1;
+        }
+    }
+    return stmt;
+}
+
+/**
+ * @brief Parses the "do ...; done" part of a loop, starting at segs[*i].
+ *
+ * @return int: 0 on success, -1 on failure
+ */
+static int parse_loop_body(Statement *loop, char **segs, int num, int *i,
+                           Variable **variables){
+    if (*i >= num){
+        ERR_PRINT(ERR_LOOP_SYNTAX, KW_DO);
+        return -1;
+    }
+    int len = starts_with_word(segs[*i], KW_DO);
+    if (len == 0){
+        ERR_PRINT(ERR_LOOP_SYNTAX, segs[*i]);
+        return -1;
+    }
+    // "do cmd" starts the body on the same segment
+    segs[*i] = skip_blanks(segs[*i] + len);
+
+    Statement *body = parse_list(segs, num, i, variables, KW_DONE);
+    if (body == (Statement *) -1){
+        return -1;
+    }
+    loop->body = body;
+
+    if (*i >= num || strcmp(segs[*i], KW_DONE) != 0){
+        ERR_PRINT(ERR_LOOP_SYNTAX, *i < num ? segs[*i] : KW_DONE);
+        return -1;
+    }
+    (*i)++;
+    return 0;
+}
+
+/**
+ * @brief Parses "for NAME in WORDS..." followed by its body
+ *
+ * @return Statement*: the loop, -1 cast as a (Statement *) on error
+ */
+static Statement *parse_for(char **segs, int num, int *i, Variable **variables){
+    char *header = skip_blanks(segs[*i] + strlen(KW_FOR));
+    char *name_end = header;
+    while (isalpha(*name_end) || *name_end == '_'){
+        name_end++;
+    }
+    char *rest = skip_blanks(name_end);
+    int in_len = starts_with_word(rest, KW_IN);
+    if (name_end == header || in_len == 0){
+        ERR_PRINT(ERR_LOOP_SYNTAX, segs[*i]);
+        return (Statement *) -1;
+    }
+
+    Statement *loop = new_statement(STMT_FOR);
+    if (loop == NULL) return (Statement *) -1;
+    loop->text = mem_strndup(header, name_end - header, MEM_PARSE);
+    loop->items = mem_strdup(skip_blanks(rest + in_len), MEM_PARSE);
+    loop->needs_expand = strchr(loop->items, VARIABLE_PARSE_MARKER) != NULL;
+
+    (*i)++;
+    if (parse_loop_body(loop, segs, num, i, variables) < 0){
+        free_statement(loop);
+        return (Statement *) -1;
+    }
+    return loop;
+}
+
+/**
+ * @brief Parses "while CONDITION" followed by its body
+ *
+ * @return Statement*: the loop, -1 cast as a (Statement *) on error
+ */
+static Statement *parse_while(char **segs, int num, int *i, Variable **variables){
+    char *cond_text = skip_blanks(segs[*i] + strlen(KW_WHILE));
+    Statement *cond = parse_simple(cond_text, variables);
+    if (cond == NULL || cond == (Statement *) -1){
+        ERR_PRINT(ERR_LOOP_SYNTAX, segs[*i]);
+        return (Statement *) -1;
+    }
+
+    Statement *loop = new_statement(STMT_WHILE);
+    if (loop == NULL){
+        free_statement(cond);
+        return (Statement *) -1;
+    }
+    loop->cond = cond;
+
+    (*i)++;
+    if (parse_loop_body(loop, segs, num, i, variables) < 0){
+        free_statement(loop);
+        return (Statement *) -1;
+    }
+    return loop;
+}
+
+/**
+ * @brief Parses "NAME() { BODY }" into a definition statement. The body is
+ * parsed here, once, and kept with the function.
+ *
+ * @return Statement*: the definition, -1 cast as a (Statement *) on error
+ */
+static Statement *parse_function(char **segs, int num, int *i,
+                                 Variable **variables){
+    char *header = segs[*i];
+    int name_len = function_header(header);
+    char *open = strstr(header, FUNC_PARENS) + strlen(FUNC_PARENS);
+    open = skip_blanks(open);
+
+    // the '{' may also start the next line
+    if (*open == '\0' && *i + 1 < num){
+        (*i)++;
+        open = segs[*i];
+    }
+    if (*open != FUNC_OPEN[0]){
+        ERR_PRINT(ERR_FUNC_SYNTAX, header);
+        return (Statement *) -1;
+    }
+    segs[*i] = skip_blanks(open + 1);
+
+    Statement *body = parse_list(segs, num, i, variables, FUNC_CLOSE);
+    if (body == (Statement *) -1){
+        return (Statement *) -1;
+    }
+    if (*i >= num || strcmp(segs[*i], FUNC_CLOSE) != 0){
+        ERR_PRINT(ERR_FUNC_SYNTAX, header);
+        free_statement(body);
+        return (Statement *) -1;
+    }
+    (*i)++;
+
+    Statement *stmt = new_statement(STMT_FUNCTION);
+    Function *function = mem_calloc(1, sizeof(Function), MEM_PARSE);
+    if (stmt == NULL || function == NULL){
+        perror("parse_function");
+        mem_free(stmt);
+        mem_free(function);
+        free_statement(body);
+        return (Statement *) -1;
+    }
+    function->name = mem_strndup(header, name_len, MEM_PARSE);
+    function->body = body;
+    function->refs = 1;
+    stmt->function = function;
+    return stmt;
+}
+
+/**
+ * @brief Parses segments into a statement list, stopping at the terminator
+ * ("done" for a loop body, "}" for a function), or at the end of the segments.
+ *
+ * @param segs: the segments
+ * @param num: the number of segments
+ * @param i: the current segment, advanced past everything parsed
+ * @param variables: the variable list
+ * @param terminator: the word that ends the list, NULL at the top level
+ * @return Statement*: the list (NULL if empty), -1 cast on error
+ */
+static Statement *parse_list(char **segs, int num, int *i,
+                             Variable **variables, const char *terminator){
+    Statement *head = NULL;
+    Statement *tail = NULL;
+
+    while (*i < num){
+        char *seg = segs[*i];
+        Statement *stmt;
+
+        if (terminator != NULL && starts_with_word(seg, terminator)){
+            break;
+        }
+        else if (starts_with_word(seg, KW_DONE)){
+            ERR_PRINT(ERR_LOOP_SYNTAX, seg);
+            stmt = (Statement *) -1;
+        }
+        else if (starts_with_word(seg, FUNC_CLOSE)){
+            ERR_PRINT(ERR_FUNC_SYNTAX, seg);
+            stmt = (Statement *) -1;
+        }
+        else if (function_header(seg)){
+            stmt = parse_function(segs, num, i, variables);
+        }
+        else if (starts_with_word(seg, KW_FOR)){
+            stmt = parse_for(segs, num, i, variables);
+        }
+        else if (starts_with_word(seg, KW_WHILE)){
+            stmt = parse_while(segs, num, i, variables);
+        }
+        else {
+            stmt = parse_simple(seg, variables);
+            (*i)++;
+        }
+
+        if (stmt == (Statement *) -1){
+            free_statement(head);
+            return (Statement *) -1;
+        }
+        if (stmt == NULL) continue;
+
+        if (tail == NULL){
+            head = stmt;
+        }
+        else {
+            tail->next = stmt;
+        }
+        tail = stmt;
+    }
+    return head;
+}
+
+/**
+ * @brief Duplicates text into a new array of args, splitting it on blanks
+ * like the line tokenizer would have if the variable was expanded first.
+ *
+ * @param args: the args array being built, grown as needed
+ * @param num_args: the number of args currently stored
+ * @param cap: the capacity of args
+ * @param text: the (expanded) text to add
+ * @return int: 0 on success, -1 on failure
+ */
+static int append_split_args(char ***args, int *num_args, int *cap, char *text){
+    char *toksave;
+    for (char *word = strtok_r(text, " \t", &toksave); word != NULL;
+         word = strtok_r(NULL, " \t", &toksave)){
+        if (*num_args + 1 >= *cap){
+            *cap *= 2;
+            char **grown = mem_realloc(*args, sizeof(char *) * *cap, MEM_EXECUTION);
+            if (grown == NULL){
+                perror("expand_commands");
+                return -1;
+            }
+            *args = grown;
+        }
+        (*args)[(*num_args)++] = mem_strdup(word, MEM_EXECUTION);
+        (*args)[*num_args] = NULL;
+    }
+    return 0;
+}
+
+/**
+ * @brief Expands a single string from a template, if it uses variables.
+ *
+ * @return char*: a heap copy (possibly expanded), or NULL on error
+ */
+static char *expand_or_copy(const char *text, Variable *variables){
+    if (text == NULL || strchr(text, VARIABLE_PARSE_MARKER) == NULL){
+        return text == NULL ? NULL : mem_strdup(text, MEM_EXECUTION);
+    }
+    return replace_variables_mk_line(text, variables);
+}
+
+/* SHELL EXTENSION FUNCTIONS */
+
+Command *expand_commands(Command *template, Variable **variables){
+    Command *head = NULL;
+    Command *tail = NULL;
+    GlobCache cache = {NULL};
+
+    for (Command *t = template; t != NULL; t = t->next){
+        Command *command = mem_calloc(1, sizeof(Command), MEM_EXECUTION);
+        if (command == NULL){
+            perror("expand_commands");
+            goto expand_error;
+        }
+        if (tail == NULL){
+            head = command;
+        }
+        else {
+            tail->next = command;
+        }
+        tail = command;
+
+        command->stdin_fd = t->stdin_fd;
+        command->stdout_fd = t->stdout_fd;
+        command->variables = t->variables;
+        command->redir_append = t->redir_append;
+
+        int cap = 4;
+        int num_args = 0;
+        command->args = mem_alloc(sizeof(char *) * cap, MEM_EXECUTION);
+        if (command->args == NULL){
+            perror("expand_commands");
+            goto expand_error;
+        }
+        command->args[0] = NULL;
+
+        uint8_t exec_changed = 0;
+        for (int i = 0; t->args[i] != NULL; i++){
+            if (strchr(t->args[i], VARIABLE_PARSE_MARKER) == NULL){
+                char *copy = mem_strdup(t->args[i], MEM_EXECUTION);
+                if (append_split_args(&command->args, &num_args, &cap, copy) < 0){
+                    mem_free(copy);
+                    goto expand_error;
+                }
+                mem_free(copy);
+                continue;
+            }
+
+            if (i == 0) exec_changed = 1;
+            char *expanded = replace_variables_mk_line(t->args[i], *variables);
+            if (expanded == NULL || expanded == (char *) -1){
+                goto expand_error;
+            }
+            int err = append_split_args(&command->args, &num_args, &cap, expanded);
+            mem_free(expanded);
+            if (err < 0){
+                goto expand_error;
+            }
+        }
+
+        if (num_args == 0){
+            goto expand_error;
+        }
+
+        if (exec_changed || t->exec_path == NULL){
+            command->exec_path = resolve_executable(command->args[0], *variables);
+            if (command->exec_path == NULL){
+                ERR_PRINT(ERR_NO_EXECU, command->args[0]);
+                goto expand_error;
+            }
+        }
+        else {
+            command->exec_path = mem_strdup(t->exec_path, MEM_EXECUTION);
+        }
+
+        command->redir_in_path = expand_or_copy(t->redir_in_path, *variables);
+        command->redir_out_path = expand_or_copy(t->redir_out_path, *variables);
+        command->here_doc = expand_or_copy(t->here_doc, *variables);
+        if ((t->redir_in_path != NULL && command->redir_in_path == NULL) ||
+            (t->redir_out_path != NULL && command->redir_out_path == NULL) ||
+            (t->here_doc != NULL && command->here_doc == NULL) ||
+            expand_braces(command) < 0 || expand_globs(command, &cache) < 0){
+            goto expand_error;
+        }
+
+        OutTarget **out_tail = &command->more_out;
+        for (OutTarget *out = t->more_out; out != NULL; out = out->next){
+            OutTarget *target = mem_calloc(1, sizeof(OutTarget), MEM_EXECUTION);
+            if (target == NULL){
+                perror("expand_commands");
+                goto expand_error;
+            }
+            *out_tail = target;
+            out_tail = &target->next;
+            target->append = out->append;
+            target->path = expand_or_copy(out->path, *variables);
+            if (target->path == NULL){
+                goto expand_error;
+            }
+        }
+    }
+
+    if (head != NULL && template->tee_next != NULL){
+        head->tee_next = expand_commands(template->tee_next, variables);
+        if (head->tee_next == (Command *) -1){
+            head->tee_next = NULL;
+            goto expand_error;
+        }
+    }
+    free_glob_cache(&cache);
+    return head;
+
+expand_error:
+    free_glob_cache(&cache);
+    free_command(head);
+    return (Command *) -1;
+}
+
+uint8_t is_compound_line(const char *line){
+    // here-document bodies after the first line, and comments, don't count
+    size_t first_line = strcspn(line, "\n");
+    const char *comment = find_comment(line);
+    size_t separator = strcspn(line, ";\n");
+    if (separator < first_line && line[separator] == STATEMENT_SEPARATOR &&
+        (comment == NULL || line + separator < comment)){
+        return 1;
+    }
+    const char *start = line + strspn(line, " \t");
+    return starts_with_word(start, KW_FOR) || starts_with_word(start, KW_WHILE) ||
+           function_header(start);
+}
+
+int block_depth(const char *text){
+    int depth = 0;
+    const char *comment = find_comment(text);
+    const char *seg = text;
+    while (seg != NULL && (comment == NULL || seg < comment)){
+        seg += strspn(seg, " \t");
+        if (starts_with_word(seg, KW_FOR) || starts_with_word(seg, KW_WHILE) ||
+            function_header(seg)){
+            depth++;
+        }
+        else if (starts_with_word(seg, KW_DONE) || starts_with_word(seg, FUNC_CLOSE)){
+            depth--;
+        }
+
+        const char *next = strchr(seg, STATEMENT_SEPARATOR);
+        seg = next == NULL ? NULL : next + 1;
+    }
+    return depth;
+}
+
+Function *find_function(const char *name){
+    for (Function *curr = functions; curr != NULL; curr = curr->next){
+        if (strcmp(curr->name, name) == 0){
+            return curr;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Adds a function to the table, replacing any with the same name
+ *
+ * @param function: the function, which gains a reference from the table
+ */
+static void define_function(Function *function){
+    Function **link = &functions;
+    while (*link != NULL && strcmp((*link)->name, function->name) != 0){
+        link = &(*link)->next;
+    }
+    if (*link == function){
+        return; // already defined by this very statement
+    }
+    function->refs++;
+    if (*link != NULL){
+        Function *old = *link;
+        *link = old->next;
+        release_function(old);
+    }
+    function->next = functions;
+    functions = function;
+    // lines naming it may have resolved to a program before
+    variable_generation++;
+}
+
+int call_function(Command *command){
+    Function *function = find_function(command->args[0]);
+    if (function == NULL){
+        return -1;
+    }
+    if (function_depth >= MAX_FUNCTION_DEPTH){
+        ERR_PRINT(ERR_FUNC_DEPTH, MAX_FUNCTION_DEPTH, function->name);
+        return -1;
+    }
+
+    // keep the body alive even if it redefines itself while running
+    function->refs++;
+    function_depth++;
+    char **saved_params = positional_params;
+    positional_params = command->args;
+
+    int status = execute_statements(function->body, command->variables);
+
+    positional_params = saved_params;
+    function_depth--;
+    release_function(function);
+    return status;
+}
+
+void free_functions(void){
+    while (functions != NULL){
+        Function *next = functions->next;
+        release_function(functions);
+        functions = next;
+    }
+}
+
+Statement *parse_statements(const char *text, Variable **variables){
+    char *copy = mem_strdup(text, MEM_PARSE);
+    if (copy == NULL){
+        perror("parse_statements");
+        return (Statement *) -1;
+    }
+
+    // here-document bodies follow the whole text
+    char *bodies = strchr(copy, '\n');
+    if (bodies != NULL){
+        *bodies++ = '\0';
+    }
+
+    int num = 0;
+    char **segs = split_segments(copy, &num);
+    char **attached = segs != NULL ?
+        mem_calloc(num, sizeof(char *), MEM_PARSE) : NULL;
+    if (attached == NULL){
+        if (segs != NULL) perror("parse_statements");
+        mem_free(segs);
+        mem_free(copy);
+        return (Statement *) -1;
+    }
+
+    Statement *statements = (Statement *) -1;
+    if (attach_here_docs(segs, num, bodies, attached) == 0){
+        int i = 0;
+        uint64_t trace_start = TRACE_START();
+        statements = parse_list(segs, num, &i, variables, NULL);
+        TRACE_END("parse", trace_start, getpid(), text);
+    }
+
+    for (int k = 0; k < num; k++){
+        mem_free(attached[k]);
+    }
+    mem_free(attached);
+    mem_free(segs);
+    mem_free(copy);
+    return statements;
+}
+
+/**
+ * @brief Executes a single statement (running a loop entirely).
+ *
+ * @param stmt: the statement
+ * @param variables: the variable list
+ * @return int: the exit code of the statement, -1 on error
+ */
+static int execute_statement(Statement *stmt, Variable **variables){
+    int status = 0;
+
+    if (stmt->kind == STMT_ASSIGN){
+        char *line = stmt->text;
+        if (stmt->needs_expand){
+            line = replace_variables_mk_line(stmt->text, *variables);
+            if (line == NULL || line == (char *) -1){
+                ERR_PRINT(ERR_PARSING_LINE);
+                return -1;
+            }
+        }
+        status = retrieve_variable(line, variables, strchr(line, '=') - line);
+        if (line != stmt->text){
+            mem_free(line);
+        }
+        if (status < 0){
+            ERR_PRINT(ERR_PARSING_LINE);
+        }
+        return status;
+    }
+
+    if (stmt->kind == STMT_PIPELINE){
+        Command *commands = stmt->commands;
+        if (commands == NULL){
+            commands = parse_line(stmt->text, variables);
+            if (commands == NULL){
+                return 0;
+            }
+            if (commands == (Command *) -1){
+                ERR_PRINT(ERR_PARSING_LINE);
+                return -1;
+            }
+        }
+        else if (stmt->needs_expand){
+            uint64_t trace_start = TRACE_START();
+            commands = expand_commands(stmt->commands, variables);
+            TRACE_END("expand", trace_start, getpid(), stmt->commands->args[0]);
+            if (commands == (Command *) -1){
+                ERR_PRINT(ERR_PARSING_LINE);
+                return -1;
+            }
+        }
+
+        int *ret_code_pt = execute_line(commands);
+        if (commands != stmt->commands){
+            free_command(commands);
+        }
+        if (ret_code_pt == NULL || ret_code_pt == (int *) -1){
+            ERR_PRINT(ERR_EXECUTE_LINE);
+            return -1;
+        }
+        status = *ret_code_pt;
+        mem_free(ret_code_pt);
+        return status;
+    }
+
+    if (stmt->kind == STMT_FOR){
+        char *items = stmt->items;
+        if (stmt->needs_expand){
+            items = replace_variables_mk_line(stmt->items, *variables);
+            if (items == NULL || items == (char *) -1){
+                ERR_PRINT(ERR_PARSING_LINE);
+                return -1;
+            }
+        }
+        else {
+            items = mem_strdup(stmt->items, MEM_EXECUTION);
+        }
+
+        // braces are expanded as the loop goes, never as a whole list
+        char *toksave;
+        uint8_t failed = 0;
+        GlobCache cache = {NULL};
+        for (char *item = strtok_r(items, " \t", &toksave); item != NULL && !failed;
+             item = strtok_r(NULL, " \t", &toksave)){
+            BraceIter iter;
+            if (brace_iter_init(&iter, item) < 0){
+                status = -1;
+                break;
+            }
+            const char *word;
+            while (!failed && (word = brace_iter_next(&iter)) != NULL){
+                // a pattern loops over its matches, listed as the loop
+                // reaches it
+                char **matches = expand_glob_word(word, &cache);
+                if (matches == NULL){
+                    status = -1;
+                    failed = 1;
+                    break;
+                }
+                for (int k = 0; matches[k] != NULL && !failed; k++){
+                    if (set_variable(variables, stmt->text, matches[k]) < 0){
+                        status = -1;
+                        failed = 1;
+                        break;
+                    }
+                    status = execute_statements(stmt->body, variables);
+                }
+                for (int k = 0; matches[k] != NULL; k++){
+                    mem_free(matches[k]);
+                }
+                mem_free(matches);
+            }
+            free_brace_iter(&iter);
+        }
+        free_glob_cache(&cache);
+        mem_free(items);
+        return status;
+    }
+
+    if (stmt->kind == STMT_FUNCTION){
+        define_function(stmt->function);
+        return 0;
+    }
+
+    // STMT_WHILE
+    while (execute_statement(stmt->cond, variables) == 0){
+        status = execute_statements(stmt->body, variables);
+    }
+    return status;
+}
+
+int execute_statements(Statement *stmt, Variable **variables){
+    int status = 0;
+    for (; stmt != NULL; stmt = stmt->next){
+        status = execute_statement(stmt, variables);
+    }
+    return status;
+}
+
+void free_statement(Statement *stmt){
+    while (stmt != NULL && stmt != (Statement *) -1){
+        Statement *next = stmt->next;
+        mem_free(stmt->text);
+        mem_free(stmt->items);
+        free_command(stmt->commands);
+        free_statement(stmt->cond);
+        free_statement(stmt->body);
+        release_function(stmt->function);
+        mem_free(stmt);
+        stmt = next;
+    }
+}
@@ -0,0 +1,292 @@
+/*****************************************************************************/
+/*                           CSC209-24s A3 CSCSHELL                          */
+/*       Copyright 2024 -- Demetres Kostas PhD (aka Darlene Heliokinde)      */
+/*****************************************************************************/
+
+#include "cscshell.h"
+
+
+/*
+** Buffered readers of seekable fds. Bytes read ahead but not yet handed
+** out are given back with lseek (sync_fd_readers) before anything else can
+** read the fd, so children and later opens see the right offset.
+*/
+static FdReader *readers = NULL;
+
+// Pipes are peeked by tee-ing them into this one, without consuming them
+static int peek_pipe[2] = {-1, -1};
+
+// A stdio stream of an fd's lines, each read with read_record
+typedef struct RecordStream {
+    int fd;
+    ExpandBuffer line;  // the current line, with its newline
+    size_t taken;       // how much of it stdio has had
+} RecordStream;
+
+
+/* HELPERS */
+
+/**
+ * @brief Finds the reader for fd
+ *
+ * @return FdReader*: the reader, NULL if fd has none
+ */
+static FdReader *find_reader(int fd){
+    for (FdReader *curr = readers; curr != NULL; curr = curr->next){
+        if (curr->fd == fd){
+            return curr;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Finds the reader for fd, making one if it's new
+ *
+ * @return FdReader*: the reader, NULL on error
+ */
+static FdReader *get_reader(int fd){
+    FdReader *reader = find_reader(fd);
+    if (reader != NULL){
+        return reader;
+    }
+
+    reader = mem_calloc(1, sizeof(FdReader), MEM_EXECUTION);
+    if (reader == NULL ||
+        (reader->buf = mem_alloc(FD_READER_BUF, MEM_EXECUTION)) == NULL){
+        perror("read");
+        mem_free(reader);
+        return NULL;
+    }
+    reader->fd = fd;
+    reader->next = readers;
+    readers = reader;
+    return reader;
+}
+
+/**
+ * @brief Reads a record from a seekable fd through its buffer
+ */
+static int read_buffered(FdReader *reader, char delim, ExpandBuffer *record){
+    int fd = reader->fd;
+    while (1){
+        char *start = reader->buf + reader->start;
+        size_t available = reader->end - reader->start;
+        char *found = memchr(start, delim, available);
+        if (found != NULL){
+            reader->start += found - start + 1;
+            return expand_buffer_append(record, start, found - start) < 0 ? -1 : 1;
+        }
+        if (expand_buffer_append(record, start, available) < 0){
+            return -1;
+        }
+
+        ssize_t got;
+        do {
+            got = read(fd, reader->buf, FD_READER_BUF);
+        } while (got < 0 && errno == EINTR);
+        reader->start = 0;
+        reader->end = got < 0 ? 0 : got;
+        if (got <= 0){
+            if (got < 0) perror("read");
+            return got < 0 ? -1 : 0;
+        }
+    }
+}
+
+/**
+ * @brief Reads a record from a pipe, consuming no more than the record
+ * itself. Returns -2 if fd can't be peeked at (it's not a pipe).
+ */
+static int read_peeked(int fd, char delim, ExpandBuffer *record){
+    if (peek_pipe[0] < 0 && pipe2(peek_pipe, O_CLOEXEC) < 0){
+        return -2;
+    }
+
+    char chunk[FD_READER_BUF];
+    while (1){
+        // blocks until there is data (or EOF), like read would
+        ssize_t copied = tee(fd, peek_pipe[1], FD_READER_BUF, 0);
+        if (copied < 0){
+            if (errno == EINTR) continue;
+            return errno == EINVAL && record->len == 0 ? -2 : -1;
+        }
+        if (copied == 0){
+            return 0;
+        }
+
+        ssize_t peeked = read(peek_pipe[0], chunk, copied);
+        if (peeked != copied){
+            perror("read");
+            return -1;
+        }
+        char *found = memchr(chunk, delim, copied);
+        size_t wanted = found == NULL ? copied : found - chunk + 1;
+
+        // now take exactly what we're going to use
+        ssize_t got;
+        do {
+            got = read(fd, chunk, wanted);
+        } while (got < 0 && errno == EINTR);
+        if (got != wanted){
+            perror("read");
+            return -1;
+        }
+        if (expand_buffer_append(record, chunk, found == NULL ? wanted : wanted - 1) < 0){
+            return -1;
+        }
+        if (found != NULL){
+            return 1;
+        }
+    }
+}
+
+/**
+ * @brief Reads a record a byte at a time, for fds that are neither
+ * seekable nor pipes (terminals, sockets)
+ */
+static int read_bytewise(int fd, char delim, ExpandBuffer *record){
+    char c;
+    while (1){
+        ssize_t got = read(fd, &c, 1);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0){
+            if (got < 0) perror("read");
+            return got < 0 ? -1 : 0;
+        }
+        if (c == delim){
+            return 1;
+        }
+        if (expand_buffer_append(record, &c, 1) < 0){
+            return -1;
+        }
+    }
+}
+
+/**
+ * @brief Gives back what reader holds but hasn't handed out, and drops it
+ *
+ * @param link: the link in the readers list that points to reader
+ */
+static void sync_reader(FdReader **link){
+    FdReader *reader = *link;
+    off_t unread = reader->end - reader->start;
+    if (unread > 0){
+        lseek(reader->fd, -unread, SEEK_CUR);
+    }
+    *link = reader->next;
+    mem_free(reader->buf);
+    mem_free(reader);
+}
+
+/**
+ * @brief Gives stdio the rest of the current line, reading the next one when
+ * it's all been taken. stdio never gets ahead of the line that runs.
+ *
+ * @return ssize_t: the bytes given, 0 at EOF, -1 on error
+ */
+static ssize_t record_stream_read(void *cookie, char *buf, size_t size){
+    RecordStream *stream = cookie;
+    if (stream->taken == stream->line.len){
+        stream->line.len = 0;
+        stream->taken = 0;
+        int found = read_record(stream->fd, '\n', &stream->line);
+        if (found < 0 || (found == 1 && expand_buffer_append(&stream->line, "\n", 1) < 0)){
+            return -1;
+        }
+    }
+    size_t n = stream->line.len - stream->taken;
+    n = n < size ? n : size;
+    memcpy(buf, stream->line.data + stream->taken, n);
+    stream->taken += n;
+    return n;
+}
+
+static int record_stream_close(void *cookie){
+    RecordStream *stream = cookie;
+    mem_free(stream->line.data);
+    mem_free(stream);
+    return 0;
+}
+
+
+/* SHELL EXTENSION FUNCTIONS */
+
+int read_record(int fd, char delim, ExpandBuffer *record){
+    // only seekable fds get a reader, so one that has is known to be
+    FdReader *reader = find_reader(fd);
+    if (reader == NULL && lseek(fd, 0, SEEK_CUR) >= 0){
+        reader = get_reader(fd);
+        if (reader == NULL){
+            return -1;
+        }
+    }
+    if (reader != NULL){
+        return read_buffered(reader, delim, record);
+    }
+    int found = read_peeked(fd, delim, record);
+    if (found == -2){
+        found = read_bytewise(fd, delim, record);
+    }
+    return found;
+}
+
+void sync_fd_readers(void){
+    while (readers != NULL){
+        sync_reader(&readers);
+    }
+}
+
+void sync_fd_reader(int fd){
+    for (FdReader **link = &readers; *link != NULL; link = &(*link)->next){
+        if ((*link)->fd == fd){
+            sync_reader(link);
+            return;
+        }
+    }
+}
+
+void sync_inherited_fd_readers(int child_stdin){
+    FdReader **link = &readers;
+    while (*link != NULL){
+        int fd = (*link)->fd;
+        int flags = fcntl(fd, F_GETFD);
+        // 0 and 1 are the child's stdin and stdout, whatever they were here;
+        // a reader whose fd was closed is dropped as well
+        uint8_t inherited = fd == child_stdin || flags < 0 ||
+            (fd != STDIN_FILENO && fd != STDOUT_FILENO && !(flags & FD_CLOEXEC));
+        if (inherited){
+            sync_reader(link);
+        }
+        else {
+            link = &(*link)->next;
+        }
+    }
+}
+
+void forget_fd_readers(void){
+    while (readers != NULL){
+        FdReader *next = readers->next;
+        mem_free(readers->buf);
+        mem_free(readers);
+        readers = next;
+    }
+}
+
+FILE *open_record_stream(int fd){
+    RecordStream *stream = mem_calloc(1, sizeof(RecordStream), MEM_EXECUTION);
+    if (stream == NULL || expand_buffer_init(&stream->line, MAX_SINGLE_LINE) < 0){
+        perror("open_record_stream");
+        mem_free(stream);
+        return NULL;
+    }
+    stream->fd = fd;
+
+    cookie_io_functions_t io = {record_stream_read, NULL, NULL, record_stream_close};
+    FILE *file = fopencookie(stream, "r", io);
+    if (file == NULL){
+        perror("open_record_stream");
+        record_stream_close(stream);
+    }
+    return file;
+}
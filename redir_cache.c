@@ -0,0 +1,101 @@
+/*****************************************************************************/
+/*                           CSC209-24s A3 CSCSHELL                          */
+/*       Copyright 2024 -- Demetres Kostas PhD (aka Darlene Heliokinde)      */
+/*****************************************************************************/
+
+#include "cscshell.h"
+
+
+/*
+** Files appended to (>>) stay open in the shell between lines. Every
+** write to an O_APPEND fd goes to the end of the file whoever else writes
+** or truncates it, so one open file can be shared by every command that
+** appends there. A hit only stats the path, to check it still names the
+** file we hold open (and not one that was moved away or deleted and
+** created again), and dups the fd.
+*/
+
+typedef struct RedirEntry {
+    char *path;
+    int flags;
+    int fd;
+    dev_t dev;
+    ino_t ino;
+    uint64_t last_used;
+} RedirEntry;
+
+static RedirEntry redir_entries[REDIR_CACHE_SIZE];
+static uint64_t redir_clock = 0;
+
+
+/* HELPERS */
+
+static void drop_entry(RedirEntry *entry){
+    if (entry->path != NULL){
+        close(entry->fd);
+        mem_free(entry->path);
+        entry->path = NULL;
+    }
+}
+
+/**
+ * @brief Finds the entry for path and flags, or the one to reuse for them:
+ * an empty one, else the least recently used
+ */
+static RedirEntry *find_entry(const char *path, int flags){
+    RedirEntry *victim = &redir_entries[0];
+    for (int i = 0; i < REDIR_CACHE_SIZE; i++){
+        RedirEntry *entry = &redir_entries[i];
+        if (entry->path != NULL && entry->flags == flags &&
+            strcmp(entry->path, path) == 0){
+            return entry;
+        }
+        if (victim->path != NULL &&
+            (entry->path == NULL || entry->last_used < victim->last_used)){
+            victim = entry;
+        }
+    }
+    return victim;
+}
+
+
+/* SHELL EXTENSION FUNCTIONS */
+
+int redir_cache_open(const char *path, int flags, mode_t mode){
+    RedirEntry *entry = find_entry(path, flags);
+    if (entry->path != NULL && strcmp(entry->path, path) == 0 &&
+        entry->flags == flags){
+        struct stat info;
+        if (stat(path, &info) == 0 && info.st_dev == entry->dev &&
+            info.st_ino == entry->ino){
+            entry->last_used = ++redir_clock;
+            return fcntl(entry->fd, F_DUPFD_CLOEXEC, 0);
+        }
+    }
+    drop_entry(entry);
+
+    int fd = open(path, flags | O_CLOEXEC, mode);
+    if (fd < 0){
+        return -1;
+    }
+    struct stat info;
+    char *copy = mem_strdup(path, MEM_EXECUTION);
+    // a pipe held open would never see its writers go; only files are kept
+    if (copy == NULL || fstat(fd, &info) < 0 || !S_ISREG(info.st_mode)){
+        mem_free(copy);
+        return fd;
+    }
+    entry->path = copy;
+    entry->flags = flags;
+    entry->fd = fd;
+    entry->dev = info.st_dev;
+    entry->ino = info.st_ino;
+    entry->last_used = ++redir_clock;
+    return fcntl(fd, F_DUPFD_CLOEXEC, 0);
+}
+
+void redir_cache_clear(void){
+    for (int i = 0; i < REDIR_CACHE_SIZE; i++){
+        drop_entry(&redir_entries[i]);
+    }
+}
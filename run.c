@@ -4,6 +4,7 @@
 /*****************************************************************************/
 
 #include "cscshell.h"
+#include <sys/mman.h>
 
 
 // COMPLETE
@@ -26,35 +27,47 @@ int cd_cscshell(const char *target_dir){
         perror("cd_cscshell");
         return -1;
     }
+    // relative PATH entries now point somewhere else
+    variable_generation++;
     return 0;
 }
 
 
 int *execute_line(Command *head){
-    #ifdef DEBUG
-    printf("\n***********************\n");
-    printf("BEGIN: Executing line...\n");
-    #endif
-    int *exit_code = malloc(sizeof(int));
+    int *exit_code = mem_alloc(sizeof(int), MEM_EXECUTION);
     *exit_code = 0;
     pid_t pid;
-    int *pid_list = NULL;
-    int num_pids = 0;
      
     Command * curr = head;
     if (curr == NULL){
-        free(exit_code);
+        mem_free(exit_code);
         return NULL;
     }
+    else if (exceeds_arg_max(head)){
+        // refused before anything starts, rather than by execv in a child
+        *exit_code = ARG_TOO_LONG_STATUS;
+        return exit_code;
+    }
+    else if (needs_fanout(head)){
+        mem_free(exit_code);
+        return execute_fanout(head);
+    }
     else if (curr->next == NULL){
-        // check for cd explicitly
-        
-        if (strcmp(curr->args[0], "cd") == 0){\
-            pid = cd_cscshell(curr->args[1]);
-            *exit_code= pid;
+        // functions run in the shell itself, unless their output or input
+        // is redirected, in which case they get a child like any command
+        if (find_function(curr->args[0]) != NULL && curr->redir_in_path == NULL &&
+            curr->redir_out_path == NULL && curr->here_doc == NULL){
+            *exit_code = call_function(curr);
+            return exit_code;
+        }
+
+        // builtins (including cd) run in the shell itself
+        if (find_builtin(curr->args[0]) != NULL){
+            *exit_code = run_builtin(curr, NULL);
             return exit_code;
         }
         else{
+            pin_stage(0, 1);
             pid = run_command(curr);
             if (pid == -1) {
                 // Handle fork error
@@ -64,7 +77,7 @@ int *execute_line(Command *head){
             else {
                 // Wait for the child process to terminate
                 int status;
-                if (waitpid(pid, &status, 0) == -1) {
+                if (wait_child(pid, &status) == -1) {
                     perror("waitpid");
                     // Handle waitpid error
                     *exit_code = -1;
@@ -82,66 +95,114 @@ int *execute_line(Command *head){
         
     }
     else{
-        while (curr != NULL){
-            // if we are not the last command, we need to make any more pipes.
-            if (curr->next != NULL){
-                int fd[2];
-                if (pipe(fd) == -1) {
-                    perror("pipe");
+        int num_stages = 0;
+        for (Command *stage = head; stage != NULL; stage = stage->next){
+            num_stages++;
+        }
+        pid_t *pid_list = mem_alloc(sizeof(pid_t) * num_stages, MEM_EXECUTION);
+        if (pid_list == NULL){
+            perror("execute_line");
+            *exit_code = -1;
+            return exit_code;
+        }
+
+        int num_pids = start_pipeline(head, pid_list);
+        *exit_code = num_pids < 0 ? -1 : wait_pipeline(pid_list, num_pids);
+        mem_free(pid_list);
+        return exit_code;    
+    }
+
+    return NULL;
+}
+
+int start_pipeline(Command *head, pid_t *pids){
+    int num_stages = 0;
+    for (Command *stage = head; stage != NULL; stage = stage->next){
+        num_stages++;
+    }
+
+    int num_pids = 0;
+    for (Command *curr = head; curr != NULL; curr = curr->next){
+        // if we are not the last command, we need to make any more pipes.
+        // Close on exec: a child only keeps the two ends dup'd onto 0 and 1.
+        if (curr->next != NULL){
+            int fd[2];
+            if (pipe2(fd, O_CLOEXEC) == -1) {
+                perror("pipe");
+                if (curr->stdin_fd != STDIN_FILENO){
+                    close(curr->stdin_fd);
                 }
-                curr->next->stdin_fd = fd[0];
-                curr->stdout_fd = fd[1];
-            }
-            
-            pid = run_command(curr);
-            if (pid == -1) {
-                // Handle fork error
-                *exit_code = -1;
-                return exit_code;
-            } 
-            num_pids++;
-            pid_list = realloc(pid_list, num_pids);
-            pid_list[num_pids - 1] = pid;
-            curr = curr->next;
-        }
-
-        #ifdef DEBUG
-            printf("All children created\n");
-        #endif
-
-        int status;
-        for (int i = 0; i < num_pids; i++){
-            // Wait for the child process to terminate
-            
-            if (waitpid(pid_list[i], &status, 0) == -1) {
-                perror("waitpid");
-                // Handle waitpid error
-                *exit_code = -1;
-                return exit_code;
-            }   
-            if (WEXITSTATUS(status) == -1){
-                ERR_PRINT(ERR_EXECUTE_LINE);
-                *exit_code = -1;
-                return exit_code;
+                return -1;
             }
+            curr->next->stdin_fd = fd[0];
+            curr->stdout_fd = fd[1];
+        }
+
+        // placement failures are reported, but the pipeline still runs
+        pin_stage(num_pids, num_stages);
+        pid_t pid = run_command(curr);
+        if (pid == -1) {
+            // Handle fork error
+            return -1;
+        } 
+        pids[num_pids++] = pid;
+    }
+    return num_pids;
+}
 
+int wait_pipeline(pid_t *pids, int num_pids){
+    int status = 0;
+    for (int i = 0; i < num_pids; i++){
+        // Wait for the child process to terminate
+        if (wait_child(pids[i], &status) == -1) {
+            perror("waitpid");
+            return -1;
+        }   
+        if (WEXITSTATUS(status) == -1){
+            ERR_PRINT(ERR_EXECUTE_LINE);
+            return -1;
         }
-        *exit_code = WEXITSTATUS(status);
-        #ifdef DEBUG
-        printf("All children finished\n");
-        #endif
-        free(head);
-        return exit_code;    
     }
+    return WEXITSTATUS(status);
+}
 
-    #ifdef DEBUG
-    printf("END: Executing line...\n");
-    printf("***********************\n\n");
-    #endif
 
-    return NULL;
-}
+/**
+ * @brief Puts a here-document into a sealed, in-memory file, so a child can
+ * read it as stdin without touching the filesystem or blocking on a pipe.
+ * 
+ * @param content: the here-document text
+ * @return int: a read-only fd positioned at the start, -1 on error
+ */
+int open_here_doc(const char *content){
+    int doc_fd = memfd_create(HERE_DOC_MEMFD_NAME, MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (doc_fd < 0){
+        perror("memfd_create");
+        return -1;
+    }
+
+    size_t remaining = strlen(content);
+    while (remaining > 0){
+        ssize_t written = write(doc_fd, content, remaining);
+        if (written < 0){
+            if (errno == EINTR) continue;
+            perror("open_here_doc");
+            close(doc_fd);
+            return -1;
+        }
+        content += written;
+        remaining -= written;
+    }
 
+    if (fcntl(doc_fd, F_ADD_SEALS,
+              F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) < 0 ||
+        lseek(doc_fd, 0, SEEK_SET) < 0){
+        perror("open_here_doc");
+        close(doc_fd);
+        return -1;
+    }
+    return doc_fd;
+}
 
 /*
 ** Forks a new process and execs the command
@@ -151,29 +212,25 @@ int *execute_line(Command *head){
 ** Any child processes should not return.
 */
 int run_command(Command *command){
-    #ifdef DEBUG
-    printf("Running command: %s\n", command->exec_path);
-    printf("Argvs: ");
-    if (command->args == NULL){
-        printf("NULL\n");
-    }
-    else if (command->args[0] == NULL){
-        printf("Empty\n");
-    }
-    else {
-        for (int i=0; command->args[i] != NULL; i++){
-            printf("%d: [%s] ", i+1, command->args[i]);
-        }
+    // the child must find stdin where read left off, not where it buffered to
+    uint8_t stdin_replaced = command->redir_in_path != NULL ||
+                             command->here_doc != NULL;
+    sync_inherited_fd_readers(stdin_replaced ? -1 : command->stdin_fd);
+
+    // appends are opened here, so the shell's cache of them stays filled
+    int out_fd = -1;
+    if (command->redir_out_path != NULL && command->redir_append){
+        out_fd = open_redirect_out(command);
     }
-    printf("\n");
-    printf("Redir out: %s\n Redir in: %s\n",
-           command->redir_out_path, command->redir_in_path);
-    printf("Stdin fd: %d | Stdout fd: %d\n",
-           command->stdin_fd, command->stdout_fd);
-    #endif
-    
+
+    uint64_t trace_start = TRACE_START();
     int pid = fork();
+    if (pid != 0){
+        clear_stage_pin();
+    }
     if (pid > 0) {
+        session_stats.forks++;
+        TRACE_END("fork", trace_start, pid, command->exec_path);
         if (command->stdin_fd != STDIN_FILENO){
             close(command->stdin_fd);
         }
@@ -181,8 +238,13 @@ int run_command(Command *command){
         if (command->stdout_fd != STDOUT_FILENO){
             close(command->stdout_fd);
         }
+        if (out_fd >= 0){
+            close(out_fd);
+        }
 
     } else if (pid == 0) {
+        trace_start = TRACE_START();
+        forget_fd_readers();
         if (command->stdin_fd != STDIN_FILENO){
             dup2(command->stdin_fd, STDIN_FILENO);
             close(command->stdin_fd);
@@ -198,110 +260,612 @@ int run_command(Command *command){
             close(in_fd);
         }
 
+        if (command->here_doc != NULL){
+            int doc_fd = open_here_doc(command->here_doc);
+            if (doc_fd < 0){
+                _exit(1);
+            }
+            dup2(doc_fd, STDIN_FILENO);
+            close(doc_fd);
+        }
+
         if (command->redir_out_path != NULL){
-            if(command->redir_append == 1){
-                int out_fd = open(command->redir_out_path, O_APPEND);
-                dup2(out_fd, STDOUT_FILENO);
-                close(out_fd);
+            // an append that failed in the shell has been reported already
+            if (!command->redir_append){
+                out_fd = open_redirect_out(command);
             }
-            else{
-                int out_fd = open(command->redir_out_path, O_WRONLY);
-                dup2(out_fd, command->stdout_fd);
-                close(out_fd);
+            if (out_fd < 0){
+                _exit(1);
             }
+            dup2(out_fd, STDOUT_FILENO);
+            close(out_fd);
+        }
+
+        if (apply_child_limits() < 0){
+            _exit(1);
+        }
+        apply_stage_pin();
+
+        if (find_function(command->args[0]) != NULL){
+            fflush(stdout);
+            int status = call_function(command);
+            fflush(stdout);
+            _exit(status);
+        }
+
+        if (find_builtin(command->args[0]) != NULL){
+            // every redirection is in place on 0 and 1 already
+            command->stdin_fd = STDIN_FILENO;
+            command->stdout_fd = STDOUT_FILENO;
+            command->redir_in_path = NULL;
+            command->redir_out_path = NULL;
+            command->here_doc = NULL;
+            _exit(run_builtin(command, NULL));
         }
         
+        // covers the child's fd and limit setup, up to the exec itself
+        TRACE_END("exec", trace_start, getpid(), command->exec_path);
         execv(command->exec_path, command->args);
+        perror("run_command");
+        _exit(EXEC_FAILED_STATUS);
     } else {
         perror("fork");
         return -1;
     }
 
-    #ifdef DEBUG
-    //printf("Parent process created child PID [%d] for %s\n", pid, command->exec_path);
-    #endif
     return pid;
 }
 
+static int run_line_traced(char *line, Variable **root, int *last_status);
+
+uint8_t tail_exec = 0;
+
+// Set by run_stream for the last line of its stream, and taken (cleared)
+// by the run_line that runs it, so nothing that line runs in turn sees it
+static uint8_t on_last_line = 0;
+
+int open_redirect_out(Command *command){
+    int flags = O_WRONLY | O_CREAT;
+    flags |= command->redir_append ? O_APPEND : O_TRUNC;
+    int out_fd = command->redir_append ?
+                 redir_cache_open(command->redir_out_path, flags, 0644) :
+                 open(command->redir_out_path, flags, 0644);
+    if (out_fd < 0){
+        perror(command->redir_out_path);
+    }
+    return out_fd;
+}
+
+int exec_in_place(char *exec_path, char **args, int in_fd, int out_fd){
+    // the new image must start where the shell's own reads and writes got to
+    fflush(stdout);
+    sync_fd_readers();
+    if (in_fd != STDIN_FILENO && dup2(in_fd, STDIN_FILENO) < 0){
+        perror("exec");
+        return -1;
+    }
+    if (out_fd != STDOUT_FILENO && dup2(out_fd, STDOUT_FILENO) < 0){
+        perror("exec");
+        return -1;
+    }
+    if (args == NULL){
+        return 0;
+    }
+
+    if (apply_child_limits() < 0){
+        return -1;
+    }
+    execv(exec_path, args);
+    perror(exec_path);
+    return -1;
+}
+
+/**
+ * @brief Runs the last line of a script as the shell itself, when it is a
+ * single program (not a builtin or function) with no fan-out: there is
+ * nothing left for the shell to do once it exits.
+ *
+ * @return int: -1 if it exec'd and failed, 0 if it can't be exec'd (or
+ * its redirections couldn't be opened) and should run as usual
+ */
+static int tail_exec_line(Command *commands){
+    if (commands->next != NULL || commands->tee_next != NULL ||
+        commands->more_out != NULL || commands->exec_path == NULL ||
+        find_builtin(commands->args[0]) != NULL ||
+        find_function(commands->args[0]) != NULL){
+        return 0;
+    }
+
+    // everything is opened before any fd moves, so a failure leaves the
+    // shell as it was
+    int in_fd = STDIN_FILENO;
+    int out_fd = STDOUT_FILENO;
+    if (commands->here_doc != NULL){
+        in_fd = open_here_doc(commands->here_doc);
+    }
+    else if (commands->redir_in_path != NULL){
+        in_fd = open(commands->redir_in_path, O_RDONLY | O_CLOEXEC);
+    }
+    if (commands->redir_out_path != NULL && in_fd >= 0){
+        out_fd = open_redirect_out(commands);
+    }
+    if (in_fd < 0 || out_fd < 0){
+        if (in_fd > STDIN_FILENO) close(in_fd);
+        return 0;
+    }
+
+    exec_in_place(commands->exec_path, commands->args, in_fd, out_fd);
+    return -1;
+}
+
+/**
+ * @brief Runs a list of commands with the stdout of the last one going into
+ * a pipe, reading everything from it into out as it arrives.
+ * 
+ * @param head: the first command
+ * @param out: the buffer the output is appended to
+ * @return int: the exit code of the last command, -1 on error
+ */
+static int capture_line(Command *head, ExpandBuffer *out){
+    if (exceeds_arg_max(head)){
+        return ARG_TOO_LONG_STATUS;
+    }
+    int num_commands = 0;
+    for (Command *curr = head; curr != NULL; curr = curr->next){
+        num_commands++;
+    }
+    pid_t *pid_list = mem_alloc(sizeof(pid_t) * num_commands, MEM_EXECUTION);
+    if (pid_list == NULL){
+        perror("capture_line");
+        return -1;
+    }
+
+    // The read end must not leak into the children, or we never see EOF
+    int capture_fd[2];
+    if (pipe2(capture_fd, O_CLOEXEC) == -1){
+        perror("pipe");
+        mem_free(pid_list);
+        return -1;
+    }
+
+    int num_pids = 0;
+    for (Command *curr = head; curr != NULL; curr = curr->next){
+        if (curr->next != NULL){
+            int fd[2];
+            if (pipe2(fd, O_CLOEXEC) == -1) {
+                perror("pipe");
+                break;
+            }
+            curr->next->stdin_fd = fd[0];
+            curr->stdout_fd = fd[1];
+        }
+        else {
+            curr->stdout_fd = capture_fd[1];
+        }
+
+        pid_t pid = run_command(curr);
+        if (pid == -1){
+            break;
+        }
+        pid_list[num_pids++] = pid;
+    }
+    if (num_pids < num_commands){
+        // run_command only closes the write end once it forks
+        close(capture_fd[1]);
+    }
+
+    // read straight into the spare room at the end of the buffer
+    while (1){
+        if (out->cap - out->len - 1 < CAPTURE_READ_CHUNK){
+            if (expand_buffer_reserve(out, CAPTURE_READ_CHUNK) < 0){
+                close(capture_fd[0]);
+                mem_free(pid_list);
+                return -1;
+            }
+        }
+        ssize_t n = read(capture_fd[0], out->data + out->len,
+                         out->cap - out->len - 1);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        out->len += n;
+    }
+    out->data[out->len] = '\0';
+    close(capture_fd[0]);
+
+    int status = 0;
+    for (int i = 0; i < num_pids; i++){
+        if (wait_child(pid_list[i], &status) == -1){
+            perror("waitpid");
+        }
+    }
+    mem_free(pid_list);
+    if (num_pids < num_commands){
+        return -1;
+    }
+    return WEXITSTATUS(status);
+}
+
+/**
+ * @brief Copies a variable list, in order
+ *
+ * @return Variable*: the copy, -1 cast as a (Variable *) on error
+ */
+static Variable *copy_variables(Variable *variables){
+    Variable *head = NULL;
+    Variable **tail = &head;
+    for (Variable *curr = variables; curr != NULL; curr = curr->next){
+        Variable *copy = mem_alloc(sizeof(Variable), MEM_VARIABLES);
+        if (copy == NULL){
+            perror("copy_variables");
+            free_variable(head, NON_ZERO_BYTE);
+            return (Variable *) -1;
+        }
+        copy->name = mem_strdup(curr->name, MEM_VARIABLES);
+        copy->value = mem_strdup(curr->value, MEM_VARIABLES);
+        copy->next = NULL;
+        *tail = copy;
+        tail = &copy->next;
+        if (copy->name == NULL || copy->value == NULL){
+            perror("copy_variables");
+            free_variable(head, NON_ZERO_BYTE);
+            return (Variable *) -1;
+        }
+    }
+    return head;
+}
+
+int capture_command(const char *text, Variable *variables, ExpandBuffer *out){
+    // assignments inside a substitution don't leak out of it: it gets a copy
+    Variable *vars = copy_variables(variables);
+    if (vars == (Variable *) -1){
+        return -1;
+    }
+    Command *commands = parse_line((char *) text, &vars);
+    if (commands == NULL || commands == (Command *) -1){
+        free_variable(vars, NON_ZERO_BYTE);
+        return commands == NULL ? 0 : -1;
+    }
+
+    size_t start = out->len;
+    int status;
+    if (commands->next == NULL && find_builtin(commands->args[0]) != NULL &&
+        commands->redir_out_path == NULL && commands->redir_in_path == NULL &&
+        commands->here_doc == NULL){
+        status = run_builtin(commands, out);
+    }
+    else {
+        status = capture_line(commands, out);
+    }
+    free_command(commands);
+    free_variable(vars, NON_ZERO_BYTE);
+    if (out->data == NULL){
+        return -1;
+    }
+
+    while (out->len > start && out->data[out->len - 1] == '\n'){
+        out->data[--out->len] = '\0';
+    }
+    return status;
+}
+
+int run_line(char *line, Variable **root, int *last_status){
+    trace_next_line();
+    uint64_t trace_start = TRACE_START();
+    int line_error = run_line_traced(line, root, last_status);
+    TRACE_END("line", trace_start, getpid(), line);
+    // a line that never ran still failed: -c, scripts and --serve see it
+    if (line_error == -1){
+        *last_status = LINE_FAILED_STATUS;
+    }
+    return line_error;
+}
+
+/**
+ * @brief The body of run_line, so the whole line can be traced
+ */
+static int run_line_traced(char *line, Variable **root, int *last_status){
+    uint8_t last_line = on_last_line;
+    on_last_line = 0;
+    if (is_compound_line(line)){
+        Statement *statements = parse_statements(line, root);
+        if (statements == (Statement *) -1){
+            ERR_PRINT(ERR_PARSING_LINE);
+            return -1;
+        }
+        *last_status = execute_statements(statements, root);
+        free_statement(statements);
+        return 0;
+    }
+
+    // a hit skips expansion, lexing and resolution altogether
+    ParseCacheEntry *cached = parse_cache_lookup(line);
+    Command *commands;
+    if (cached != NULL){
+        commands = cached->commands;
+    }
+    else {
+        parse_volatile = 0;
+        commands = parse_line(line, root);
+        if (commands == (Command *) -1){
+            ERR_PRINT(ERR_PARSING_LINE);
+            return -1;
+        }
+        if (commands == NULL) return 0;
+        if (!parse_volatile){
+            cached = parse_cache_store(line, commands);
+        }
+    }
+
+    if (last_line && tail_exec && tail_exec_line(commands) < 0){
+        // it got as far as exec, so the fds are already the command's
+        *last_status = EXEC_FAILED_STATUS;
+        if (cached != NULL) parse_cache_release(cached);
+        else free_command(commands);
+        return 0;
+    }
+
+    int *last_ret_code_pt = execute_line(commands);
+    if (cached != NULL){
+        parse_cache_release(cached);
+    }
+    else {
+        free_command(commands);
+    }
+    if (last_ret_code_pt == (int *) -1){
+        ERR_PRINT(ERR_EXECUTE_LINE);
+        return -2;
+    }
+    if (last_ret_code_pt != NULL){
+        *last_status = *last_ret_code_pt;
+    }
+    mem_free(last_ret_code_pt);
+    return 0;
+}
+
+const char *next_here_doc(const char *text, char *delim, size_t delim_cap){
+    const char *op;
+    while ((op = strstr(text, HERE_DOC_MARKER)) != NULL){
+        size_t run = strspn(op, "<");
+        text = op + run;
+        if (run != 2) continue;
+
+        text += strspn(text, " \t");
+        size_t length = strcspn(text, " \t|<>;#");
+        if (length == 0 || length >= delim_cap) continue;
+        strncpy(delim, text, length);
+        delim[length] = '\0';
+        return text + length;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Reads one line from stream, without its newline, appending it to
+ * the block after the separator sep.
+ * 
+ * @return int: 0 on success, -1 on EOF or error
+ */
+static int append_block_line(char **block, size_t *block_len, size_t *block_cap,
+                             const char *sep, FILE *stream, uint8_t interactive){
+    char next[MAX_SINGLE_LINE];
+    if (interactive){
+        char *read = read_edited_line(CONTINUATION_PROMPT_STR, next, MAX_SINGLE_LINE);
+        if (read == NULL || read == (char *) -1){
+            return -1;
+        }
+    }
+    else if (fgets(next, MAX_SINGLE_LINE, stream) == NULL){
+        return -1;
+    }
+    next[strcspn(next, "\n")] = '\0';
+
+    size_t sep_len = strlen(sep);
+    size_t next_len = strlen(next);
+    if (*block_len + sep_len + next_len + 1 > *block_cap){
+        *block_cap = (*block_len + sep_len + next_len + 1) * 2;
+        char *grown = mem_realloc(*block, *block_cap, MEM_PARSE);
+        if (grown == NULL){
+            perror("complete_block");
+            return -1;
+        }
+        *block = grown;
+    }
+    strcpy(*block + *block_len, sep);
+    *block_len += sep_len;
+    strcpy(*block + *block_len, next);
+    *block_len += next_len;
+    return 0;
+}
+
+/**
+ * @brief Reads the bodies of the here-documents that line's operators start,
+ * each line after a newline, appending them to the bodies so far
+ *
+ * @return int: 0 on success, -1 on error (after saying so)
+ */
+static int read_here_docs(const char *line, char **bodies, size_t *bodies_len,
+                          size_t *bodies_cap, FILE *stream, uint8_t interactive){
+    char delim[MAX_SINGLE_LINE];
+    const char *scan = line;
+    while ((scan = next_here_doc(scan, delim, MAX_SINGLE_LINE)) != NULL){
+        do {
+            if (append_block_line(bodies, bodies_len, bodies_cap, "\n",
+                                  stream, interactive) < 0){
+                ERR_PRINT(ERR_HEREDOC, delim);
+                return -1;
+            }
+        } while (strcmp(strrchr(*bodies, '\n') + 1, delim) != 0);
+    }
+    return 0;
+}
+
+char *complete_block(const char *line, FILE *stream, uint8_t interactive){
+    size_t block_len = strlen(line);
+    size_t block_cap = block_len + 1;
+    char *block = mem_alloc(block_cap, MEM_PARSE);
+    if (block == NULL){
+        perror("complete_block");
+        return NULL;
+    }
+    strcpy(block, line);
+
+    // Here-document bodies follow the line they belong to, but are kept
+    // apart from the block's lines and go after all of them, in order
+    char *bodies = NULL;
+    size_t bodies_len = 0;
+    size_t bodies_cap = 0;
+    size_t line_start = 0;
+    while (1){
+        if (read_here_docs(block + line_start, &bodies, &bodies_len, &bodies_cap,
+                           stream, interactive) < 0){
+            goto error;
+        }
+        if (block_depth(block) <= 0){
+            break;
+        }
+        line_start = block_len + strlen(BLOCK_LINE_SEPARATOR);
+        if (append_block_line(&block, &block_len, &block_cap, BLOCK_LINE_SEPARATOR,
+                              stream, interactive) < 0){
+            ERR_PRINT(ERR_UNCLOSED_BLOCK);
+            goto error;
+        }
+    }
+
+    if (bodies != NULL){
+        char *joined = mem_realloc(block, block_len + bodies_len + 1, MEM_PARSE);
+        if (joined == NULL){
+            perror("complete_block");
+            goto error;
+        }
+        block = joined;
+        strcpy(block + block_len, bodies);
+        mem_free(bodies);
+    }
+    return block;
+
+error:
+    mem_free(block);
+    mem_free(bodies);
+    return NULL;
+}
+
+int run_stream(FILE *stream, Variable **root, int *last_status){
+    int error = 0;
+    // lines are as long as they need to be: a pipeline of thousands of
+    // stages doesn't fit in MAX_SINGLE_LINE
+    char *line = NULL;
+    size_t line_cap = 0;
+
+    while (getline(&line, &line_cap, stream) != -1) {
+        // kill the newline
+        line[strcspn(line, "\n")] = '\0';
+
+        char *block = complete_block(line, stream, 0);
+        if (block == NULL){
+            error = -1;
+            break;
+        }
+
+        // only peeked when it matters: on a pipe it waits for the next line
+        if (tail_exec){
+            int next = fgetc(stream);
+            if (next != EOF){
+                ungetc(next, stream);
+            }
+            on_last_line = next == EOF;
+        }
+
+        int line_error = run_line(block, root, last_status);
+        mem_free(block);
+        if (line_error == -2){
+            error = -2;
+            break;
+        }
+        if (line_error < 0){
+            error = -1;
+        }
+    }
+    free(line);
+    return error;
+}
+
+int run_command_string(char *text, Variable **root){
+    FILE *stream = fmemopen(text, strlen(text), "r");
+    if (stream == NULL){
+        perror("fmemopen");
+        return -1;
+    }
+
+    int last_status = 0;
+    int error = run_stream(stream, root, &last_status);
+    fclose(stream);
+    return error == -2 ? -1 : last_status;
+}
+
 int run_script(char *file_path, Variable **root){
     long error = 0;
-    char line[MAX_SINGLE_LINE];
     FILE *directory;
     
-    // Put the path as the head of the linked list
-    Variable *path = malloc(sizeof(Variable));
-    path->name = malloc(sizeof(char) * 5);
-    strcpy(path->name, "PATH\0");
-    int value_length = strlen(file_path) + 1;
-    // TODO: malloc check
-    char * var_value = malloc(sizeof(char) * value_length);
-    var_value = strncpy(var_value, file_path, value_length - 1);
-    var_value[value_length] = '\0';
-    path->value = var_value;
-    path->next = NULL;
-    *root = path;
+    // Put the path as the head of the linked list, unless the init script
+    // already set one up for us.
+    if (*root == NULL){
+        Variable *path = mem_alloc(sizeof(Variable), MEM_VARIABLES);
+        path->name = mem_strdup(PATH_VAR_NAME, MEM_VARIABLES);
+        path->value = mem_strdup(file_path, MEM_VARIABLES);
+        path->next = NULL;
+        *root = path;
+    }
 
     // Open file
-    directory = fopen(file_path, "r");
+    directory = fopen(file_path, "re");
         if (directory == NULL){
             ERR_PRINT(ERR_BAD_PATH, file_path);
             return -1;
         }
     
-    while (fgets(line, MAX_SINGLE_LINE, directory) != NULL) {
-        // kill the newline
-        line[strlen(line) - 1] = '\0';
-
-        Command *commands = parse_line(line, root);
-        if (commands == (Command *) -1){
-            ERR_PRINT(ERR_PARSING_LINE);
-            error = -1;
-            continue;
-        }
-        if (commands == NULL) continue;
-        int *last_ret_code_pt = execute_line(commands);
-        if (last_ret_code_pt == (int *) -1){
-            ERR_PRINT(ERR_EXECUTE_LINE);
-            free(last_ret_code_pt);
-            return -1;
-        }
-        free(last_ret_code_pt);
+    int last_status = 0;
+    if (parallel_lines > 1){
+        error = run_stream_parallel(directory, root, &last_status);
+    }
+    else {
+        error = run_stream(directory, root, &last_status);
+    }
+    if (error == -2){
+        fclose(directory);
+        return -1;
+    }
+    // only tidies up a terminal; piped output must stay exactly as produced
+    if (isatty(STDOUT_FILENO)){
+        printf("\n");
     }
-    printf("\n");
 
     if (fclose(directory) != 0) {
         error = -1;
     }
 
-    // 0 on EOF, -1 on other errors
-    return (int) error;
+    // the last line's status, whether or not it was exec'd in place
+    return error < 0 ? (int) error : last_status;
 }
 
 void free_command(Command *command){
-    if (command == NULL){
-        return;
-    }
-    else if (command->next == NULL){
-        free(command->exec_path);
-        int i = 0;
-        while ((command->args)[i] != NULL){
-            free((command->args)[i]);
-            i++;
+    while (command != NULL){
+        Command *next = command->next;
+        mem_free(command->exec_path);
+        for (int i = 0; command->args != NULL && command->args[i] != NULL; i++){
+            mem_free((command->args)[i]);
         }
-        free(command->args);
-        free(command->redir_in_path);
-        free(command->redir_out_path);
-        #ifdef DEBUG
-            printf("freed command 2\n");
-        #endif
-        free(command);
-
-    }
-    else{
-        free_command(command->next);
-        #ifdef DEBUG
-            printf("freed command 1\n");
-        #endif
-        free(command);
+        mem_free(command->args);
+        mem_free(command->redir_in_path);
+        mem_free(command->redir_out_path);
+        mem_free(command->here_doc);
+        while (command->more_out != NULL){
+            OutTarget *next_out = command->more_out->next;
+            mem_free(command->more_out->path);
+            mem_free(command->more_out);
+            command->more_out = next_out;
+        }
+        free_command(command->tee_next);
+        mem_free(command);
+        command = next;
     }
 }
@@ -0,0 +1,167 @@
+/*****************************************************************************/
+/*                           CSC209-24s A3 CSCSHELL                          */
+/*       Copyright 2024 -- Demetres Kostas PhD (aka Darlene Heliokinde)      */
+/*****************************************************************************/
+
+#include "cscshell.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86
+#endif
+
+
+/*
+** Every byte is compared against each of these at once, a whole vector
+** of bytes at a time. '$' comes first: it also gets a bitmap of its own.
+*/
+static const char scan_chars[] = {
+    VARIABLE_PARSE_MARKER, ' ', '\t', '\n', COMMENT_MARKER, '=', '<', '>', '|'
+};
+
+#define NUM_SCAN_CHARS (sizeof(scan_chars) / sizeof(scan_chars[0]))
+
+// Scans bytes [start, length) of a line, returning where it stopped
+typedef size_t (*ScanKernel)(const char *line, size_t start, size_t length,
+                             LineScan *scan);
+
+
+/* HELPERS */
+
+/**
+ * @brief Sets the bits for a block of bytes starting at pos. Blocks are 16
+ * or 32 bytes and start at a multiple of their size, so they never
+ * straddle two words.
+ */
+static inline void set_block(uint64_t *bits, size_t pos, uint64_t mask){
+    bits[pos / 64] |= mask << (pos % 64);
+}
+
+/**
+ * @brief The byte at a time kernel, for the tail of a line and CPUs
+ * without vectors
+ */
+static size_t scan_scalar(const char *line, size_t start, size_t length,
+                          LineScan *scan){
+    for (size_t i = start; i < length; i++){
+        if (memchr(scan_chars, line[i], NUM_SCAN_CHARS) != NULL){
+            scan->meta[i / 64] |= (uint64_t) 1 << (i % 64);
+            if (line[i] == VARIABLE_PARSE_MARKER){
+                scan->vars[i / 64] |= (uint64_t) 1 << (i % 64);
+            }
+        }
+    }
+    return length;
+}
+
+#ifdef SCAN_X86
+static size_t scan_sse2(const char *line, size_t start, size_t length,
+                        LineScan *scan){
+    __m128i targets[NUM_SCAN_CHARS];
+    for (int c = 0; c < NUM_SCAN_CHARS; c++){
+        targets[c] = _mm_set1_epi8(scan_chars[c]);
+    }
+
+    size_t i = start;
+    for (; i + 16 <= length; i += 16){
+        __m128i block = _mm_loadu_si128((const __m128i *) (line + i));
+        __m128i dollars = _mm_cmpeq_epi8(block, targets[0]);
+        __m128i found = dollars;
+        for (int c = 1; c < NUM_SCAN_CHARS; c++){
+            found = _mm_or_si128(found, _mm_cmpeq_epi8(block, targets[c]));
+        }
+        set_block(scan->meta, i, (uint16_t) _mm_movemask_epi8(found));
+        set_block(scan->vars, i, (uint16_t) _mm_movemask_epi8(dollars));
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+static size_t scan_avx2(const char *line, size_t start, size_t length,
+                        LineScan *scan){
+    __m256i targets[NUM_SCAN_CHARS];
+    for (int c = 0; c < NUM_SCAN_CHARS; c++){
+        targets[c] = _mm256_set1_epi8(scan_chars[c]);
+    }
+
+    size_t i = start;
+    for (; i + 32 <= length; i += 32){
+        __m256i block = _mm256_loadu_si256((const __m256i *) (line + i));
+        __m256i dollars = _mm256_cmpeq_epi8(block, targets[0]);
+        __m256i found = dollars;
+        for (int c = 1; c < NUM_SCAN_CHARS; c++){
+            found = _mm256_or_si256(found, _mm256_cmpeq_epi8(block, targets[c]));
+        }
+        set_block(scan->meta, i, (uint32_t) _mm256_movemask_epi8(found));
+        set_block(scan->vars, i, (uint32_t) _mm256_movemask_epi8(dollars));
+    }
+    // a 16 byte block may be left before the tail
+    return scan_sse2(line, i, length, scan);
+}
+#endif
+
+/**
+ * @brief Picks the widest kernel this CPU can run, once
+ */
+static ScanKernel pick_kernel(void){
+    static ScanKernel kernel = NULL;
+    if (kernel == NULL){
+        kernel = scan_scalar;
+        #ifdef SCAN_X86
+        kernel = __builtin_cpu_supports("avx2") ? scan_avx2 :
+                 __builtin_cpu_supports("sse2") ? scan_sse2 : scan_scalar;
+        #endif
+    }
+    return kernel;
+}
+
+
+/* SHELL EXTENSION FUNCTIONS */
+
+int scan_line(const char *line, size_t length, LineScan *scan){
+    size_t num_words = (length + 63) / 64;
+    scan->length = length;
+    if (length <= SCAN_INLINE_BYTES){
+        scan->meta = scan->inline_words;
+        scan->vars = scan->inline_words + SCAN_INLINE_WORDS;
+    }
+    else {
+        scan->meta = mem_alloc(sizeof(uint64_t) * num_words * 2, MEM_PARSE);
+        if (scan->meta == NULL){
+            perror("scan_line");
+            return -1;
+        }
+        scan->vars = scan->meta + num_words;
+    }
+    memset(scan->meta, 0, sizeof(uint64_t) * num_words);
+    memset(scan->vars, 0, sizeof(uint64_t) * num_words);
+
+    size_t done = pick_kernel()(line, 0, length, scan);
+    scan_scalar(line, done, length, scan);
+    return 0;
+}
+
+size_t scan_next(const uint64_t *bits, size_t length, size_t from){
+    if (from >= length){
+        return length;
+    }
+    size_t word = from / 64;
+    // drop the bits before from in its word
+    uint64_t remaining = bits[word] & (~(uint64_t) 0 << (from % 64));
+    size_t num_words = (length + 63) / 64;
+    while (remaining == 0){
+        if (++word == num_words){
+            return length;
+        }
+        remaining = bits[word];
+    }
+    size_t pos = word * 64 + __builtin_ctzll(remaining);
+    return pos < length ? pos : length;
+}
+
+void free_line_scan(LineScan *scan){
+    if (scan->meta != scan->inline_words){
+        mem_free(scan->meta);
+    }
+    scan->meta = scan->vars = NULL;
+}
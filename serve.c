@@ -0,0 +1,252 @@
+/*****************************************************************************/
+/*                           CSC209-24s A3 CSCSHELL                          */
+/*       Copyright 2024 -- Demetres Kostas PhD (aka Darlene Heliokinde)      */
+/*****************************************************************************/
+
+#include "cscshell.h"
+
+
+static volatile sig_atomic_t serve_stopping = 0;
+
+
+/* HELPERS */
+
+static void stop_serving(int signum){
+    serve_stopping = 1;
+}
+
+/**
+ * @brief Reaps every client that is done, as soon as it is, so an idle
+ * server doesn't collect zombies until the next connection
+ */
+static void reap_clients(int signum){
+    int saved_errno = errno;
+    while (waitpid(-1, NULL, WNOHANG) > 0);
+    errno = saved_errno;
+}
+
+/**
+ * @brief Reads exactly n bytes, retrying short reads
+ *
+ * @return int: 0 on success, 1 on EOF before any byte, -1 on error
+ */
+static int read_full(int fd, void *buf, size_t n){
+    size_t done = 0;
+    while (done < n){
+        ssize_t got = read(fd, (char *) buf + done, n - done);
+        if (got < 0){
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (got == 0){
+            return done == 0 ? 1 : -1;
+        }
+        done += got;
+    }
+    return 0;
+}
+
+/**
+ * @brief Receives a request header and the fds attached to it
+ *
+ * @param client: the client socket
+ * @param header: filled in with the header
+ * @param fds: filled in with the stdin and stdout fds, -1 where not sent
+ * @return int: 0 on success, 1 once the client hangs up, -1 on error
+ */
+static int receive_header(int client, ServeHeader *header, int fds[2]){
+    char control[CMSG_SPACE(sizeof(int) * 2)];
+    struct iovec iov = {header, sizeof(ServeHeader)};
+    struct msghdr msg = {0};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t got;
+    do {
+        got = recvmsg(client, &msg, MSG_CMSG_CLOEXEC);
+    } while (got < 0 && errno == EINTR);
+    if (got <= 0){
+        return got == 0 ? 1 : -1;
+    }
+
+    int received[2] = {-1, -1};
+    int num_received = 0;
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+         cmsg = CMSG_NXTHDR(&msg, cmsg)){
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS){
+            continue;
+        }
+        int count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (int i = 0; i < count && num_received < 2; i++){
+            memcpy(&received[num_received++], CMSG_DATA(cmsg) + sizeof(int) * i,
+                   sizeof(int));
+        }
+    }
+
+    // the rest of the header may trail behind the fds
+    if (got < sizeof(ServeHeader) &&
+        read_full(client, (char *) header + got, sizeof(ServeHeader) - got) != 0){
+        got = -1;
+    }
+
+    int next = 0;
+    fds[0] = (header->flags & SERVE_STDIN) ? received[next++] : -1;
+    fds[1] = (header->flags & SERVE_STDOUT) ? received[next++] : -1;
+    if (got < 0 || next != num_received || header->length > SERVE_MAX_REQUEST){
+        for (int i = 0; i < num_received; i++){
+            close(received[i]);
+        }
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Runs one request with the client's fds as stdin / stdout, then
+ * puts the shell's own back.
+ *
+ * @param saved: the shell's own stdin and stdout
+ * @return int: 0 on success, 1 once the client hangs up, -1 on error
+ */
+static int serve_request(int client, Variable **root, int saved[2]){
+    ServeHeader header;
+    int fds[2];
+    int received = receive_header(client, &header, fds);
+    if (received != 0){
+        return received;
+    }
+
+    char *text = mem_alloc(header.length + 1, MEM_EXECUTION);
+    if (text == NULL || read_full(client, text, header.length) != 0){
+        mem_free(text);
+        for (int i = 0; i < 2; i++){
+            if (fds[i] >= 0) close(fds[i]);
+        }
+        return -1;
+    }
+    text[header.length] = '\0';
+
+    fflush(stdout);
+    for (int i = 0; i < 2; i++){
+        if (fds[i] >= 0){
+            dup2(fds[i], i);
+            close(fds[i]);
+        }
+    }
+
+    int32_t status = run_command_string(text, root);
+    mem_free(text);
+
+    fflush(stdout);
+    sync_fd_reader(STDIN_FILENO);
+    dup2(saved[STDIN_FILENO], STDIN_FILENO);
+    dup2(saved[STDOUT_FILENO], STDOUT_FILENO);
+
+    ssize_t sent;
+    do {
+        sent = send(client, &status, sizeof(status), MSG_NOSIGNAL);
+    } while (sent < 0 && errno == EINTR);
+    return sent == sizeof(status) ? 0 : -1;
+}
+
+/**
+ * @brief Serves one client until it hangs up. Runs in its own fork, so its
+ * cd's and variables stay its own. Never returns.
+ */
+static void serve_client(int client, Variable **root){
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    // the commands' own children are waited for by whoever started them
+    signal(SIGCHLD, SIG_DFL);
+
+    int saved[2] = {fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 0),
+                    fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0)};
+    if (saved[0] < 0 || saved[1] < 0){
+        perror("serve");
+        _exit(1);
+    }
+
+    int result;
+    while ((result = serve_request(client, root, saved)) == 0);
+    if (result < 0){
+        ERR_PRINT(ERR_SERVE_REQUEST);
+    }
+    close(client);
+    fflush(stdout);
+    _exit(result < 0);
+}
+
+
+/* SHELL EXTENSION FUNCTIONS */
+
+int serve(const char *socket_path, Variable **root){
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr.sun_path)){
+        ERR_PRINT(ERR_BAD_PATH, socket_path);
+        return -1;
+    }
+    strcpy(addr.sun_path, socket_path);
+
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listener < 0){
+        perror("serve");
+        return -1;
+    }
+    // only a socket left behind by an earlier server is replaced
+    struct stat info;
+    if (lstat(socket_path, &info) == 0){
+        if (!S_ISSOCK(info.st_mode)){
+            ERR_PRINT(ERR_SERVE_NOT_SOCKET, socket_path);
+            close(listener);
+            return -1;
+        }
+        unlink(socket_path);
+    }
+    if (bind(listener, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+        listen(listener, SERVE_BACKLOG) < 0){
+        perror("serve");
+        close(listener);
+        return -1;
+    }
+
+    // no SA_RESTART, so accept returns once we're asked to stop
+    struct sigaction stop = {0};
+    stop.sa_handler = stop_serving;
+    sigaction(SIGINT, &stop, NULL);
+    sigaction(SIGTERM, &stop, NULL);
+    struct sigaction reap = {0};
+    reap.sa_handler = reap_clients;
+    reap.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+    sigaction(SIGCHLD, &reap, NULL);
+
+    // whatever the init script printed should only come out once
+    fflush(stdout);
+    while (!serve_stopping){
+        int client = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+        if (client < 0){
+            if (errno != EINTR){
+                perror("serve");
+            }
+            continue;
+        }
+
+        pid_t pid = fork();
+        if (pid == 0){
+            close(listener);
+            serve_client(client, root);
+        }
+        if (pid < 0){
+            perror("fork");
+        }
+        close(client);
+    }
+
+    close(listener);
+    unlink(socket_path);
+    signal(SIGCHLD, SIG_DFL);
+    while (waitpid(-1, NULL, 0) > 0);
+    return 0;
+}
@@ -0,0 +1,83 @@
+/*****************************************************************************/
+/*                           CSC209-24s A3 CSCSHELL                          */
+/*       Copyright 2024 -- Demetres Kostas PhD (aka Darlene Heliokinde)      */
+/*****************************************************************************/
+
+#include "cscshell.h"
+
+
+SessionStats session_stats = {0};
+
+
+/* HELPERS */
+
+/**
+ * @brief Converts a timeval to seconds
+ */
+static double tv_seconds(struct timeval tv){
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+
+/* SHELL EXTENSION FUNCTIONS */
+
+pid_t wait_child(pid_t pid, int *status){
+    uint64_t trace_start = TRACE_START();
+    struct rusage usage;
+    pid_t reaped;
+    do {
+        reaped = wait4(pid, status, 0, &usage);
+    } while (reaped == -1 && errno == EINTR);
+    if (reaped == -1){
+        return -1;
+    }
+    if (TRACE_ON){
+        char detail[MAX_USER_BUF];
+        if (WIFSIGNALED(*status)){
+            snprintf(detail, MAX_USER_BUF, "signal=%d", WTERMSIG(*status));
+        }
+        else {
+            snprintf(detail, MAX_USER_BUF, "status=%d", WEXITSTATUS(*status));
+        }
+        trace_event("wait", trace_start, reaped, detail);
+    }
+
+    timeradd(&session_stats.child_utime, &usage.ru_utime,
+             &session_stats.child_utime);
+    timeradd(&session_stats.child_stime, &usage.ru_stime,
+             &session_stats.child_stime);
+    if (usage.ru_maxrss > session_stats.peak_child_rss_kb){
+        session_stats.peak_child_rss_kb = usage.ru_maxrss;
+    }
+    if (WIFEXITED(*status) && WEXITSTATUS(*status) == EXEC_FAILED_STATUS){
+        session_stats.exec_failures++;
+    }
+    return reaped;
+}
+
+void print_session_stats(FILE *stream){
+    struct rusage self;
+    if (getrusage(RUSAGE_SELF, &self) < 0){
+        perror("print_session_stats");
+        return;
+    }
+    struct timeval now, wall;
+    gettimeofday(&now, NULL);
+    timersub(&now, &session_stats.start, &wall);
+
+    double child_cpu = tv_seconds(session_stats.child_utime) +
+                       tv_seconds(session_stats.child_stime);
+    fprintf(stream, "---- cscshell session stats ----\n");
+    fprintf(stream, "wall time:        %.3fs\n", tv_seconds(wall));
+    fprintf(stream, "shell cpu:        %.3fs (user %.3fs, sys %.3fs)\n",
+            tv_seconds(self.ru_utime) + tv_seconds(self.ru_stime),
+            tv_seconds(self.ru_utime), tv_seconds(self.ru_stime));
+    fprintf(stream, "children cpu:     %.3fs (user %.3fs, sys %.3fs)\n",
+            child_cpu, tv_seconds(session_stats.child_utime),
+            tv_seconds(session_stats.child_stime));
+    fprintf(stream, "peak child rss:   %ld KiB\n", session_stats.peak_child_rss_kb);
+    fprintf(stream, "shell peak rss:   %ld KiB\n", self.ru_maxrss);
+    fprintf(stream, "forks:            %lu\n", (unsigned long) session_stats.forks);
+    fprintf(stream, "exec failures:    %lu\n",
+            (unsigned long) session_stats.exec_failures);
+}
@@ -0,0 +1,14 @@
+echo $((1 + 2 * 3)) $(((1 + 2) * 3)) $((7 / 2)) $((7 % 3)) $((-4 + 1))
+x=6
+y=4
+echo $((x * y)) $(($x - $y)) $((x > y)) $((x <= y)) $((x == 6)) $((x != 6))
+echo $((!0)) $((!x)) $((- -x))
+echo sum=$((x+y))
+echo $((1/0))
+echo $((2 +))
+x=$((x * 2))
+echo x=$x
+cat <<EOF
+in a here-document: $((x + 1))
+EOF
+echo done
@@ -0,0 +1,7 @@
+a=first
+echo a=b
+echo $a
+echo a=b; echo $a
+for w in x; do echo w=$w; done
+  b=blank
+echo b=$b
@@ -0,0 +1,13 @@
+echo {a,b,c}
+echo pre{x,y}post
+echo {1..5}
+echo {5..1}
+echo {0..10..3}
+echo {a..e}
+echo {1,2}{a,b}
+echo {a,{b,c}}d
+echo {single} {} a{,b}
+for i in {1..3}; do echo i=$i; done
+echo {1..100000000}
+echo {-9223372036854775808..9223372036854775807}
+echo after
@@ -0,0 +1,3 @@
+echo before
+exec echo done
+echo never
@@ -0,0 +1 @@
+sh tests/exit_status.in
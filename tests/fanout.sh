@@ -0,0 +1,14 @@
+echo first > /tmp/cscshell-fanout-a
+seq 3 > /tmp/cscshell-fanout-a >> /tmp/cscshell-fanout-b > /tmp/cscshell-fanout-c
+seq 4 5 >> /tmp/cscshell-fanout-a >> /tmp/cscshell-fanout-b
+cat /tmp/cscshell-fanout-a
+cat /tmp/cscshell-fanout-b
+cat /tmp/cscshell-fanout-c
+echo hello |& tr a-z A-Z
+echo piped > /tmp/cscshell-fanout-c |& tr a-z A-Z > /tmp/cscshell-fanout-b
+cat /tmp/cscshell-fanout-c /tmp/cscshell-fanout-b
+seq 100000 > /tmp/cscshell-fanout-a |& head -n 2
+wc -l /tmp/cscshell-fanout-a
+for i in 1 2 3; do echo $i >> /tmp/cscshell-fanout-b >> /tmp/cscshell-fanout-c; done
+cat /tmp/cscshell-fanout-b /tmp/cscshell-fanout-c
+rm /tmp/cscshell-fanout-a /tmp/cscshell-fanout-b /tmp/cscshell-fanout-c
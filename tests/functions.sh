@@ -0,0 +1,15 @@
+greet() { echo hello $1 from $0; }
+greet world
+show() {
+echo count=$#
+echo all=$@
+}
+show a b c
+show
+twice() { $1; $1; }
+hi() { echo hi; }
+twice hi
+greet piped | tr a-z A-Z
+for x in 1 2; do greet $x; done
+greet() { echo redefined $1; }
+greet again
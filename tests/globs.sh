@@ -0,0 +1,16 @@
+mkdir -p /tmp/cscshell-glob-check/sub
+touch /tmp/cscshell-glob-check/b.txt /tmp/cscshell-glob-check/a.txt /tmp/cscshell-glob-check/c.log /tmp/cscshell-glob-check/.hidden /tmp/cscshell-glob-check/sub/d.txt
+cd /tmp/cscshell-glob-check
+echo *.txt
+echo ?.log
+echo [ab].txt
+echo *
+echo */*.txt
+echo *.none
+echo .*
+for f in *.txt c.*; do echo file $f; done
+for f in {a,b}.txt; do echo brace $f; done
+touch e.txt
+echo *.txt
+cd /
+rm -r /tmp/cscshell-glob-check
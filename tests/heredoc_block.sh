@@ -0,0 +1,17 @@
+for x in a b; do
+cat <<EOF
+hi $x; not a separator # nor a comment
+EOF
+done
+echo after
+cat <<A; cat <<B
+first
+A
+second
+B
+while false; do
+echo never
+done
+cat <<EOF | tr a-z A-Z
+piped
+EOF
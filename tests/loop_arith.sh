@@ -0,0 +1,7 @@
+for i in 1 3; do echo $((i>2)) $((i<2)) $((i>=3)) $((i<=1)); done
+n=0
+while [ $n -lt 3 ]; do n=$((n + 1)); echo $((n*n)); done
+for i in 1 2; do echo $(( i == 2 )) $((i!=2)); done
+f() { echo $(($1>1)); }
+f 1; f 2
+echo $((3>2))
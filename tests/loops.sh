@@ -0,0 +1,10 @@
+for i in a b c; do echo item $i; done
+for i in 1 2; do for j in x y; do echo $i$j; done; done
+n=0
+while [ $n -lt 3 ]; do
+echo n=$n
+n=$((n + 1))
+done
+for w in one two; do echo $w | tr a-z A-Z; done
+for f in; do echo never; done
+echo after loops
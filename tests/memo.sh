@@ -0,0 +1,16 @@
+MEMO_DIR=/tmp/cscshell-memo-check
+rm -rf /tmp/cscshell-memo-check
+echo one > /tmp/cscshell-memo-input
+memo date +%N > /tmp/cscshell-memo-1
+memo date +%N > /tmp/cscshell-memo-2
+diff /tmp/cscshell-memo-1 /tmp/cscshell-memo-2
+echo replayed
+memo -i /tmp/cscshell-memo-input cat /tmp/cscshell-memo-input
+memo -i /tmp/cscshell-memo-input cat /tmp/cscshell-memo-input
+echo two > /tmp/cscshell-memo-input
+memo -i /tmp/cscshell-memo-input cat /tmp/cscshell-memo-input
+memo seq 3 | tr 1-3 a-c
+memo seq 3 | tr 1-3 a-c
+memo nosuchcmd
+echo done
+rm -r /tmp/cscshell-memo-check /tmp/cscshell-memo-input /tmp/cscshell-memo-1 /tmp/cscshell-memo-2
@@ -0,0 +1 @@
+./cscshell --parallel-lines=4 tests/parallel_lines.in
@@ -0,0 +1,20 @@
+read a b <<EOF
+first second third
+EOF
+echo a=$a b=$b
+cat > /tmp/cscshell-read-check <<EOF
+one
+two
+three
+EOF
+read x < /tmp/cscshell-read-check
+echo x=$x
+read -d t y < /tmp/cscshell-read-check
+echo y=$y
+sh tests/read_builtin.in
+rm /tmp/cscshell-read-check
+IFS=:
+read p q <<EOF
+left:right:more
+EOF
+echo p=$p q=$q
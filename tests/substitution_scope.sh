@@ -0,0 +1,5 @@
+b=1
+a=$(b=7)
+echo $b
+d=$(echo $b x)
+echo $d
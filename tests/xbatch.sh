@@ -0,0 +1,7 @@
+xbatch echo {1..200000} | wc -w
+xbatch -k 1 printf %s\n {1..200000} | wc -l
+xbatch -k 1 printf %s\n {1..200000} | tail -n 1
+xbatch -P 4 -k 1 printf %s\n {1..200000} | wc -l
+xbatch echo small args
+xbatch -P 0 echo bad
+echo done
@@ -0,0 +1,87 @@
+/*****************************************************************************/
+/*                           CSC209-24s A3 CSCSHELL                          */
+/*       Copyright 2024 -- Demetres Kostas PhD (aka Darlene Heliokinde)      */
+/*****************************************************************************/
+
+#include "cscshell.h"
+#include <time.h>
+
+
+int trace_fd = -1;
+static uint64_t trace_line = 0;
+
+
+/* HELPERS */
+
+/**
+ * @brief Copies src into dst as the inside of a JSON string, truncating
+ * it if it doesn't fit.
+ * 
+ * @return size_t: the number of bytes written (dst is null terminated)
+ */
+static size_t json_escape(char *dst, size_t cap, const char *src){
+    size_t n = 0;
+    for (; src != NULL && *src != '\0' && n + 7 < cap; src++){
+        unsigned char c = *src;
+        if (c == '"' || c == '\\'){
+            dst[n++] = '\\';
+            dst[n++] = c;
+        }
+        else if (c < 0x20){
+            n += snprintf(dst + n, cap - n, "\\u%04x", c);
+        }
+        else {
+            dst[n++] = c;
+        }
+    }
+    dst[n] = '\0';
+    return n;
+}
+
+
+/* SHELL EXTENSION FUNCTIONS */
+
+int trace_open(const char *path){
+    trace_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC,
+                    0644);
+    if (trace_fd < 0){
+        perror(path);
+        return -1;
+    }
+    return 0;
+}
+
+uint64_t trace_clock(void){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+void trace_next_line(void){
+    trace_line++;
+}
+
+void trace_event(const char *phase, uint64_t start, pid_t pid,
+                 const char *detail){
+    uint64_t end = trace_clock();
+    char escaped[TRACE_DETAIL_MAX];
+    json_escape(escaped, TRACE_DETAIL_MAX, detail);
+
+    // One write per event, so events from children (O_APPEND) never interleave
+    char event[TRACE_DETAIL_MAX + 128];
+    int length = snprintf(event, sizeof(event),
+        "{\"ts\":%llu,\"line\":%llu,\"phase\":\"%s\",\"dur_ns\":%llu,"
+        "\"pid\":%d,\"detail\":\"%s\"}\n",
+        (unsigned long long) start, (unsigned long long) trace_line, phase,
+        (unsigned long long) (end - start), (int) pid, escaped);
+    if (length >= (int) sizeof(event)){
+        // cut short, but still one line of its own
+        length = sizeof(event) - 1;
+        event[length - 1] = '\n';
+    }
+    if (write(trace_fd, event, length) < 0){
+        // a broken trace file shouldn't take the shell down with it
+        close(trace_fd);
+        trace_fd = -1;
+    }
+}
@@ -0,0 +1,210 @@
+/*****************************************************************************/
+/*                           CSC209-24s A3 CSCSHELL                          */
+/*       Copyright 2024 -- Demetres Kostas PhD (aka Darlene Heliokinde)      */
+/*****************************************************************************/
+
+#include "cscshell.h"
+#include <sys/mman.h>
+
+
+/*
+** The kernel counts every arg and environment string (with its
+** terminator) and the pointer to it against ARG_MAX, and refuses any one
+** string over MAX_ARG_STRLEN (32 pages). xbatch fills each batch up to
+** that, less XBATCH_HEADROOM for what the count doesn't cover exactly.
+** Batches only point at the original args; nothing is copied.
+*/
+
+
+/* HELPERS */
+
+/**
+ * @brief The bytes a list of strings takes against ARG_MAX, with its NULL
+ */
+static size_t strings_size(char **strings){
+    size_t size = sizeof(char *);
+    for (int i = 0; strings[i] != NULL; i++){
+        size += strlen(strings[i]) + 1 + sizeof(char *);
+    }
+    return size;
+}
+
+static size_t arg_strlen_max(void){
+    return 32 * (size_t) sysconf(_SC_PAGESIZE);
+}
+
+/**
+ * @brief Checks one command that will be exec'd against the limits
+ *
+ * @return uint8_t: 1 (after saying so) if the kernel would refuse it
+ */
+static uint8_t command_exceeds_arg_max(Command *command){
+    if (find_builtin(command->args[0]) != NULL ||
+        find_function(command->args[0]) != NULL){
+        return 0; // never exec'd
+    }
+    long limit = sysconf(_SC_ARG_MAX);
+    size_t size = strings_size(command->args) + strings_size(environ);
+    if (limit > 0 && size > (size_t) limit){
+        ERR_PRINT(ERR_ARG_MAX, command->args[0], size, limit);
+        return 1;
+    }
+    for (int i = 1; command->args[i] != NULL; i++){
+        if (strlen(command->args[i]) >= arg_strlen_max()){
+            ERR_PRINT(ERR_ARG_TOO_LONG, command->args[0], command->args[i]);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Waits for one batch to finish, keeping the highest exit code
+ *
+ * @return int: 0 on success, -1 on error
+ */
+static int reap_batch(int *worst){
+    int status;
+    if (wait_child(-1, &status) == -1){
+        perror("waitpid");
+        return -1;
+    }
+    int code = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    *worst = code > *worst ? code : *worst;
+    return 0;
+}
+
+
+/* SHELL EXTENSION FUNCTIONS */
+
+uint8_t exceeds_arg_max(Command *head){
+    for (Command *branch = head; branch != NULL; branch = branch->tee_next){
+        for (Command *curr = branch; curr != NULL; curr = curr->next){
+            if (command_exceeds_arg_max(curr)){
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+int xbatch_run(Command *command, int first, int num_fixed, int max_jobs,
+               BuiltinOutput *out){
+    char **fixed = command->args + first;
+    char **tail = fixed + 1 + num_fixed;
+    int num_tail = 0;
+    while (tail[num_tail] != NULL){
+        num_tail++;
+    }
+
+    // what every batch starts with: the command, its fixed args, the env
+    long limit = sysconf(_SC_ARG_MAX);
+    size_t base = strings_size(environ) + sizeof(char *);
+    for (int i = 0; i <= num_fixed; i++){
+        base += strlen(fixed[i]) + 1 + sizeof(char *);
+    }
+    size_t budget = limit > 0 && (size_t) limit > base + XBATCH_HEADROOM ?
+                    limit - base - XBATCH_HEADROOM : 0;
+    for (int i = 0; i < num_tail; i++){
+        size_t size = strlen(tail[i]) + 1 + sizeof(char *);
+        if (size > budget || strlen(tail[i]) >= arg_strlen_max()){
+            ERR_PRINT(ERR_ARG_TOO_LONG, fixed[0], tail[i]);
+            return ARG_TOO_LONG_STATUS;
+        }
+    }
+
+    Command child = *command;
+    child.next = NULL;
+    child.tee_next = NULL;
+    child.more_out = NULL;
+    child.redir_in_path = NULL;
+    child.redir_out_path = NULL;
+    child.here_doc = NULL;
+    child.exec_path = NULL;
+    if (find_builtin(fixed[0]) == NULL && find_function(fixed[0]) == NULL){
+        child.exec_path = resolve_executable(fixed[0], *command->variables);
+        if (child.exec_path == NULL){
+            ERR_PRINT(ERR_NO_EXECU, fixed[0]);
+            return EXEC_FAILED_STATUS;
+        }
+    }
+
+    // one argv for every batch: fork copies it, so it can be refilled as
+    // soon as each batch starts
+    char **argv = mem_alloc(sizeof(char *) * (num_fixed + num_tail + 2),
+                            MEM_EXECUTION);
+    // captured output is collected after each batch, so they go one by one
+    int out_fd = out->capture == NULL ? out->fd :
+                 memfd_create(XBATCH_MEMFD_NAME, MFD_CLOEXEC);
+    if (argv == NULL || out_fd < 0){
+        perror("xbatch");
+        mem_free(argv);
+        mem_free(child.exec_path);
+        return -1;
+    }
+    if (out->capture != NULL){
+        max_jobs = 1;
+    }
+    memcpy(argv, fixed, sizeof(char *) * (num_fixed + 1));
+    child.args = argv;
+
+    int worst = 0;
+    int running = 0;
+    int next = 0;
+    int error = 0;
+    // with no tail at all, the command still runs once
+    do {
+        int num_args = num_fixed + 1;
+        size_t used = 0;
+        while (next < num_tail){
+            size_t size = strlen(tail[next]) + 1 + sizeof(char *);
+            if (used + size > budget) break;
+            used += size;
+            argv[num_args++] = tail[next++];
+        }
+        argv[num_args] = NULL;
+
+        if (running == max_jobs){
+            if (reap_batch(&worst) < 0){
+                error = 1;
+                break;
+            }
+            running--;
+        }
+
+        // run_command closes both in the parent; the originals stay ours
+        child.stdout_fd = dup(out_fd);
+        child.stdin_fd = command->stdin_fd == STDIN_FILENO ? STDIN_FILENO :
+                         dup(command->stdin_fd);
+        if (child.stdout_fd < 0 || child.stdin_fd < 0){
+            perror("xbatch");
+        }
+        if (child.stdout_fd < 0 || child.stdin_fd < 0 || run_command(&child) < 0){
+            if (child.stdout_fd >= 0) close(child.stdout_fd);
+            if (child.stdin_fd > STDIN_FILENO) close(child.stdin_fd);
+            error = 1;
+            break;
+        }
+        running++;
+
+        if (out->capture != NULL){
+            error = reap_batch(&worst) < 0 || builtin_write_fd(out, out_fd) < 0;
+            running--;
+        }
+    } while (next < num_tail && !error);
+
+    while (running > 0){
+        if (reap_batch(&worst) < 0){
+            error = 1;
+            break;
+        }
+        running--;
+    }
+
+    if (out->capture != NULL){
+        close(out_fd);
+    }
+    mem_free(argv);
+    mem_free(child.exec_path);
+    return error ? -1 : worst;
+}